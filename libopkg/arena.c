@@ -0,0 +1,132 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* arena.c - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "opkg_message.h"
+#include "xfuncs.h"
+
+#define ARENA_MIN_BLOCK_SIZE 1024
+
+/* Good enough for every object allocated from an arena. */
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define arena_align(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_block {
+    arena_block_t *next;
+};
+
+#define ARENA_HEADER_SIZE arena_align(sizeof(arena_block_t))
+
+static char *arena_new_block(arena_t * arena, size_t size)
+{
+    arena_block_t *block;
+
+    block = xmalloc(ARENA_HEADER_SIZE + size);
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->n_blocks++;
+
+    return (char *)block + ARENA_HEADER_SIZE;
+}
+
+void arena_init(const char *name, arena_t * arena, size_t block_size)
+{
+    memset(arena, 0, sizeof(arena_t));
+
+    if (block_size < ARENA_MIN_BLOCK_SIZE)
+        block_size = ARENA_MIN_BLOCK_SIZE;
+
+    arena->name = name;
+    arena->block_size = arena_align(block_size);
+}
+
+void arena_deinit(arena_t * arena)
+{
+    arena_block_t *block, *next;
+
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    arena->blocks = NULL;
+    arena->next = arena->end = NULL;
+    arena->n_blocks = 0;
+    arena->n_bytes = 0;
+}
+
+void arena_print_stats(arena_t * arena)
+{
+    printf("arena: %s, %lu bytes\n"
+           "\tn_blocks=%u, block_size=%lu\n", arena->name,
+           (unsigned long)arena->n_bytes, arena->n_blocks,
+           (unsigned long)arena->block_size);
+}
+
+void *arena_calloc(arena_t * arena, size_t nmemb, size_t size)
+{
+    char *ptr;
+    size_t len;
+
+    if (size && nmemb > SIZE_MAX / size) {
+        opkg_msg(ERROR, "Arena allocation of %lu * %lu bytes overflows.\n",
+                 (unsigned long)nmemb, (unsigned long)size);
+        exit(EXIT_FAILURE);
+    }
+
+    len = arena_align(nmemb * size);
+    if (!len)
+        len = ARENA_ALIGN;
+
+    if ((size_t)(arena->end - arena->next) >= len) {
+        ptr = arena->next;
+        arena->next += len;
+    } else if (len > arena->block_size / 4) {
+        /* Would waste most of a block; give it one of its own and keep
+         * filling the current one. */
+        ptr = arena_new_block(arena, len);
+    } else {
+        ptr = arena_new_block(arena, arena->block_size);
+        arena->next = ptr + len;
+        arena->end = ptr + arena->block_size;
+    }
+
+    arena->n_bytes += len;
+    memset(ptr, 0, len);
+
+    return ptr;
+}
+
+char *arena_strdup(arena_t * arena, const char *s)
+{
+    size_t len;
+    char *t;
+
+    if (s == NULL)
+        return NULL;
+
+    len = strlen(s) + 1;
+    t = arena_calloc(arena, len, 1);
+    memcpy(t, s, len);
+
+    return t;
+}
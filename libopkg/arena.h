@@ -0,0 +1,54 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* arena.h - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A bump allocator: memory is carved out of a few large blocks and can only
+ * be released all at once, by arena_deinit().
+ */
+typedef struct arena_block arena_block_t;
+typedef struct arena arena_t;
+
+struct arena {
+    const char *name;
+    arena_block_t *blocks;
+    char *next;
+    char *end;
+    size_t block_size;
+
+    /* useful stats */
+    unsigned int n_blocks;
+    size_t n_bytes;
+};
+
+void arena_init(const char *name, arena_t * arena, size_t block_size);
+void arena_deinit(arena_t * arena);
+void arena_print_stats(arena_t * arena);
+/* Returns zeroed memory, like xcalloc(). */
+void *arena_calloc(arena_t * arena, size_t nmemb, size_t size);
+char *arena_strdup(arena_t * arena, const char *s);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* ARENA_H */
@@ -0,0 +1,316 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* file_commit.c - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "file_commit.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "str_list.h"
+#include "xfuncs.h"
+
+#define FILE_COMMIT_SUFFIX ".new"
+
+typedef struct file_commit_entry file_commit_entry_t;
+
+struct file_commit_entry {
+    char *path;
+    char *tmp_path;
+    FILE *fp;                   /* set while the file is being written */
+    file_commit_entry_t *next;
+};
+
+/* The files waiting for file_commit(), most recent first. */
+static file_commit_entry_t *pending;
+
+/* Directories on the file systems to sync, besides those of pending. */
+static str_list_t *touched;
+
+static int file_commit_batch(void)
+{
+    return strcmp(opkg_config->durability, OPKG_CONF_DURABILITY_BATCH) == 0;
+}
+
+static file_commit_entry_t *file_commit_find(const char *path)
+{
+    file_commit_entry_t *entry;
+
+    for (entry = pending; entry; entry = entry->next)
+        if (strcmp(entry->path, path) == 0)
+            return entry;
+
+    return NULL;
+}
+
+static void file_commit_free(file_commit_entry_t * entry)
+{
+    file_commit_entry_t **p;
+
+    for (p = &pending; *p; p = &(*p)->next) {
+        if (*p == entry) {
+            *p = entry->next;
+            break;
+        }
+    }
+
+    free(entry->path);
+    free(entry->tmp_path);
+    free(entry);
+}
+
+FILE *file_commit_open(const char *path)
+{
+    file_commit_entry_t *entry;
+    FILE *fp;
+
+    if (!file_commit_batch())
+        return fopen(path, "w");
+
+    /* A file written twice in a transaction keeps its first entry. */
+    entry = file_commit_find(path);
+    if (!entry) {
+        entry = xcalloc(1, sizeof(*entry));
+        entry->path = xstrdup(path);
+        sprintf_alloc(&entry->tmp_path, "%s%s", path, FILE_COMMIT_SUFFIX);
+        entry->next = pending;
+        pending = entry;
+    }
+
+    fp = fopen(entry->tmp_path, "w");
+    if (!fp) {
+        int err = errno;
+        file_commit_free(entry);
+        errno = err;
+        return NULL;
+    }
+
+    entry->fp = fp;
+    return fp;
+}
+
+int file_commit_close(FILE * fp)
+{
+    file_commit_entry_t *entry;
+    int r;
+
+    for (entry = pending; entry; entry = entry->next)
+        if (entry->fp == fp)
+            break;
+
+    r = fclose(fp);
+    if (!entry)
+        return r;
+
+    entry->fp = NULL;
+    if (r != 0) {
+        unlink(entry->tmp_path);
+        file_commit_free(entry);
+    }
+
+    return r;
+}
+
+const char *file_commit_path(const char *path)
+{
+    file_commit_entry_t *entry = file_commit_find(path);
+
+    return entry ? entry->tmp_path : path;
+}
+
+void file_commit_cancel(const char *path)
+{
+    file_commit_entry_t *entry = file_commit_find(path);
+
+    if (entry) {
+        unlink(entry->tmp_path);
+        file_commit_free(entry);
+    }
+}
+
+void file_commit_touch(const char *dir)
+{
+    if (!file_commit_batch())
+        return;
+
+    if (!touched)
+        touched = str_list_alloc();
+
+    if (!str_list_contains(touched, dir, 0))
+        str_list_append(touched, (char *)dir);
+}
+
+/* Runs fn on an open descriptor of each directory in dirs, or only on the
+ * first directory of each file system if per_fs is set. */
+static int file_commit_each_dir(str_list_t * dirs, int per_fs,
+                                int (*fn) (int), const char *what)
+{
+    str_list_elt_t *iter;
+    dev_t *devs = NULL;
+    unsigned int n_devs = 0, i;
+    struct stat st;
+    const char *dir;
+    int fd, ret = 0;
+
+    for (iter = str_list_first(dirs); iter; iter = str_list_next(dirs, iter)) {
+        dir = (const char *)iter->data;
+
+        fd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (fd == -1) {
+            /* Removed since, nothing of it to sync. */
+            if (errno != ENOENT) {
+                opkg_perror(ERROR, "Failed to open %s", dir);
+                ret = -1;
+            }
+            continue;
+        }
+
+        if (per_fs) {
+            if (fstat(fd, &st) != 0) {
+                opkg_perror(ERROR, "Failed to stat %s", dir);
+                close(fd);
+                ret = -1;
+                continue;
+            }
+            for (i = 0; i < n_devs; i++)
+                if (devs[i] == st.st_dev)
+                    break;
+            if (i < n_devs) {
+                close(fd);
+                continue;
+            }
+            devs = xrealloc(devs, (n_devs + 1) * sizeof(dev_t));
+            devs[n_devs++] = st.st_dev;
+        }
+
+        if (fn(fd) != 0 && errno != EINVAL && errno != EROFS) {
+            opkg_perror(ERROR, "Failed to %s %s", what, dir);
+            ret = -1;
+        }
+        close(fd);
+    }
+
+    free(devs);
+    return ret;
+}
+
+#ifndef HAVE_SYNCFS
+/* Without syncfs(), the first file system synced in a commit syncs them
+ * all. */
+static int synced;
+
+static int file_commit_syncfs(int fd)
+{
+    (void)fd;
+
+    if (!synced) {
+        sync();
+        synced = 1;
+    }
+    return 0;
+}
+#else
+#define file_commit_syncfs syncfs
+#endif
+
+static void file_commit_add_dir(str_list_t * dirs, const char *path)
+{
+    char *dir = xdirname(path);
+
+    if (!str_list_contains(dirs, dir, 0))
+        str_list_append(dirs, dir);
+    free(dir);
+}
+
+int file_commit(void)
+{
+    file_commit_entry_t *entry;
+    str_list_elt_t *iter;
+    str_list_t *dirs, *renamed_dirs;
+    int ret = 0;
+
+    if (!pending && !touched)
+        return 0;
+
+    dirs = str_list_alloc();
+    for (entry = pending; entry; entry = entry->next)
+        file_commit_add_dir(dirs, entry->path);
+
+    /* First make the new files and everything unpacked durable, syncing
+     * each file system once. touched already holds directories. */
+    if (touched) {
+        for (iter = str_list_first(touched); iter;
+                iter = str_list_next(touched, iter))
+            if (!str_list_contains(dirs, (char *)iter->data, 0))
+                str_list_append(dirs, (char *)iter->data);
+    }
+#ifndef HAVE_SYNCFS
+    synced = 0;
+#endif
+    if (file_commit_each_dir(dirs, 1, file_commit_syncfs, "sync") != 0)
+        ret = -1;
+    str_list_purge(dirs);
+
+    /* Then put them in place and make that durable too. Were a new file
+     * renamed before its data reached the disk, a crash could leave it
+     * empty. */
+    renamed_dirs = str_list_alloc();
+    while (pending) {
+        entry = pending;
+        if (!entry->fp) {
+            if (rename(entry->tmp_path, entry->path) == 0) {
+                file_commit_add_dir(renamed_dirs, entry->path);
+            } else {
+                opkg_perror(ERROR, "Failed to rename %s to %s",
+                            entry->tmp_path, entry->path);
+                ret = -1;
+            }
+        }
+        file_commit_free(entry);
+    }
+    if (file_commit_each_dir(renamed_dirs, 0, fsync, "sync") != 0)
+        ret = -1;
+    str_list_purge(renamed_dirs);
+
+    if (touched) {
+        str_list_purge(touched);
+        touched = NULL;
+    }
+
+    return ret;
+}
+
+void file_commit_deinit(void)
+{
+    /* An aborted transaction leaves its new files behind, to be
+     * overwritten by the next one. */
+    while (pending)
+        file_commit_free(pending);
+
+    if (touched) {
+        str_list_purge(touched);
+        touched = NULL;
+    }
+}
@@ -0,0 +1,58 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* file_commit.h - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+
+#ifndef FILE_COMMIT_H
+#define FILE_COMMIT_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Files of the package database written through file_commit_open() are
+ * replaced as a whole, according to the durability option.
+ *
+ * With "sync", the default, they are written in place.
+ *
+ * With "batch", each one is written to "<path>.new" and left there until
+ * file_commit() ends the transaction: it syncs every file system written
+ * to, which also flushes the files unpacked from packages, renames the new
+ * files into place and syncs their directories. A crash therefore leaves
+ * either the old or the new version of each file.
+ */
+
+/* Returns NULL and sets errno on error. */
+FILE *file_commit_open(const char *path);
+/* Closes a file from file_commit_open(). On error, it is not committed. */
+int file_commit_close(FILE * fp);
+
+/* The file to read path from until the transaction is committed. */
+const char *file_commit_path(const char *path);
+/* Drops the uncommitted version of path, if any, as path is removed. */
+void file_commit_cancel(const char *path);
+/* Notes that files are written under dir, so that file_commit() syncs its
+ * file system. */
+void file_commit_touch(const char *dir);
+
+int file_commit(void);
+void file_commit_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* FILE_COMMIT_H */
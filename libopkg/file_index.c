@@ -0,0 +1,448 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* file_index.c - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file_index.h"
+#include "file_tree.h"
+#include "hash_table.h"
+#include "pkg_hash.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "xfuncs.h"
+
+#define FILE_INDEX_MAGIC "OPKGFIX"
+#define FILE_INDEX_VERSION 1
+
+struct file_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+/* Each record is the package name, the stamp of its .list file, a 32-bit
+ * count of files and the files. Strings are stored as a 32-bit length
+ * followed by the bytes and a NUL.
+ */
+struct file_index_stamp {
+    uint64_t size;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t mtime_nsec;
+};
+
+typedef struct file_index file_index_t;
+
+struct file_index {
+    pkg_dest_t *dest;
+    void *map;
+    size_t size;
+    struct timespec mtime;
+    hash_table_t records;       /* package name -> record stamp */
+    file_index_t *next;
+};
+
+/* The indexes opened by file_index_load_pkg(). */
+static file_index_t *indexes;
+
+/* Set once file_hash holds the owner of every installed file. */
+static int file_index_complete;
+/* Set when a .list file changed, or an index record was out of date. */
+static int file_index_dirty;
+/* Set when a .list file could not be written. */
+static int file_index_failed;
+
+static char *file_index_file_alloc(pkg_dest_t * dest)
+{
+    char *index_file;
+
+    sprintf_alloc(&index_file, "%s.files.idx", dest->status_file_name);
+    return index_file;
+}
+
+static int file_index_stamp_list(pkg_t * pkg, struct file_index_stamp *stamp)
+{
+    char *list_file;
+    struct stat st;
+    int r;
+
+    sprintf_alloc(&list_file, "%s/%s.list", pkg->dest->info_dir, pkg->name);
+    r = stat(list_file, &st);
+    free(list_file);
+    if (r != 0)
+        return -1;
+
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->size = st.st_size;
+    stamp->ino = st.st_ino;
+    stamp->mtime = st.st_mtim.tv_sec;
+    stamp->mtime_nsec = st.st_mtim.tv_nsec;
+
+    return 0;
+}
+
+/*
+ * Reading
+ */
+
+struct file_index_cursor {
+    const char *p;
+    const char *end;
+};
+
+static int read_u32(struct file_index_cursor *c, uint32_t * v)
+{
+    if (c->end - c->p < (ptrdiff_t) sizeof(*v))
+        return -1;
+    memcpy(v, c->p, sizeof(*v));
+    c->p += sizeof(*v);
+    return 0;
+}
+
+static int read_str(struct file_index_cursor *c, const char **s)
+{
+    uint32_t len;
+
+    if (read_u32(c, &len) < 0 || (size_t)(c->end - c->p) <= len
+            || c->p[len] != '\0')
+        return -1;
+    *s = c->p;
+    c->p += len + 1;
+    return 0;
+}
+
+static int read_record(struct file_index_cursor *c, const char **name,
+                       const char **stamp)
+{
+    uint32_t i, count;
+    const char *path;
+
+    if (read_str(c, name) < 0)
+        return -1;
+    if (c->end - c->p < (ptrdiff_t) sizeof(struct file_index_stamp))
+        return -1;
+    *stamp = c->p;
+    c->p += sizeof(struct file_index_stamp);
+
+    if (read_u32(c, &count) < 0)
+        return -1;
+    for (i = 0; i < count; i++)
+        if (read_str(c, &path) < 0)
+            return -1;
+
+    return 0;
+}
+
+static void file_index_close(file_index_t * index)
+{
+    hash_table_deinit(&index->records);
+    if (index->map)
+        munmap(index->map, index->size);
+    free(index);
+}
+
+static void file_index_read(file_index_t * index, const char *index_file)
+{
+    struct file_index_header header;
+    struct file_index_cursor c;
+    const char *name, *stamp;
+    struct stat st;
+    uint32_t i;
+    int fd;
+
+    fd = open(index_file, O_RDONLY);
+    if (fd == -1)
+        return;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+        close(fd);
+        return;
+    }
+
+    index->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        return;
+    }
+    index->size = st.st_size;
+    index->mtime = st.st_mtim;
+
+    memcpy(&header, index->map, sizeof(header));
+    if (memcmp(header.magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC)) != 0
+            || header.version != FILE_INDEX_VERSION) {
+        opkg_msg(DEBUG, "Ignoring index %s of another format.\n", index_file);
+        return;
+    }
+
+    c.p = (const char *)index->map + sizeof(header);
+    c.end = (const char *)index->map + index->size;
+    for (i = 0; i < header.count; i++) {
+        if (read_record(&c, &name, &stamp) < 0)
+            break;
+        hash_table_insert(&index->records, name, (void *)stamp);
+    }
+
+    if (i != header.count || c.p != c.end) {
+        opkg_msg(NOTICE, "Ignoring corrupted index %s.\n", index_file);
+        hash_table_deinit(&index->records);
+        hash_table_init("file-index", &index->records, 256);
+        return;
+    }
+
+    opkg_msg(DEBUG, "Loaded index %s (%u packages).\n", index_file,
+             header.count);
+}
+
+static file_index_t *file_index_open(pkg_dest_t * dest)
+{
+    file_index_t *index;
+    char *index_file;
+
+    for (index = indexes; index; index = index->next)
+        if (index->dest == dest)
+            return index;
+
+    index = xcalloc(1, sizeof(*index));
+    index->dest = dest;
+    hash_table_init("file-index", &index->records, 256);
+    index->next = indexes;
+    indexes = index;
+
+    /* A missing or unusable index just leaves the records empty. */
+    index_file = file_index_file_alloc(dest);
+    file_index_read(index, index_file);
+    free(index_file);
+
+    return index;
+}
+
+int file_index_load_pkg(pkg_t * pkg)
+{
+    file_index_t *index;
+    struct file_index_stamp stamp, recorded;
+    struct file_index_cursor c;
+    const char *record, *path;
+    uint32_t i, count = 0;
+
+    if (!pkg->dest)
+        return 1;
+
+    index = file_index_open(pkg->dest);
+    record = hash_table_get(&index->records, pkg->name);
+    if (!record || file_index_stamp_list(pkg, &stamp) != 0)
+        goto stale;
+
+    /* A .list rewritten in the same clock tick as the index can't be told
+     * apart from the recorded one on file systems with coarse timestamps,
+     * so such a record is not trusted. */
+    memcpy(&recorded, record, sizeof(recorded));
+    if (memcmp(&recorded, &stamp, sizeof(stamp)) != 0
+            || recorded.mtime > index->mtime.tv_sec
+            || (recorded.mtime == index->mtime.tv_sec
+                && recorded.mtime_nsec >= index->mtime.tv_nsec))
+        goto stale;
+
+    /* read_record() has already checked the bounds, but a record that
+     * doesn't parse is still only a reason to read the .list instead. */
+    c.p = record + sizeof(stamp);
+    c.end = (const char *)index->map + index->size;
+    if (read_u32(&c, &count) < 0)
+        goto stale;
+    for (i = 0; i < count; i++) {
+        if (read_str(&c, &path) < 0)
+            goto stale;
+        file_hash_set_file_owner(path, pkg);
+    }
+
+    return 0;
+
+ stale:
+    file_index_dirty = 1;
+    return 1;
+}
+
+void file_index_loaded(void)
+{
+    file_index_t *index, *next;
+
+    for (index = indexes; index; index = next) {
+        next = index->next;
+        file_index_close(index);
+    }
+    indexes = NULL;
+
+    file_index_complete = 1;
+}
+
+void file_index_list_changed(int err)
+{
+    if (err)
+        file_index_failed = 1;
+    else
+        file_index_dirty = 1;
+}
+
+/*
+ * Writing
+ */
+
+static void write_u32(FILE * fp, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void write_str(FILE * fp, const char *s, size_t len)
+{
+    write_u32(fp, len);
+    fwrite(s, 1, len, fp);
+    fputc('\0', fp);
+}
+
+static int file_index_write_dest(pkg_dest_t * dest, pkg_vec_t * installed)
+{
+    struct file_index_header header;
+    struct file_index_stamp stamp;
+    char *index_file, *tmp_file, *path;
+    file_node_t *node;
+    unsigned int i, n_files;
+    size_t len;
+    FILE *fp;
+    int fd, err = 0;
+
+    index_file = file_index_file_alloc(dest);
+    sprintf_alloc(&tmp_file, "%s.XXXXXX", index_file);
+
+    fd = mkstemp(tmp_file);
+    if (fd == -1) {
+        /* Not fatal: the .list files are still there. */
+        opkg_msg(DEBUG, "Can't create index %s: %s.\n", tmp_file,
+                 strerror(errno));
+        goto out;
+    }
+    fchmod(fd, 0644);
+
+    fp = fdopen(fd, "w");
+    if (!fp) {
+        opkg_perror(ERROR, "Failed to fdopen %s", tmp_file);
+        close(fd);
+        unlink(tmp_file);
+        err = -1;
+        goto out;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC));
+    header.version = FILE_INDEX_VERSION;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (i = 0; i < installed->len; i++) {
+        pkg_t *pkg = installed->pkgs[i];
+
+        if (pkg->dest != dest || file_index_stamp_list(pkg, &stamp) != 0)
+            continue;
+
+        write_str(fp, pkg->name, strlen(pkg->name));
+        fwrite(&stamp, sizeof(stamp), 1, fp);
+
+        n_files = 0;
+        for (node = pkg->owned_files; node; node = node->owned_next)
+            n_files++;
+        write_u32(fp, n_files);
+        for (node = pkg->owned_files; node; node = node->owned_next) {
+            /* As pkg_write_filelist() writes it, so as it is read back. */
+            path = file_node_path_alloc(node);
+            len = strlen(path);
+            if (len > 0 && path[len - 1] == '/')
+                len--;
+            write_str(fp, path, len);
+            free(path);
+        }
+        header.count++;
+    }
+
+    rewind(fp);
+    fwrite(&header, sizeof(header), 1, fp);
+    if (ferror(fp)) {
+        opkg_msg(ERROR, "Failed to write index %s.\n", tmp_file);
+        err = -1;
+    }
+    if (fclose(fp) != 0) {
+        opkg_perror(ERROR, "Failed to close %s", tmp_file);
+        err = -1;
+    }
+
+    if (!err && rename(tmp_file, index_file) != 0) {
+        opkg_perror(ERROR, "Failed to rename %s to %s", tmp_file, index_file);
+        err = -1;
+    }
+    if (err)
+        unlink(tmp_file);
+    else
+        opkg_msg(DEBUG, "Wrote index %s (%u packages).\n", index_file,
+                 header.count);
+
+ out:
+    free(tmp_file);
+    free(index_file);
+    return err;
+}
+
+int file_index_write(void)
+{
+    pkg_dest_list_elt_t *iter;
+    pkg_vec_t *installed;
+    int err = 0;
+
+    if (!opkg_config->file_index || !file_index_complete || !file_index_dirty
+            || file_index_failed || opkg_config->noaction)
+        return 0;
+
+    installed = pkg_vec_alloc();
+    pkg_hash_fetch_all_installed(installed, INSTALLED);
+
+    for (iter = void_list_first(&opkg_config->pkg_dest_list); iter;
+            iter = void_list_next(&opkg_config->pkg_dest_list, iter)) {
+        if (file_index_write_dest((pkg_dest_t *) iter->data, installed) != 0)
+            err = -1;
+    }
+
+    pkg_vec_free(installed);
+
+    if (!err)
+        file_index_dirty = 0;
+
+    return err;
+}
+
+void file_index_deinit(void)
+{
+    file_index_loaded();
+
+    file_index_complete = 0;
+    file_index_dirty = 0;
+    file_index_failed = 0;
+}
@@ -0,0 +1,55 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* file_index.h - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include "pkg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A file index holds the files owned by each installed package of a
+ * destination, as they were read from its <info_dir>/<pkg>.list files. It is
+ * stored next to the status file as "<status>.files.idx". Each record notes
+ * the size, inode and mtime of the .list it matches and is ignored as soon
+ * as that .list changes.
+ */
+
+/* Sets the owner of every file of pkg from the index of its destination.
+ * Returns 1, without doing anything, if the index has no up to date record
+ * of pkg.
+ */
+int file_index_load_pkg(pkg_t * pkg);
+
+/* Called once file_hash holds the owner of every installed file: from then
+ * on the indexes can be rewritten from it. */
+void file_index_loaded(void);
+
+/* Called whenever a .list file is written or removed. err is the result of
+ * the write; after a failure the indexes are left alone for this run. */
+void file_index_list_changed(int err);
+
+/* Rewrites the index of every destination if a .list file changed. */
+int file_index_write(void);
+
+void file_index_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* FILE_INDEX_H */
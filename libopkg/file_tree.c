@@ -0,0 +1,218 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* file_tree.c - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_tree.h"
+#include "pkg.h"
+#include "xfuncs.h"
+
+#define FILE_TREE_MIN_BUCKETS 1024
+#define FILE_TREE_BLOCK_SIZE (64 * 1024)
+
+/* FNV-1a over the component, seeded with its parent: components are short,
+ * so hashing them a byte at a time is cheap. */
+static unsigned long file_node_hash(const file_node_t * parent,
+                                    const char *name, unsigned int len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uintptr_t) parent;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 32;
+
+    return (unsigned long)h;
+}
+
+/* Returns the bucket holding the child name of parent, or the empty bucket
+ * where it would go. */
+static file_node_t **file_tree_slot(file_tree_t * tree,
+                                    const file_node_t * parent,
+                                    const char *name, unsigned int len)
+{
+    unsigned int mask = tree->n_buckets - 1;
+    unsigned int i = file_node_hash(parent, name, len) & mask;
+
+    for (;; i = (i + 1) & mask) {
+        file_node_t *node = tree->nodes[i];
+        if (!node || (node->parent == parent && node->len == len
+                      && memcmp(node->name, name, len) == 0))
+            return tree->nodes + i;
+    }
+}
+
+static void file_tree_resize(file_tree_t * tree, unsigned int n_buckets)
+{
+    file_node_t **old = tree->nodes;
+    unsigned int old_n = tree->n_buckets;
+    unsigned int i;
+
+    tree->nodes = xcalloc(n_buckets, sizeof(file_node_t *));
+    tree->n_buckets = n_buckets;
+
+    for (i = 0; i < old_n; i++) {
+        file_node_t *node = old[i];
+        if (node)
+            *file_tree_slot(tree, node->parent, node->name, node->len) = node;
+    }
+
+    free(old);
+}
+
+static file_node_t *file_tree_new_node(file_tree_t * tree,
+                                       file_node_t * parent, const char *name,
+                                       unsigned int len)
+{
+    file_node_t *node;
+
+    node = arena_calloc(&tree->arena, 1, sizeof(file_node_t) + len);
+    node->parent = parent;
+    node->len = len;
+    memcpy(node->name, name, len);
+
+    return node;
+}
+
+void file_tree_init(const char *name, file_tree_t * tree)
+{
+    memset(tree, 0, sizeof(file_tree_t));
+
+    tree->name = name;
+    arena_init(name, &tree->arena, FILE_TREE_BLOCK_SIZE);
+    tree->root = file_tree_new_node(tree, NULL, "", 0);
+    tree->n_buckets = FILE_TREE_MIN_BUCKETS;
+    tree->nodes = xcalloc(tree->n_buckets, sizeof(file_node_t *));
+}
+
+void file_tree_deinit(file_tree_t * tree)
+{
+    free(tree->nodes);
+    arena_deinit(&tree->arena);
+
+    tree->nodes = NULL;
+    tree->root = NULL;
+    tree->n_buckets = 0;
+    tree->n_nodes = 0;
+}
+
+void file_tree_print_stats(file_tree_t * tree)
+{
+    printf("file_tree: %s, %lu bytes\n"
+           "\tn_buckets=%u, n_nodes=%u, load=%.2f\n", tree->name,
+           (unsigned long)(tree->n_buckets * sizeof(file_node_t *)
+                           + tree->arena.n_bytes), tree->n_buckets,
+           tree->n_nodes,
+           (tree->n_buckets ? ((float)tree->n_nodes) / tree->n_buckets : 0.0f));
+}
+
+static file_node_t *file_tree_walk(file_tree_t * tree, const char *path,
+                                   int add)
+{
+    file_node_t *node = tree->root;
+    file_node_t **slot;
+    const char *end;
+    unsigned int len;
+
+    while (*path == '/')
+        path++;
+    if (*path == '\0')
+        return node;
+
+    while (1) {
+        for (end = path; *end && *end != '/'; end++) ;
+        len = end - path;
+
+        slot = file_tree_slot(tree, node, path, len);
+        if (!*slot) {
+            if (!add)
+                return NULL;
+            /* Keep the load under 3/4. */
+            if ((tree->n_nodes + 1) * 4 > tree->n_buckets * 3) {
+                file_tree_resize(tree, tree->n_buckets * 2);
+                slot = file_tree_slot(tree, node, path, len);
+            }
+            *slot = file_tree_new_node(tree, node, path, len);
+            tree->n_nodes++;
+        }
+
+        node = *slot;
+        if (*end == '\0')
+            return node;
+        path = end + 1;
+    }
+}
+
+file_node_t *file_tree_get(file_tree_t * tree, const char *path)
+{
+    return file_tree_walk(tree, path, 0);
+}
+
+file_node_t *file_tree_add(file_tree_t * tree, const char *path)
+{
+    return file_tree_walk(tree, path, 1);
+}
+
+void file_node_set_owner(file_node_t * node, pkg_t * owner)
+{
+    if (node->owner) {
+        *node->owned_pprev = node->owned_next;
+        if (node->owned_next)
+            node->owned_next->owned_pprev = node->owned_pprev;
+        node->owned_next = NULL;
+        node->owned_pprev = NULL;
+    }
+
+    node->owner = owner;
+
+    if (owner) {
+        node->owned_next = owner->owned_files;
+        if (node->owned_next)
+            node->owned_next->owned_pprev = &node->owned_next;
+        owner->owned_files = node;
+        node->owned_pprev = &owner->owned_files;
+    }
+}
+
+char *file_node_path_alloc(file_node_t * node)
+{
+    file_node_t *n;
+    size_t size = 0;
+    char *path, *p;
+
+    if (!node->parent)
+        return xstrdup("/");
+
+    for (n = node; n->parent; n = n->parent)
+        size += n->len + 1;
+
+    path = xmalloc(size + 1);
+    p = path + size;
+    *p = '\0';
+    for (n = node; n->parent; n = n->parent) {
+        p -= n->len;
+        memcpy(p, n->name, n->len);
+        *--p = '/';
+    }
+
+    return path;
+}
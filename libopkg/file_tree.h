@@ -0,0 +1,79 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* file_tree.h - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef FILE_TREE_H
+#define FILE_TREE_H
+
+#include <stddef.h>
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A tree of the paths opkg tracks the owners of. Each node is one path
+ * component and points to its parent directory, so the directories shared
+ * by many files are only stored once. Nodes are never freed before the
+ * whole tree is.
+ */
+typedef struct file_node file_node_t;
+typedef struct file_tree file_tree_t;
+
+struct pkg;
+
+struct file_node {
+    file_node_t *parent;        /* NULL for the root */
+    struct pkg *owner;          /* the package providing this file */
+    struct pkg *obs_owner;      /* the package it is obsolete in, if any */
+    /* The other files of owner, see pkg->owned_files. */
+    file_node_t *owned_next;
+    file_node_t **owned_pprev;
+    unsigned int len;
+    char name[];                /* not terminated */
+};
+
+struct file_tree {
+    const char *name;
+    file_node_t *root;
+    /* Open addressing table of every node but the root, keyed by
+     * (parent, name). */
+    file_node_t **nodes;
+    unsigned int n_buckets;     /* always a power of two */
+    unsigned int n_nodes;
+    arena_t arena;
+};
+
+void file_tree_init(const char *name, file_tree_t * tree);
+void file_tree_deinit(file_tree_t * tree);
+void file_tree_print_stats(file_tree_t * tree);
+
+/* Leading slashes are ignored, so "a/b" is "/a/b". Any other slash starts a
+ * new component, even an empty one: "/a/b/" is a child of "/a/b", as those
+ * two are told apart when a directory is replaced by a symlink. */
+file_node_t *file_tree_get(file_tree_t * tree, const char *path);
+file_node_t *file_tree_add(file_tree_t * tree, const char *path);
+
+/* Returns the full path of node, starting with a slash. */
+char *file_node_path_alloc(file_node_t * node);
+
+/* Moves node from the owned_files of its owner to those of owner, which
+ * may be NULL. */
+void file_node_set_owner(file_node_t * node, struct pkg *owner);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* FILE_TREE_H */
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <utime.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -375,53 +376,142 @@ int file_mkdir_hier(const char *path, long mode)
     return 0;
 }
 
-char *file_md5sum_alloc(const char *file_name)
+struct file_checksum {
+    int kinds;
+    struct md5_ctx md5;
+#ifdef HAVE_SHA256
+    struct sha256_ctx sha256;
+#endif
+};
+
+struct file_checksum *file_checksum_new(int kinds)
+{
+    struct file_checksum *ctx = xmalloc(sizeof(*ctx));
+
+#ifndef HAVE_SHA256
+    kinds &= ~FILE_CHECKSUM_SHA256;
+#endif
+    ctx->kinds = kinds;
+    if (kinds & FILE_CHECKSUM_MD5)
+        md5_init_ctx(&ctx->md5);
+#ifdef HAVE_SHA256
+    if (kinds & FILE_CHECKSUM_SHA256)
+        sha256_init_ctx(&ctx->sha256);
+#endif
+    return ctx;
+}
+
+void file_checksum_update(struct file_checksum *ctx, const void *buf,
+                          size_t len)
+{
+    if (ctx->kinds & FILE_CHECKSUM_MD5)
+        md5_process_bytes(buf, len, &ctx->md5);
+#ifdef HAVE_SHA256
+    if (ctx->kinds & FILE_CHECKSUM_SHA256)
+        sha256_process_bytes(buf, len, &ctx->sha256);
+#endif
+}
+
+void file_checksum_finish(struct file_checksum *ctx, char **md5sum,
+                          char **sha256sum)
 {
-    int err;
-    FILE *file;
     unsigned char md5sum_bin[16];
+#ifdef HAVE_SHA256
+    unsigned char sha256sum_bin[32];
+#endif
+
+    if (md5sum) {
+        *md5sum = NULL;
+        if (ctx->kinds & FILE_CHECKSUM_MD5) {
+            md5_finish_ctx(&ctx->md5, md5sum_bin);
+            *md5sum = md5_to_string(md5sum_bin);
+        }
+    }
+    if (sha256sum) {
+        *sha256sum = NULL;
+#ifdef HAVE_SHA256
+        if (ctx->kinds & FILE_CHECKSUM_SHA256) {
+            sha256_finish_ctx(&ctx->sha256, sha256sum_bin);
+            *sha256sum = sha256_to_string(sha256sum_bin);
+        }
+#endif
+    }
+
+    free(ctx);
+}
+
+void file_checksum_free(struct file_checksum *ctx)
+{
+    free(ctx);
+}
 
-    file = fopen(file_name, "r");
-    if (file == NULL) {
+/* Buffer size used when reading a file to checksum it. */
+#define CHECKSUM_BUFFER_LEN 0x10000
+
+int file_checksums_alloc(const char *file_name, char **md5sum,
+                         char **sha256sum)
+{
+    struct file_checksum *ctx;
+    char *buffer;
+    ssize_t len;
+    int kinds = 0;
+    int fd;
+
+    if (md5sum)
+        kinds |= FILE_CHECKSUM_MD5;
+    if (sha256sum)
+        kinds |= FILE_CHECKSUM_SHA256;
+
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
         opkg_perror(ERROR, "Failed to open file %s", file_name);
-        return NULL;
+        return -1;
     }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
-    err = md5_stream(file, md5sum_bin);
-    if (err) {
-        opkg_msg(ERROR, "Could't compute md5sum for %s.\n", file_name);
-        fclose(file);
-        return NULL;
+    ctx = file_checksum_new(kinds);
+    buffer = xmalloc(CHECKSUM_BUFFER_LEN);
+    while ((len = read(fd, buffer, CHECKSUM_BUFFER_LEN)) != 0) {
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            opkg_perror(ERROR, "Couldn't compute checksums for %s",
+                        file_name);
+            free(buffer);
+            file_checksum_free(ctx);
+            close(fd);
+            return -1;
+        }
+        file_checksum_update(ctx, buffer, len);
     }
 
-    fclose(file);
+    free(buffer);
+    close(fd);
+    file_checksum_finish(ctx, md5sum, sha256sum);
+    return 0;
+}
+
+char *file_md5sum_alloc(const char *file_name)
+{
+    char *md5sum;
 
-    return md5_to_string(md5sum_bin);
+    if (file_checksums_alloc(file_name, &md5sum, NULL) < 0)
+        return NULL;
+
+    return md5sum;
 }
 
 #ifdef HAVE_SHA256
 char *file_sha256sum_alloc(const char *file_name)
 {
-    int err;
-    FILE *file;
-    unsigned char sha256sum_bin[32];
+    char *sha256sum;
 
-    file = fopen(file_name, "r");
-    if (file == NULL) {
-        opkg_perror(ERROR, "Failed to open file %s", file_name);
-        return NULL;
-    }
-
-    err = sha256_stream(file, sha256sum_bin);
-    if (err) {
-        opkg_msg(ERROR, "Could't compute sha256sum for %s.\n", file_name);
-        fclose(file);
+    if (file_checksums_alloc(file_name, NULL, &sha256sum) < 0)
         return NULL;
-    }
-
-    fclose(file);
 
-    return sha256_to_string(sha256sum_bin);
+    return sha256sum;
 }
 
 #endif
@@ -38,6 +38,27 @@ int file_copy(const char *src, const char *dest);
 int file_mkdir_hier(const char *path, long mode);
 char *file_md5sum_alloc(const char *file_name);
 char *file_sha256sum_alloc(const char *file_name);
+/* Computes the checksums whose result pointers are non-NULL in one read of
+ * the file. Returns 0 on success or -1 on error. A sha256sum is only computed
+ * if opkg is built with sha256 support and is NULL otherwise. */
+int file_checksums_alloc(const char *file_name, char **md5sum,
+                         char **sha256sum);
+
+/* Computes several checksums of data in a single pass over it. */
+struct file_checksum;
+
+#define FILE_CHECKSUM_MD5 1
+#define FILE_CHECKSUM_SHA256 2
+
+/* kinds is a mask of the FILE_CHECKSUM_* values to compute. */
+struct file_checksum *file_checksum_new(int kinds);
+void file_checksum_update(struct file_checksum *ctx, const void *buf,
+                          size_t len);
+/* Stores the checksums in strings the caller must free, NULL for those not
+ * computed, and frees ctx. Either result pointer may be NULL. */
+void file_checksum_finish(struct file_checksum *ctx, char **md5sum,
+                          char **sha256sum);
+void file_checksum_free(struct file_checksum *ctx);
 int rm_r(const char *path);
 int file_decompress(const char *in, const char *out);
 int file_gz_compress(const char *filename);
@@ -21,28 +21,124 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hash_table.h"
 #include "opkg_message.h"
 #include "xfuncs.h"
 
-static unsigned long djb2_hash(const unsigned char *str)
+#define HASH_TABLE_MIN_BUCKETS 16
+
+/* Marks a bucket whose entry was removed. Lookups have to probe past it,
+ * inserts may reuse it. */
+static char hash_tombstone[1];
+
+#define bucket_is_live(e) ((e)->key && (e)->key != hash_tombstone)
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_mix(uint64_t k)
+{
+    k *= 0x87c37b91114253d5ULL;
+    k = rotl64(k, 31);
+    k *= 0x4cf5ad432745937fULL;
+    return k;
+}
+
+/*
+ * Hashes eight bytes at a time, which matters for the long paths kept in the
+ * file hashes. The result is never stored, so byte order doesn't matter.
+ */
+static unsigned long hash_string(const char *key, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t w;
+
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        h ^= hash_mix(w);
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+        p += 8;
+        len -= 8;
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, p, len);
+        h ^= hash_mix(w);
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (unsigned long)h;
+}
+
+static unsigned int round_up_pow2(unsigned int n)
 {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c;        /* hash * 33 + c */
-    return hash;
+    unsigned int r = HASH_TABLE_MIN_BUCKETS;
+
+    while (r < n)
+        r <<= 1;
+    return r;
 }
 
-static int hash_index(hash_table_t * hash, const char *key)
+/*
+ * Returns the bucket holding key, or NULL. Linear probing: the table always
+ * has empty buckets, so the loop terminates.
+ */
+static hash_entry_t *hash_find(hash_table_t * hash, const char *key,
+                               size_t len, unsigned long h)
 {
-    return djb2_hash((const unsigned char *)key) % hash->n_buckets;
+    unsigned int mask = hash->n_buckets - 1;
+    unsigned int i = h & mask;
+
+    for (;; i = (i + 1) & mask) {
+        hash_entry_t *e = hash->entries + i;
+        if (!e->key)
+            return NULL;
+        /* Comparing the cached hashes first avoids almost all strcmp(). */
+        if (e->hash == h && e->key != hash_tombstone
+                && strncmp(e->key, key, len) == 0 && e->key[len] == '\0')
+            return e;
+    }
+}
+
+static void hash_resize(hash_table_t * hash, unsigned int n_buckets)
+{
+    hash_entry_t *old = hash->entries;
+    unsigned int old_n = hash->n_buckets;
+    unsigned int i, mask;
+
+    hash->entries = xcalloc(n_buckets, sizeof(hash_entry_t));
+    hash->n_buckets = n_buckets;
+    hash->n_deleted = 0;
+    hash->n_resizes++;
+    mask = n_buckets - 1;
+
+    for (i = 0; i < old_n; i++) {
+        hash_entry_t *e = old + i;
+        unsigned int j;
+
+        if (!bucket_is_live(e))
+            continue;
+
+        for (j = e->hash & mask; hash->entries[j].key; j = (j + 1) & mask) ;
+        hash->entries[j] = *e;
+    }
+
+    free(old);
 }
 
 /*
- * this is an open table keyed by strings
+ * this is an open addressing table keyed by strings
  */
 void hash_table_init(const char *name, hash_table_t * hash, int len)
 {
@@ -54,20 +150,20 @@ void hash_table_init(const char *name, hash_table_t * hash, int len)
     memset(hash, 0, sizeof(hash_table_t));
 
     hash->name = name;
-    hash->n_buckets = len;
+    hash->n_buckets = round_up_pow2(len);
     hash->entries = xcalloc(hash->n_buckets, sizeof(hash_entry_t));
 }
 
 void hash_print_stats(hash_table_t * hash)
 {
     printf("hash_table: %s, %d bytes\n"
-           "\tn_buckets=%d, n_elements=%d, n_collisions=%d\n"
-           "\tmax_bucket_len=%d, n_used_buckets=%d, ave_bucket_len=%.2f\n"
+           "\tn_buckets=%d, n_elements=%d, n_deleted=%d, load=%.2f\n"
+           "\tn_collisions=%d, max_probe_len=%d, n_resizes=%d\n"
            "\tn_hits=%d, n_misses=%d\n", hash->name,
            hash->n_buckets * (int)sizeof(hash_entry_t), hash->n_buckets,
-           hash->n_elements, hash->n_collisions, hash->max_bucket_len,
-           hash->n_used_buckets,
-           (hash->n_used_buckets ? ((float)hash->n_elements) / hash->n_used_buckets : 0.0f),
+           hash->n_elements, hash->n_deleted,
+           (hash->n_buckets ? ((float)hash->n_elements) / hash->n_buckets : 0.0f),
+           hash->n_collisions, hash->max_probe_len, hash->n_resizes,
            hash->n_hits, hash->n_misses);
 }
 
@@ -80,112 +176,131 @@ void hash_table_deinit(hash_table_t * hash)
     /* free the reminaing entries */
     for (i = 0; i < hash->n_buckets; i++) {
         hash_entry_t *hash_entry = (hash->entries + i);
-        free(hash_entry->key);
-        /* skip the first entry as this is part of the array */
-        hash_entry = hash_entry->next;
-        while (hash_entry) {
-            hash_entry_t *old = hash_entry;
-            hash_entry = hash_entry->next;
-            free(old->key);
-            free(old);
-        }
+        if (bucket_is_live(hash_entry))
+            free(hash_entry->key);
     }
 
     free(hash->entries);
 
     hash->entries = NULL;
     hash->n_buckets = 0;
+    hash->n_elements = 0;
+    hash->n_deleted = 0;
 }
 
 void *hash_table_get(hash_table_t * hash, const char *key)
 {
-    int ndx = hash_index(hash, key);
-    hash_entry_t *hash_entry = hash->entries + ndx;
-    while (hash_entry) {
-        if (hash_entry->key) {
-            if (strcmp(key, hash_entry->key) == 0) {
-                hash->n_hits++;
-                return hash_entry->data;
-            }
-        }
-        hash_entry = hash_entry->next;
+    size_t len = strlen(key);
+    hash_entry_t *hash_entry = hash_find(hash, key, len, hash_string(key, len));
+
+    if (hash_entry) {
+        hash->n_hits++;
+        return hash_entry->data;
     }
     hash->n_misses++;
     return NULL;
 }
 
-int hash_table_insert(hash_table_t * hash, const char *key, void *value)
+/* Adds key, which must not be in the table yet. */
+static hash_entry_t *hash_add(hash_table_t * hash, const char *key,
+                              size_t len, unsigned long h, void *value)
 {
-    unsigned int bucket_len = 0;
-    int ndx = hash_index(hash, key);
-    hash_entry_t *hash_entry = hash->entries + ndx;
-    if (hash_entry->key) {
-        if (strcmp(hash_entry->key, key) == 0) {
-            /* alread in table, update the value */
-            hash_entry->data = value;
-            return 0;
-        } else {
-            /*
-             * if this is a collision, we have to go to the end of the ll,
-             * then add a new entry
-             * before we can hook up the value
-             */
-            while (hash_entry->next) {
-                hash_entry = hash_entry->next;
-                if (strcmp(hash_entry->key, key) == 0) {
-                    hash_entry->data = value;
-                    return 0;
-                }
-                bucket_len++;
-            }
-            hash_entry->next = xcalloc(1, sizeof(hash_entry_t));
-            hash_entry = hash_entry->next;
-            hash_entry->next = NULL;
-
-            hash->n_collisions++;
-            if (++bucket_len > hash->max_bucket_len)
-                hash->max_bucket_len = bucket_len;
+    unsigned int mask, i, probe_len = 0;
+    hash_entry_t *hash_entry, *slot = NULL;
+
+    /* Keep the load, tombstones included, under 3/4. Grow if the live
+     * entries need it, otherwise just rehash to drop the tombstones. */
+    if ((hash->n_elements + hash->n_deleted + 1) * 4 > hash->n_buckets * 3) {
+        if ((hash->n_elements + 1) * 2 > hash->n_buckets)
+            hash_resize(hash, hash->n_buckets * 2);
+        else
+            hash_resize(hash, hash->n_buckets);
+    }
+
+    mask = hash->n_buckets - 1;
+    for (i = h & mask;; i = (i + 1) & mask, probe_len++) {
+        hash_entry = hash->entries + i;
+        if (!hash_entry->key) {
+            if (!slot)
+                slot = hash_entry;
+            break;
         }
-    } else
-        hash->n_used_buckets++;
+        if (hash_entry->key == hash_tombstone && !slot)
+            slot = hash_entry;
+    }
+
+    if (slot->key == hash_tombstone)
+        hash->n_deleted--;
+    if (probe_len) {
+        hash->n_collisions++;
+        if (probe_len > hash->max_probe_len)
+            hash->max_probe_len = probe_len;
+    }
 
     hash->n_elements++;
-    hash_entry->key = xstrdup(key);
-    hash_entry->data = value;
+    slot->key = xstrndup(key, len);
+    slot->data = value;
+    slot->hash = h;
 
-    return 0;
+    return slot;
 }
 
-int hash_table_remove(hash_table_t * hash, const char *key)
+int hash_table_insert(hash_table_t * hash, const char *key, void *value)
 {
-    int ndx = hash_index(hash, key);
-    hash_entry_t *hash_entry = hash->entries + ndx;
-    hash_entry_t *next_entry = NULL, *last_entry = NULL;
-    while (hash_entry) {
-        if (hash_entry->key) {
-            if (strcmp(key, hash_entry->key) == 0) {
-                free(hash_entry->key);
-                if (last_entry) {
-                    last_entry->next = hash_entry->next;
-                    free(hash_entry);
-                } else {
-                    next_entry = hash_entry->next;
-                    if (next_entry) {
-                        memmove(hash_entry, next_entry, sizeof(hash_entry_t));
-                        free(next_entry);
-                    } else {
-                        memset(hash_entry, 0, sizeof(hash_entry_t));
-                    }
-                }
-                return 1;
-            }
-        }
-        last_entry = hash_entry;
-        hash_entry = hash_entry->next;
+    size_t len = strlen(key);
+    unsigned long h = hash_string(key, len);
+    hash_entry_t *hash_entry;
+
+    hash_entry = hash_find(hash, key, len, h);
+    if (hash_entry) {
+        /* alread in table, update the value */
+        hash_entry->data = value;
+        return 0;
     }
+
+    hash_add(hash, key, len, h, value);
+
     return 0;
 }
 
+const char *hash_table_intern(hash_table_t * hash, const char *key)
+{
+    return hash_table_intern_len(hash, key, strlen(key));
+}
+
+const char *hash_table_intern_len(hash_table_t * hash, const char *key,
+                                  size_t len)
+{
+    unsigned long h = hash_string(key, len);
+    hash_entry_t *hash_entry;
+
+    hash_entry = hash_find(hash, key, len, h);
+    if (hash_entry) {
+        hash->n_hits++;
+        return hash_entry->key;
+    }
+    hash->n_misses++;
+
+    return hash_add(hash, key, len, h, NULL)->key;
+}
+
+int hash_table_remove(hash_table_t * hash, const char *key)
+{
+    size_t len = strlen(key);
+    hash_entry_t *hash_entry = hash_find(hash, key, len, hash_string(key, len));
+
+    if (!hash_entry)
+        return 0;
+
+    free(hash_entry->key);
+    hash_entry->key = hash_tombstone;
+    hash_entry->data = NULL;
+    hash->n_elements--;
+    hash->n_deleted++;
+
+    return 1;
+}
+
 void hash_table_foreach(hash_table_t * hash,
                         void (*f) (const char *key, void *entry, void *data),
                         void *data)
@@ -196,10 +311,7 @@ void hash_table_foreach(hash_table_t * hash,
 
     for (i = 0; i < hash->n_buckets; i++) {
         hash_entry_t *hash_entry = (hash->entries + i);
-        do {
-            if (hash_entry->key) {
-                f(hash_entry->key, hash_entry->data, data);
-            }
-        } while ((hash_entry = hash_entry->next));
+        if (bucket_is_live(hash_entry))
+            f(hash_entry->key, hash_entry->data, data);
     }
 }
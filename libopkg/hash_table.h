@@ -21,6 +21,8 @@
 #ifndef _HASH_TABLE_H_
 #define _HASH_TABLE_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,19 +33,20 @@ typedef struct hash_table hash_table_t;
 struct hash_entry {
     char *key;
     void *data;
-    struct hash_entry *next;
+    unsigned long hash;
 };
 
 struct hash_table {
     const char *name;
     hash_entry_t *entries;
-    unsigned int n_buckets;
+    unsigned int n_buckets;     /* always a power of two */
     unsigned int n_elements;
+    unsigned int n_deleted;
 
     /* useful stats */
-    unsigned int n_used_buckets;
     unsigned int n_collisions;
-    unsigned int max_bucket_len;
+    unsigned int max_probe_len;
+    unsigned int n_resizes;
     unsigned int n_hits, n_misses;
 };
 
@@ -53,6 +56,12 @@ void hash_print_stats(hash_table_t * hash);
 void *hash_table_get(hash_table_t * hash, const char *key);
 int hash_table_insert(hash_table_t * hash, const char *key, void *value);
 int hash_table_remove(hash_table_t * has, const char *key);
+/* Returns the table's own copy of key, adding key first if needed. */
+const char *hash_table_intern(hash_table_t * hash, const char *key);
+/* Same, for the first len bytes of key, which need not be terminated. */
+const char *hash_table_intern_len(hash_table_t * hash, const char *key,
+                                  size_t len);
+/* f may remove entries, but must not insert any. */
 void hash_table_foreach(hash_table_t * hash,
                         void (*f)(const char *key, void *entry, void *data),
                         void *data);
@@ -0,0 +1,640 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* list_diff.c - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file_util.h"
+#include "list_diff.h"
+#include "opkg_archive.h"
+#include "opkg_conf.h"
+#include "opkg_download.h"
+#include "opkg_message.h"
+#include "opkg_utils.h"
+#include "sprintf_alloc.h"
+#include "xfuncs.h"
+
+/*
+ * The index follows the Debian format:
+ *
+ *   SHA256-Current: <sha256> <size>
+ *   SHA256-History:
+ *    <sha256 of the list the patch applies to> <size> <name>
+ *   SHA256-Patches:
+ *    <sha256 of the patch> <size> <name>
+ *
+ * with the patches in order, each one to be downloaded as <name>.gz. With
+ * "X-Patch-Precedence: merged", each patch brings its list straight up to
+ * date instead of to the next one in the history.
+ */
+struct diff_patch {
+    char *name;
+    char *history_sha256;
+    char *sha256;
+};
+
+/* The state of one of the lists being updated. */
+struct list_diff {
+    const char *list_url;
+    const char *list_file_name;
+    const char *sha256;
+    /* URL of the Packages.diff directory. */
+    char *diff_url;
+    char *current_sha256;
+    int merged;
+    struct diff_patch *patches;
+    unsigned int n_patches;
+    /* The patches to apply, from first up to last. */
+    unsigned int first;
+    unsigned int last;
+    /* Where the cached copies of those patches are found among all those
+     * downloaded.
+     */
+    unsigned int patch_index;
+    int result;
+};
+
+static struct diff_patch *list_diff_patch(struct list_diff *diff,
+                                          const char *name)
+{
+    struct diff_patch *patch;
+    unsigned int i;
+
+    for (i = 0; i < diff->n_patches; i++) {
+        if (strcmp(diff->patches[i].name, name) == 0)
+            return &diff->patches[i];
+    }
+
+    diff->patches = xrealloc(diff->patches,
+                             (diff->n_patches + 1) * sizeof(*diff->patches));
+    patch = &diff->patches[diff->n_patches++];
+    patch->name = xstrdup(name);
+    patch->history_sha256 = NULL;
+    patch->sha256 = NULL;
+    return patch;
+}
+
+static int list_diff_parse_index(struct list_diff *diff, const char *file_name)
+{
+    enum { FIELD_OTHER, FIELD_HISTORY, FIELD_PATCHES } field = FIELD_OTHER;
+    FILE *file;
+    char *line;
+    char sha256[65];
+    char name[256];
+    long long size;
+    struct diff_patch *patch;
+
+    file = fopen(file_name, "r");
+    if (!file) {
+        opkg_perror(ERROR, "Failed to open %s", file_name);
+        return -1;
+    }
+
+    while ((line = file_read_line_alloc(file)) != NULL) {
+        if (line[0] == ' ' || line[0] == '\t') {
+            if (field != FIELD_OTHER
+                    && sscanf(line, " %64s %lld %255s", sha256, &size,
+                              name) == 3
+                    && !strchr(name, '/')) {
+                patch = list_diff_patch(diff, name);
+                if (field == FIELD_HISTORY) {
+                    free(patch->history_sha256);
+                    patch->history_sha256 = xstrdup(sha256);
+                } else {
+                    free(patch->sha256);
+                    patch->sha256 = xstrdup(sha256);
+                }
+            }
+        } else if (str_starts_with(line, "SHA256-Current:")) {
+            field = FIELD_OTHER;
+            if (sscanf(line + 15, " %64s", sha256) == 1) {
+                free(diff->current_sha256);
+                diff->current_sha256 = xstrdup(sha256);
+            }
+        } else if (str_starts_with(line, "SHA256-History:")) {
+            field = FIELD_HISTORY;
+        } else if (str_starts_with(line, "SHA256-Patches:")) {
+            field = FIELD_PATCHES;
+        } else {
+            field = FIELD_OTHER;
+            if (str_starts_with(line, "X-Patch-Precedence:"))
+                diff->merged = strstr(line + 19, "merged") != NULL;
+        }
+        free(line);
+    }
+
+    fclose(file);
+
+    if (!diff->current_sha256) {
+        opkg_msg(DEBUG, "No current list in %s.\n", file_name);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads a whole file into memory, uncompressing it if gzipped is set. */
+static char *list_diff_read(const char *file_name, int gzipped, size_t *size)
+{
+    FILE *file;
+    char *data = NULL;
+    struct stat st;
+
+    if (gzipped) {
+        struct opkg_ar *ar;
+        int r;
+
+        ar = ar_open_compressed_file(file_name);
+        if (!ar)
+            return NULL;
+
+        file = open_memstream(&data, size);
+        r = ar_copy_to_stream(ar, file);
+        fclose(file);
+        ar_close(ar);
+        if (r < 0) {
+            free(data);
+            return NULL;
+        }
+        return data;
+    }
+
+    file = fopen(file_name, "r");
+    if (!file) {
+        opkg_perror(ERROR, "Failed to open %s", file_name);
+        return NULL;
+    }
+    if (fstat(fileno(file), &st) == 0) {
+        data = xmalloc(st.st_size + 1);
+        *size = fread(data, 1, st.st_size, file);
+        if (ferror(file) || *size != (size_t)st.st_size) {
+            opkg_perror(ERROR, "Failed to read %s", file_name);
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+static char *list_diff_sha256(const char *data, size_t size)
+{
+    struct file_checksum *sums;
+    char *sha256;
+
+    sums = file_checksum_new(FILE_CHECKSUM_SHA256);
+    file_checksum_update(sums, data, size);
+    file_checksum_finish(sums, NULL, &sha256);
+    return sha256;
+}
+
+static char *list_diff_file_name(struct list_diff *diff)
+{
+    char *file_name;
+
+    sprintf_alloc(&file_name, "%s%s", diff->list_file_name,
+                  opkg_config->compress_list_files ? ".gz" : "");
+    return file_name;
+}
+
+/* Works out which patches bring the local list up to date. Returns 0 if
+ * there are some or none are needed, -1 otherwise.
+ */
+static int list_diff_plan(struct list_diff *diff, const char *index_file)
+{
+    char *file_name;
+    char *data;
+    char *sha256;
+    size_t size;
+    unsigned int i;
+    int r = -1;
+
+    if (list_diff_parse_index(diff, index_file) != 0)
+        return -1;
+
+    if (diff->sha256 && strcmp(diff->sha256, diff->current_sha256) != 0) {
+        opkg_msg(DEBUG, "Index of %s does not match its release.\n",
+                 diff->list_url);
+        return -1;
+    }
+
+    file_name = list_diff_file_name(diff);
+    data = list_diff_read(file_name, opkg_config->compress_list_files, &size);
+    free(file_name);
+    if (!data)
+        return -1;
+    sha256 = list_diff_sha256(data, size);
+    free(data);
+    if (!sha256)
+        return -1;
+
+    if (strcmp(sha256, diff->current_sha256) == 0) {
+        diff->first = diff->last = 0;
+        r = 0;
+        goto cleanup;
+    }
+
+    for (i = 0; i < diff->n_patches; i++) {
+        if (diff->patches[i].history_sha256
+                && strcmp(diff->patches[i].history_sha256, sha256) == 0)
+            break;
+    }
+    if (i == diff->n_patches) {
+        opkg_msg(DEBUG, "No patches from the local copy of %s.\n",
+                 diff->list_url);
+        goto cleanup;
+    }
+
+    diff->first = i;
+    diff->last = diff->merged ? i + 1 : diff->n_patches;
+    for (i = diff->first; i < diff->last; i++) {
+        if (!diff->patches[i].sha256)
+            goto cleanup;
+    }
+    r = 0;
+
+ cleanup:
+    free(sha256);
+    return r;
+}
+
+/* A command of an ed script: lines start to end are replaced with text. */
+struct ed_command {
+    size_t start;
+    size_t end;
+    const char *text;
+    size_t text_len;
+};
+
+static const char *next_line(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+
+    return nl ? nl + 1 : end;
+}
+
+/*
+ * Applies the ed script made by "diff --ed" to data. Its commands are for the
+ * last lines first, which lets them all be applied in one pass from the
+ * first line. Returns the patched data or NULL if the script doesn't apply.
+ */
+static char *ed_script_apply(const char *data, size_t size, const char *script,
+                             size_t script_size, size_t *out_size)
+{
+    struct ed_command *cmds = NULL;
+    size_t n_cmds = 0;
+    size_t *lines = NULL;
+    size_t n_lines = 0;
+    const char *p, *q, *end = script + script_size;
+    char *out = NULL;
+    size_t i, pos, len;
+
+    /* lines[i] is where line i + 1 starts, lines[n_lines] is the end. */
+    for (p = data; p < data + size; p = next_line(p, data + size)) {
+        if ((n_lines & 1023) == 0)
+            lines = xrealloc(lines, (n_lines + 1025) * sizeof(*lines));
+        lines[n_lines++] = p - data;
+    }
+    if (!lines)
+        lines = xmalloc(sizeof(*lines));
+    lines[n_lines] = size;
+
+    for (p = script; p < end; p = q) {
+        struct ed_command cmd;
+        unsigned long from, to;
+        char c;
+        int n = 0, m = 0;
+
+        q = next_line(p, end);
+        if (sscanf(p, "%lu%n", &from, &n) != 1)
+            goto error;
+        to = from;
+        if (p[n] == ',' && sscanf(p + n + 1, "%lu%n", &to, &m) == 1)
+            n += 1 + m;
+        c = p[n];
+        if (p + n + 1 != q - (q[-1] == '\n') || to < from)
+            goto error;
+
+        switch (c) {
+        case 'a':
+            if (from != to)
+                goto error;
+            cmd.start = from + 1;
+            cmd.end = from;
+            break;
+        case 'c':
+        case 'd':
+            if (from == 0)
+                goto error;
+            cmd.start = from;
+            cmd.end = to;
+            break;
+        default:
+            goto error;
+        }
+        if (cmd.end > n_lines
+                || (n_cmds && cmd.end >= cmds[n_cmds - 1].start))
+            goto error;
+
+        cmd.text = q;
+        cmd.text_len = 0;
+        if (c != 'd') {
+            for (p = q; p < end; p = q) {
+                q = next_line(p, end);
+                if (q - p == 2 && p[0] == '.')
+                    break;
+                if (q == end && q - p == 1 && p[0] == '.')
+                    break;
+            }
+            if (p == end)
+                goto error;
+            cmd.text_len = p - cmd.text;
+        }
+
+        cmds = xrealloc(cmds, (n_cmds + 1) * sizeof(*cmds));
+        cmds[n_cmds++] = cmd;
+    }
+
+    len = size;
+    for (i = 0; i < n_cmds; i++)
+        len += cmds[i].text_len;
+    out = xmalloc(len + 1);
+
+    *out_size = 0;
+    pos = 1;
+    for (i = n_cmds; i-- > 0;) {
+        len = lines[cmds[i].start - 1] - lines[pos - 1];
+        memcpy(out + *out_size, data + lines[pos - 1], len);
+        *out_size += len;
+        memcpy(out + *out_size, cmds[i].text, cmds[i].text_len);
+        *out_size += cmds[i].text_len;
+        pos = cmds[i].end + 1;
+    }
+    len = size - lines[pos - 1];
+    memcpy(out + *out_size, data + lines[pos - 1], len);
+    *out_size += len;
+
+ error:
+    if (!out)
+        opkg_msg(DEBUG, "Can't apply ed script at: %.*s\n",
+                 (int)(next_line(p, end) - p), p);
+    free(lines);
+    free(cmds);
+    return out;
+}
+
+static int list_diff_write(struct list_diff *diff, const char *data,
+                           size_t size)
+{
+    FILE *file;
+    char *tmp_file_name;
+    int r = 0;
+
+    sprintf_alloc(&tmp_file_name, "%s.diff", diff->list_file_name);
+    file = fopen(tmp_file_name, "w");
+    if (!file) {
+        opkg_perror(ERROR, "Failed to open %s", tmp_file_name);
+        free(tmp_file_name);
+        return -1;
+    }
+    if (fwrite(data, 1, size, file) != size)
+        r = -1;
+    if (fclose(file) != 0)
+        r = -1;
+    if (r != 0)
+        opkg_perror(ERROR, "Failed to write %s", tmp_file_name);
+
+    if (r == 0) {
+        r = rename(tmp_file_name, diff->list_file_name);
+        if (r != 0)
+            opkg_perror(ERROR, "Failed to rename %s to %s", tmp_file_name,
+                        diff->list_file_name);
+    }
+    if (r == 0 && opkg_config->compress_list_files)
+        r = file_gz_compress(diff->list_file_name);
+    if (r != 0)
+        unlink(tmp_file_name);
+
+    free(tmp_file_name);
+    return r;
+}
+
+/* Applies the downloaded patches in turn and puts the result in place if it
+ * is the current list.
+ */
+static int list_diff_apply(struct list_diff *diff, char **patch_locations)
+{
+    char *file_name;
+    char *data, *patched;
+    char *script = NULL;
+    char *sha256 = NULL;
+    size_t size, script_size, patched_size;
+    unsigned int i;
+    int r = -1;
+
+    file_name = list_diff_file_name(diff);
+    data = list_diff_read(file_name, opkg_config->compress_list_files, &size);
+    free(file_name);
+    if (!data)
+        return -1;
+
+    /* The same list may have been brought up to date as part of another
+     * source in the meantime.
+     */
+    sha256 = list_diff_sha256(data, size);
+    if (sha256 && strcmp(sha256, diff->current_sha256) == 0) {
+        r = 0;
+        goto cleanup;
+    }
+    if (!sha256 || strcmp(sha256, diff->patches[diff->first].history_sha256)) {
+        opkg_msg(ERROR, "%s changed while it was being updated.\n",
+                 diff->list_file_name);
+        goto cleanup;
+    }
+    free(sha256);
+    sha256 = NULL;
+
+    for (i = diff->first; i < diff->last; i++) {
+        const struct diff_patch *patch = &diff->patches[i];
+        const char *location = patch_locations[i - diff->first];
+
+        if (!location)
+            goto cleanup;
+
+        script = list_diff_read(location, 1, &script_size);
+        if (!script)
+            goto cleanup;
+        sha256 = list_diff_sha256(script, script_size);
+        if (!sha256 || strcmp(sha256, patch->sha256) != 0) {
+            opkg_msg(ERROR, "SHA256 verification failed for %s/%s.gz.\n",
+                     diff->diff_url, patch->name);
+            goto cleanup;
+        }
+        free(sha256);
+        sha256 = NULL;
+
+        patched = ed_script_apply(data, size, script, script_size,
+                                  &patched_size);
+        if (!patched) {
+            opkg_msg(ERROR, "Failed to apply %s/%s.gz.\n", diff->diff_url,
+                     patch->name);
+            goto cleanup;
+        }
+        free(script);
+        script = NULL;
+        free(data);
+        data = patched;
+        size = patched_size;
+    }
+
+    sha256 = list_diff_sha256(data, size);
+    if (!sha256 || strcmp(sha256, diff->current_sha256) != 0) {
+        opkg_msg(ERROR, "SHA256 verification failed for patched %s.\n",
+                 diff->list_url);
+        goto cleanup;
+    }
+
+    r = list_diff_write(diff, data, size);
+
+ cleanup:
+    free(sha256);
+    free(script);
+    free(data);
+    return r;
+}
+
+static void list_diff_deinit(struct list_diff *diff)
+{
+    unsigned int i;
+
+    for (i = 0; i < diff->n_patches; i++) {
+        free(diff->patches[i].name);
+        free(diff->patches[i].history_sha256);
+        free(diff->patches[i].sha256);
+    }
+    free(diff->patches);
+    free(diff->current_sha256);
+    free(diff->diff_url);
+}
+
+void list_diff_update_multi(const char **list_urls,
+                            const char **list_file_names,
+                            const char **sha256s, int *results,
+                            unsigned int count)
+{
+    struct list_diff *diffs;
+    struct list_diff *diff;
+    char **urls, **cache_locations;
+    unsigned int *url_diffs;
+    unsigned int i, j, n = 0;
+
+    diffs = xcalloc(count, sizeof(*diffs));
+    urls = xcalloc(count, sizeof(*urls));
+    url_diffs = xcalloc(count, sizeof(*url_diffs));
+
+    /* First the indexes of those lists there is a local copy of. */
+    for (i = 0; i < count; i++) {
+        char *file_name;
+        const char *slash = strrchr(list_urls[i], '/');
+
+        diff = &diffs[i];
+        diff->list_url = list_urls[i];
+        diff->list_file_name = list_file_names[i];
+        diff->sha256 = sha256s ? sha256s[i] : NULL;
+        diff->result = -1;
+
+        file_name = list_diff_file_name(diff);
+        if (slash && file_exists(file_name)) {
+            sprintf_alloc(&diff->diff_url, "%.*s/Packages.diff",
+                          (int)(slash - list_urls[i]), list_urls[i]);
+            sprintf_alloc(&urls[n], "%s/Index", diff->diff_url);
+            url_diffs[n++] = i;
+        }
+        free(file_name);
+    }
+
+    cache_locations = xcalloc(count, sizeof(*cache_locations));
+    opkg_download_cache_multi((const char **)urls, cache_locations, n);
+
+    for (i = 0; i < n; i++) {
+        diff = &diffs[url_diffs[i]];
+        if (cache_locations[i] && list_diff_plan(diff, cache_locations[i]) == 0)
+            diff->result = 1;
+        free(cache_locations[i]);
+        free(urls[i]);
+    }
+    free(cache_locations);
+    free(url_diffs);
+
+    /* Then the patches they need. */
+    n = 0;
+    for (i = 0; i < count; i++) {
+        diff = &diffs[i];
+        if (diff->result != 1)
+            continue;
+        if (diff->first == diff->last) {
+            opkg_msg(DEBUG, "%s is up to date.\n", diff->list_file_name);
+            diff->result = 0;
+            continue;
+        }
+
+        diff->patch_index = n;
+        urls = xrealloc(urls, (n + diff->last - diff->first) * sizeof(*urls));
+        for (j = diff->first; j < diff->last; j++)
+            sprintf_alloc(&urls[n++], "%s/%s.gz", diff->diff_url,
+                          diff->patches[j].name);
+    }
+
+    cache_locations = xcalloc(n, sizeof(*cache_locations));
+    opkg_download_cache_multi((const char **)urls, cache_locations, n);
+
+    for (i = 0; i < count; i++) {
+        diff = &diffs[i];
+        if (diff->result != 1)
+            continue;
+        diff->result = list_diff_apply(diff,
+                                       &cache_locations[diff->patch_index]);
+        if (diff->result == 0)
+            opkg_msg(INFO, "Patched %s with %u diffs.\n",
+                     diff->list_file_name, diff->last - diff->first);
+    }
+
+    for (i = 0; i < n; i++) {
+        free(cache_locations[i]);
+        free(urls[i]);
+    }
+    free(cache_locations);
+    free(urls);
+
+    for (i = 0; i < count; i++) {
+        results[i] = diffs[i].result;
+        list_diff_deinit(&diffs[i]);
+    }
+    free(diffs);
+}
+
+int list_diff_update(const char *list_url, const char *list_file_name,
+                     const char *sha256)
+{
+    int result;
+
+    list_diff_update_multi(&list_url, &list_file_name, &sha256, &result, 1);
+    return result;
+}
@@ -0,0 +1,50 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* list_diff.h - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef LIST_DIFF_H
+#define LIST_DIFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Brings the local copy of a package list up to date from the patches
+ * published next to it, as Packages.diff/Index and the gzipped ed scripts it
+ * names, instead of downloading the whole list again.
+ *
+ * list_url is the URL of the Packages or Packages.gz file, list_file_name the
+ * uncompressed name of the list in lists_dir, which may be gzipped as
+ * compress_list_files makes it. If sha256 is not NULL, the list must end up
+ * with that checksum.
+ *
+ * Returns 0 if the list is up to date, -1 if it has to be downloaded in full.
+ */
+int list_diff_update(const char *list_url, const char *list_file_name,
+                     const char *sha256);
+
+/* Does the same for several lists, fetching their indexes and then their
+ * patches several at a time if parallel_downloads allows. results[i] is set
+ * to what list_diff_update() would return for the i-th list.
+ */
+void list_diff_update_multi(const char **list_urls,
+                            const char **list_file_names,
+                            const char **sha256s, int *results,
+                            unsigned int count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* LIST_DIFF_H */
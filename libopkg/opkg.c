@@ -200,7 +200,8 @@ int opkg_install_package(const char *package_url,
     pkg_vec_t *deps, *all;
     unsigned int i;
     char **unresolved = NULL;
-    char *package_name;
+    /* Left as it is when package_url is the name of a package. */
+    char *package_name = (char *)package_url;
 
     opkg_assert(package_url != NULL);
 
@@ -256,6 +257,27 @@ int opkg_install_package(const char *package_url,
     pkg_vec_insert(deps, new);
 
     /* download package and dependencies */
+    if (opkg_config->parallel_downloads > 1) {
+        struct _curl_cb_data cb_data;
+
+        /* They are downloaded together, so progress is reported for all of
+         * them at once. */
+        pdata.action = OPKG_DOWNLOAD;
+        cb_data.cb = progress_callback;
+        cb_data.progress_data = &pdata;
+        cb_data.user_data = user_data;
+        /* 75% of "install" progress is for downloading */
+        cb_data.start_range = 0;
+        cb_data.finish_range = 75;
+
+        err = opkg_download_pkgs(deps, (curl_progress_func) curl_progress_cb,
+                                 &cb_data);
+        if (err) {
+            pkg_vec_free(deps);
+            return -1;
+        }
+    }
+
     for (i = 0; i < deps->len; i++) {
         pkg_t *pkg;
         struct _curl_cb_data cb_data;
@@ -326,8 +348,7 @@ int opkg_install_package(const char *package_url,
     }
 
     /* write out status files and file lists */
-    opkg_conf_write_status_files();
-    pkg_write_changed_filelists();
+    opkg_conf_write_db();
 
     progress(&pdata, 100, progress_callback, user_data);
     return 0;
@@ -369,8 +390,7 @@ int opkg_remove_package(const char *package_name,
     err = opkg_remove_pkg(pkg_to_remove);
 
     /* write out status files and file lists */
-    opkg_conf_write_status_files();
-    pkg_write_changed_filelists();
+    opkg_conf_write_db();
 
     progress(&pdata, 100, progress_callback, user_data);
     return (err) ? -1 : 0;
@@ -416,8 +436,7 @@ int opkg_upgrade_package(const char *package_name,
     }
 
     /* write out status files and file lists */
-    opkg_conf_write_status_files();
-    pkg_write_changed_filelists();
+    opkg_conf_write_db();
 
     progress(&pdata, 100, progress_callback, user_data);
     return 0;
@@ -459,8 +478,7 @@ int opkg_upgrade_all(opkg_progress_callback_t progress_callback,
         return 1;
 
     /* write out status files and file lists */
-    opkg_conf_write_status_files();
-    pkg_write_changed_filelists();
+    opkg_conf_write_db();
 
     pdata.pkg = NULL;
     progress(&pdata, 100, progress_callback, user_data);
@@ -562,6 +580,7 @@ int opkg_list_packages(opkg_package_callback_t callback, void *user_data)
         pkg_t *pkg;
 
         pkg = all->pkgs[i];
+        pkg_hash_load_cold_fields(pkg);
 
         callback(pkg, user_data);
     }
@@ -588,6 +607,7 @@ int opkg_list_upgradable_packages(opkg_package_callback_t callback,
         new = pkg_hash_fetch_best_installation_candidate_by_name(old->name);
         if (new == NULL)
             continue;
+        pkg_hash_load_cold_fields(new);
         callback(new, user_data);
     }
     return 0;
@@ -641,6 +661,7 @@ pkg_t *opkg_find_package(const char *name, const char *ver, const char *arch,
 
         /* match found */
         pkg_vec_free(all);
+        pkg_hash_load_cold_fields(pkg);
         return pkg;
     }
 
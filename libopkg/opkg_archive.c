@@ -20,14 +20,22 @@
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "opkg_conf.h"
 #include "opkg_message.h"
 #include "opkg_archive.h"
 #include "file_util.h"
+#include "md5.h"
 #include "sprintf_alloc.h"
 #include "xfuncs.h"
 
@@ -324,15 +332,70 @@ static int extract_file_to_stream(struct archive *a, const char *name,
     }
 }
 
-/* Extact the paths of files contained in an open archive, writing data to an
- * open stream.  Returns 0 on success or <0 on error.
+/* Extract a single file from an open archive into a buffer, which the caller
+ * must free. The buffer is terminated by a NUL that is not counted in *len.
+ * Returns NULL on error.
  */
-static int extract_paths_to_stream(struct archive *a, FILE * stream)
+static char *extract_file_to_buffer(struct archive *a, const char *name,
+                                    size_t *len)
 {
     struct archive_entry *entry;
-    int r;
     const char *path;
+    size_t size, used = 0, n;
+    char *buffer;
+    int eof;
+
+    while (1) {
+        entry = read_header(a, NULL);
+        if (!entry)
+            return NULL;
+
+        /* As in extract_file_to_stream(). */
+        transform_dest_path(entry, NULL);
+
+        path = archive_entry_pathname(entry);
+        if (strcmp(path, name) == 0)
+            break;
+    }
+
+    /* Room for the data, the NUL and one more byte so that the last read
+     * sees EOF; the header is only trusted for small files. */
+    size = EXTRACT_BUFFER_LEN;
+    if (archive_entry_size_is_set(entry) && archive_entry_size(entry) >= 0
+            && archive_entry_size(entry) < EXTRACT_BUFFER_LEN)
+        size = archive_entry_size(entry) + 2;
+    buffer = xmalloc(size);
+
+    while (1) {
+        if (size - used < 2) {
+            size *= 2;
+            buffer = xrealloc(buffer, size);
+        }
+
+        n = read_data(a, buffer + used, size - used - 1, &eof);
+        if (eof)
+            break;
+        if (n == 0) {
+            free(buffer);
+            return NULL;
+        }
+        used += n;
+    }
+
+    buffer[used] = '\0';
+    *len = used;
+    return buffer;
+}
+
+/* Pass the path, mode and symlink target (or NULL) of each file contained in
+ * an open archive to fn, stopping if it returns non-zero. Returns 0 on
+ * success or <0 on error.
+ */
+static int extract_paths(struct archive *a, ar_path_fn fn, void *data)
+{
+    struct archive_entry *entry;
     const struct stat *entry_stat;
+    const char *link_target;
     int eof;
 
     while (1) {
@@ -342,21 +405,44 @@ static int extract_paths_to_stream(struct archive *a, FILE * stream)
         if (!entry)
             return -1;
 
-        path = archive_entry_pathname(entry);
         entry_stat = archive_entry_stat(entry);
-        if (S_ISLNK(entry_stat->st_mode)) {
-            r = fprintf(stream, "%s\t%#03o\t%s\n", path, (unsigned int)entry_stat->st_mode,
-                        archive_entry_symlink(entry));
-        } else {
-            r = fprintf(stream, "%s\t%#03o\n", path, (unsigned int)entry_stat->st_mode);
-        }
-        if (r <= 0) {
-            opkg_msg(ERROR, "Failed to path to stream: %s\n", strerror(errno));
+        link_target = NULL;
+        if (S_ISLNK(entry_stat->st_mode))
+            link_target = archive_entry_symlink(entry);
+
+        if (fn(archive_entry_pathname(entry), entry_stat->st_mode,
+               link_target, data) != 0)
             return -1;
-        }
     }
 }
 
+static int print_path(const char *path, mode_t mode, const char *link_target,
+                      void *data)
+{
+    FILE *stream = data;
+    int r;
+
+    if (link_target)
+        r = fprintf(stream, "%s\t%#03o\t%s\n", path, (unsigned int)mode,
+                    link_target);
+    else
+        r = fprintf(stream, "%s\t%#03o\n", path, (unsigned int)mode);
+    if (r <= 0) {
+        opkg_msg(ERROR, "Failed to path to stream: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Extact the paths of files contained in an open archive, writing data to an
+ * open stream.  Returns 0 on success or <0 on error.
+ */
+static int extract_paths_to_stream(struct archive *a, FILE * stream)
+{
+    return extract_paths(a, print_path, stream);
+}
+
 static struct archive *open_disk(int flags)
 {
     struct archive *disk;
@@ -447,13 +533,89 @@ static int extract_entry(struct archive *a, struct archive_entry *entry,
     return 0;
 }
 
+/* Extract a regular file to disk as extract_entry() does, computing the md5sum
+ * of its data as it is written so the file need not be read back to get it.
+ * Returns 0 on success or <0 on error.
+ */
+static int extract_entry_md5(struct archive *a, struct archive_entry *entry,
+                             struct archive *disk, char **md5sum)
+{
+    static const char zeros[4096];
+    struct md5_ctx ctx;
+    unsigned char md5sum_bin[16];
+    const void *buffer;
+    size_t len;
+    int64_t offset;
+    int64_t hashed = 0;
+    int r;
+
+    r = archive_write_header(disk, entry);
+    if (r == ARCHIVE_WARN) {
+        opkg_msg(NOTICE, "Warning when extracting archive entry '%s': %s\n",
+                 archive_entry_pathname(entry), archive_error_string(disk));
+    } else if (r != ARCHIVE_OK) {
+        opkg_msg(ERROR, "Failed to extract archive entry '%s': %s\n",
+                 archive_entry_pathname(entry), archive_error_string(disk));
+        return -1;
+    }
+
+    md5_init_ctx(&ctx);
+    while ((r = archive_read_data_block(a, &buffer, &len, &offset)) == ARCHIVE_OK) {
+        /* Holes in sparse entries read back as zeros. */
+        while (hashed < offset) {
+            size_t n = sizeof(zeros);
+            if (offset - hashed < (int64_t)n)
+                n = offset - hashed;
+            md5_process_bytes(zeros, n, &ctx);
+            hashed += n;
+        }
+        md5_process_bytes(buffer, len, &ctx);
+        hashed += len;
+
+        r = archive_write_data_block(disk, buffer, len, offset);
+        if (r < ARCHIVE_WARN) {
+            opkg_msg(ERROR, "Failed to extract archive entry '%s': %s\n",
+                     archive_entry_pathname(entry), archive_error_string(disk));
+            return -1;
+        }
+    }
+    if (r != ARCHIVE_EOF) {
+        opkg_msg(ERROR, "Failed to extract archive entry '%s': %s\n",
+                 archive_entry_pathname(entry), archive_error_string(a));
+        return -1;
+    }
+    while (hashed < archive_entry_size(entry)) {
+        size_t n = sizeof(zeros);
+        if (archive_entry_size(entry) - hashed < (int64_t)n)
+            n = archive_entry_size(entry) - hashed;
+        md5_process_bytes(zeros, n, &ctx);
+        hashed += n;
+    }
+
+    r = archive_write_finish_entry(disk);
+    if (r < ARCHIVE_WARN) {
+        opkg_msg(ERROR, "Failed to extract archive entry '%s': %s\n",
+                 archive_entry_pathname(entry), archive_error_string(disk));
+        return -1;
+    }
+
+    md5_finish_ctx(&ctx, md5sum_bin);
+    free(*md5sum);
+    *md5sum = md5_to_string(md5sum_bin);
+    return 0;
+}
+
 /* Extract all files in an archive to the filesystem under the path given by
- * dest. Returns 0 on success or <0 on error.
+ * dest. Where fn is given, it is asked about each regular file extracted and
+ * the md5sum of the file is stored wherever it says. Returns 0 on success or
+ * <0 on error.
  */
-static int extract_all(struct archive *a, const char *dest, int flags, long unsigned int *size)
+static int extract_all(struct archive *a, const char *dest, int flags,
+                       long unsigned int *size, ar_md5_fn fn, void *data)
 {
     struct archive *disk;
     struct archive_entry *entry;
+    char **md5sum;
     int r;
     int eof;
 
@@ -480,7 +642,15 @@ static int extract_all(struct archive *a, const char *dest, int flags, long unsi
 
         print_paths(entry);
 
-        r = extract_entry(a, entry, disk);
+        md5sum = NULL;
+        if (fn && archive_entry_filetype(entry) == AE_IFREG
+                && !archive_entry_hardlink(entry))
+            md5sum = fn(archive_entry_pathname(entry), data);
+
+        if (md5sum)
+            r = extract_entry_md5(a, entry, disk, md5sum);
+        else
+            r = extract_entry(a, entry, disk);
         if (r < 0)
             goto err_cleanup;
 	else if (size)
@@ -543,91 +713,75 @@ static struct archive *open_outer(const char *filename)
     return NULL;
 }
 
-/* Open an inner archive at the current position within the given outer archive. */
-static struct archive *open_inner(struct archive *outer)
-{
-    struct archive *inner;
-    struct inner_data *data;
-    int r;
+/* The compressed tar formats control and data may come in, by the extension
+ * of their member name, in the order they are looked for. */
+struct inner_filter {
+    const char *ext;
+    const char *name;
+    int (*support) (struct archive *);
+};
 
-    inner = archive_read_new();
-    if (!inner) {
-        opkg_msg(ERROR, "Failed to create inner archive object.\n");
-        return NULL;
-    }
+static const struct inner_filter inner_filters[] = {
+    {"gz", "Gzip", archive_read_support_filter_gzip},
+#if HAVE_XZ
+    {"xz", "Xz", archive_read_support_filter_xz},
+#endif
+#if HAVE_BZIP2
+    {"bz2", "Bzip2", archive_read_support_filter_bzip2},
+#endif
+#if HAVE_LZ4
+    {"lz4", "Lz4", archive_read_support_filter_lz4},
+#endif
+#if HAVE_ZSTD
+    {"zst", "Zstandard", archive_read_support_filter_zstd},
+#endif
+    {NULL, NULL, NULL}
+};
 
-    data = (struct inner_data *)xmalloc(sizeof(struct inner_data));
-    data->buffer = xmalloc(EXTRACT_BUFFER_LEN);
-    data->outer = outer;
+static int support_filter(struct archive *a, const struct inner_filter *filter)
+{
+    int r;
 
-    /* Inner package is in 'tar' format, gzip compressed. */
-    r = archive_read_support_filter_gzip(inner);
+    r = filter->support(a);
     if (r == ARCHIVE_WARN) {
         /* libarchive returns ARCHIVE_WARN if the filter is provided by
          * an external program.
          */
-        opkg_msg(INFO, "Gzip support provided by external program.\n");
+        opkg_msg(INFO, "%s support provided by external program.\n",
+                 filter->name);
     } else if (r != ARCHIVE_OK) {
-        opkg_msg(ERROR, "Gzip format not supported.\n");
-        goto err_cleanup;
+        opkg_msg(ERROR, "%s format not supported.\n", filter->name);
+        return -1;
     }
 
-#if HAVE_XZ
-    r = archive_read_support_filter_xz(inner);
-    if (r == ARCHIVE_WARN) {
-        /* libarchive returns ARCHIVE_WARN if the filter is provided by
-         * an external program.
-         */
-        opkg_msg(INFO, "Xz support provided by external program.\n");
-    } else if (r != ARCHIVE_OK) {
-        opkg_msg(ERROR, "Xz format not supported.\n");
-        goto err_cleanup;
-    }
-#endif
+    return 0;
+}
 
-#if HAVE_BZIP2
-    r = archive_read_support_filter_bzip2(inner);
-    if (r == ARCHIVE_WARN) {
-        /* libarchive returns ARCHIVE_WARN if the filter is provided by
-         * an external program.
-         */
-        opkg_msg(INFO, "Bzip2 support provided by external program.\n");
-    } else if (r != ARCHIVE_OK) {
-        opkg_msg(ERROR, "Bzip2 format not supported.\n");
-        goto err_cleanup;
-    }
-#endif
+/* Open an inner tar archive compressed with the given filter, or not
+ * compressed if filter is NULL, reading it through the given callbacks. data
+ * is released by close, even on error.
+ */
+static struct archive *open_inner(const struct inner_filter *filter,
+                                  void *data, archive_read_callback * read,
+                                  archive_close_callback * close)
+{
+    struct archive *inner;
+    int r;
 
-#if HAVE_LZ4
-    r = archive_read_support_filter_lz4(inner);
-    if (r == ARCHIVE_WARN) {
-        /* libarchive returns ARCHIVE_WARN if the filter is provided by
-         * an external program.
-         */
-        opkg_msg(INFO, "Lz4 support provided by external program.\n");
-    } else if (r != ARCHIVE_OK) {
-        opkg_msg(ERROR, "Lz4 format not supported.\n");
-        goto err_cleanup;
+    inner = archive_read_new();
+    if (!inner) {
+        opkg_msg(ERROR, "Failed to create inner archive object.\n");
+        close(NULL, data);
+        return NULL;
     }
-#endif
 
-#if HAVE_ZSTD
-    r = archive_read_support_filter_zstd(inner);
-    if (r == ARCHIVE_WARN) {
-        /* libarchive returns ARCHIVE_WARN if the filter is provided by
-         * an external program.
-         */
-        opkg_msg(INFO, "Zstandard support provided by external program.\n");
-    } else if (r != ARCHIVE_OK) {
-        opkg_msg(ERROR, "Zstandard format not supported.\n");
+    if (filter && support_filter(inner, filter) < 0)
         goto err_cleanup;
-    }
-#endif
 
     r = archive_read_support_format_tar(inner);
     if (r != ARCHIVE_OK) {
         opkg_msg(ERROR, "Tar format not supported: %s\n",
-                 archive_error_string(outer));
+                 archive_error_string(inner));
         goto err_cleanup;
     }
 
@@ -638,10 +792,12 @@ static struct archive *open_inner(struct archive *outer)
         goto err_cleanup;
     }
 
-    r = archive_read_open(inner, data, NULL, inner_read, inner_close);
+    r = archive_read_open(inner, data, NULL, read, close);
     if (r != ARCHIVE_OK) {
+        /* libarchive has called close already. */
         opkg_msg(ERROR, "Failed to open inner archive: %s\n",
                  archive_error_string(inner));
+        archive_read_free(inner);
         return NULL;
     }
 
@@ -649,8 +805,7 @@ static struct archive *open_inner(struct archive *outer)
 
  err_cleanup:
     archive_read_free(inner);
-    free(data->buffer);
-    free(data);
+    close(NULL, data);
     return NULL;
 }
 
@@ -683,35 +838,589 @@ static int find_inner(struct archive *outer, const char *arname)
     }
 }
 
-/* Prepare to extract 'control.tar.gz' or 'data.tar.gz' from the outer package
- * archive, returning a `struct archive *` for the enclosed file. On error,
- * return NULL.
+/* Prepare to read 'control.tar.gz' or 'data.tar.gz' from an outer package
+ * archive read by libarchive, returning the inner_data to read the enclosed
+ * file through. On error, return NULL.
  */
-static struct archive *extract_outer(const char *filename, const char *arname)
+static struct inner_data *extract_outer(const char *filename,
+                                        const char *arname)
 {
-    int r;
-    struct archive *inner;
     struct archive *outer;
+    struct inner_data *data;
 
     outer = open_outer(filename);
     if (!outer)
         return NULL;
 
-    r = find_inner(outer, arname);
+    if (find_inner(outer, arname) < 0) {
+        archive_read_free(outer);
+        return NULL;
+    }
+
+    data = (struct inner_data *)xmalloc(sizeof(struct inner_data));
+    data->buffer = xmalloc(EXTRACT_BUFFER_LEN);
+    data->outer = outer;
+
+    return data;
+}
+
+#ifdef HAVE_PTHREAD
+/*******************************************************************************
+ * Decompression thread.
+ *
+ * An inner archive can be decompressed on a thread of its own, which hands
+ * the data on through a few buffers to the tar reader of the calling thread.
+ * Decompressing the next blocks then overlaps with unpacking and writing out
+ * the files of the previous ones.
+ */
+
+#define PIPE_BLOCKS 4
+
+struct pipe_data {
+    /* Reads the decompressed inner archive, on the thread. */
+    struct archive *source;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    /* A ring of blocks: the first count from head hold data, the first of
+     * them is being read by the tar reader if held is set. */
+    void *blocks[PIPE_BLOCKS];
+    ssize_t lens[PIPE_BLOCKS];
+    unsigned int head;
+    unsigned int count;
+    int held;
+
+    int eof;
+    int closing;
+    char *error;
+};
+
+static void pipe_finish(struct pipe_data *pipe, ssize_t r)
+{
+    pthread_mutex_lock(&pipe->mutex);
     if (r < 0)
+        pipe->error = xstrdup(archive_error_string(pipe->source)
+                              ? archive_error_string(pipe->source)
+                              : "Failed to decompress");
+    else
+        pipe->eof = 1;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->mutex);
+}
+
+static void *pipe_decompress(void *client_data)
+{
+    struct pipe_data *pipe = (struct pipe_data *)client_data;
+    struct archive_entry *entry;
+    unsigned int slot;
+    ssize_t r;
+
+    /* The raw format presents the decompressed data as a single entry. */
+    r = archive_read_next_header(pipe->source, &entry);
+    if (r == ARCHIVE_EOF) {
+        pipe_finish(pipe, 0);
+        return NULL;
+    }
+    if (r < ARCHIVE_WARN) {
+        pipe_finish(pipe, -1);
+        return NULL;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pipe->mutex);
+        while (pipe->count == PIPE_BLOCKS && !pipe->closing)
+            pthread_cond_wait(&pipe->cond, &pipe->mutex);
+        if (pipe->closing) {
+            pthread_mutex_unlock(&pipe->mutex);
+            return NULL;
+        }
+        slot = (pipe->head + pipe->count) % PIPE_BLOCKS;
+        pthread_mutex_unlock(&pipe->mutex);
+
+        /* The tar reader never touches a block past head + count. */
+        r = archive_read_data(pipe->source, pipe->blocks[slot],
+                              EXTRACT_BUFFER_LEN);
+        if (r <= 0) {
+            pipe_finish(pipe, r);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&pipe->mutex);
+        pipe->lens[slot] = r;
+        pipe->count++;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mutex);
+    }
+}
+
+static ssize_t pipe_read(struct archive *a, void *client_data,
+                         const void **buff)
+{
+    struct pipe_data *pipe = (struct pipe_data *)client_data;
+    ssize_t r;
+
+    pthread_mutex_lock(&pipe->mutex);
+
+    /* libarchive is done with the block it was given last time. */
+    if (pipe->held) {
+        pipe->head = (pipe->head + 1) % PIPE_BLOCKS;
+        pipe->count--;
+        pipe->held = 0;
+        pthread_cond_broadcast(&pipe->cond);
+    }
+
+    while (!pipe->count && !pipe->eof && !pipe->error)
+        pthread_cond_wait(&pipe->cond, &pipe->mutex);
+
+    if (pipe->count) {
+        *buff = pipe->blocks[pipe->head];
+        r = pipe->lens[pipe->head];
+        pipe->held = 1;
+    } else if (pipe->error) {
+        archive_set_error(a, EIO, "%s", pipe->error);
+        r = -1;
+    } else {
+        r = 0;
+    }
+
+    pthread_mutex_unlock(&pipe->mutex);
+    return r;
+}
+
+static int pipe_close(struct archive *a, void *client_data)
+{
+    (void)a;
+
+    struct pipe_data *pipe = (struct pipe_data *)client_data;
+    unsigned int i;
+
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->closing = 1;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->mutex);
+
+    pthread_join(pipe->thread, NULL);
+    archive_read_free(pipe->source);
+
+    for (i = 0; i < PIPE_BLOCKS; i++)
+        free(pipe->blocks[i]);
+    free(pipe->error);
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->mutex);
+    free(pipe);
+
+    return ARCHIVE_OK;
+}
+
+/* Like open_inner(), with the decompression done on a thread of its own. */
+static struct archive *open_inner_piped(const struct inner_filter *filter,
+                                        void *data,
+                                        archive_read_callback * read,
+                                        archive_close_callback * close)
+{
+    struct archive *source;
+    struct pipe_data *pipe;
+    unsigned int i;
+    int r;
+
+    source = archive_read_new();
+    if (!source) {
+        opkg_msg(ERROR, "Failed to create inner archive object.\n");
+        close(NULL, data);
+        return NULL;
+    }
+
+    if (support_filter(source, filter) < 0)
+        goto err_cleanup;
+
+    r = archive_read_support_format_raw(source);
+    if (r != ARCHIVE_OK) {
+        opkg_msg(ERROR, "Raw format not supported: %s\n",
+                 archive_error_string(source));
+        goto err_cleanup;
+    }
+
+    r = archive_read_support_format_empty(source);
+    if (r != ARCHIVE_OK) {
+        opkg_msg(ERROR, "Empty format not supported: %s\n",
+                 archive_error_string(source));
         goto err_cleanup;
+    }
+
+    r = archive_read_open(source, data, NULL, read, close);
+    if (r != ARCHIVE_OK) {
+        /* libarchive has called close already. */
+        opkg_msg(ERROR, "Failed to open inner archive: %s\n",
+                 archive_error_string(source));
+        archive_read_free(source);
+        return NULL;
+    }
 
-    inner = open_inner(outer);
-    if (!inner)
+    pipe = (struct pipe_data *)xcalloc(1, sizeof(struct pipe_data));
+    pipe->source = source;
+    for (i = 0; i < PIPE_BLOCKS; i++)
+        pipe->blocks[i] = xmalloc(EXTRACT_BUFFER_LEN);
+    pthread_mutex_init(&pipe->mutex, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+
+    r = pthread_create(&pipe->thread, NULL, pipe_decompress, pipe);
+    if (r != 0) {
+        opkg_msg(ERROR, "Failed to start decompression thread: %s.\n",
+                 strerror(r));
+        archive_read_free(source);
+        for (i = 0; i < PIPE_BLOCKS; i++)
+            free(pipe->blocks[i]);
+        pthread_cond_destroy(&pipe->cond);
+        pthread_mutex_destroy(&pipe->mutex);
+        free(pipe);
         return NULL;
+    }
 
-    return inner;
+    return open_inner(NULL, pipe, pipe_read, pipe_close);
 
  err_cleanup:
+    archive_read_free(source);
+    close(NULL, data);
+    return NULL;
+}
+#endif
+
+/* Whether data archives are decompressed on a thread of their own. */
+static int extract_threaded(void)
+{
+#ifdef HAVE_PTHREAD
+    long n = opkg_config->extract_threads;
+
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 1;
+#else
+    return 0;
+#endif
+}
+
+/*******************************************************************************
+ * Package member index.
+ *
+ * A package is normally an uncompressed ar archive, so where its members lie
+ * can be read from their headers without decompressing anything. The
+ * members are then read straight from the package file.
+ */
+
+#define AR_MAGIC "!<arch>\n"
+#define AR_MAGIC_LEN 8
+#define AR_HEADER_LEN 60
+#define AR_NAME_MAX 255
+
+struct ar_member {
+    char *name;
+    /* Where the data of the member starts, or -1 when the package is not an
+     * ar archive and the member has to be found by reading it. */
+    off_t offset;
+    off_t size;
+};
+
+struct opkg_ar_index {
+    char *filename;
+    /* The package file as it was when indexed. */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned int n_members;
+    struct ar_member *members;
+};
+
+/* Reads an ar member straight from the package file. */
+struct member_data {
+    int fd;
+    off_t remaining;
+    void *buffer;
+};
+
+static ssize_t member_read(struct archive *a, void *client_data,
+                           const void **buff)
+{
+    struct member_data *data = (struct member_data *)client_data;
+    size_t len = EXTRACT_BUFFER_LEN;
+    ssize_t r;
+
+    if (data->remaining == 0)
+        return 0;
+    if ((off_t) len > data->remaining)
+        len = data->remaining;
+
+    do {
+        r = read(data->fd, data->buffer, len);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) {
+        archive_set_error(a, r < 0 ? errno : EIO,
+                          "Failed to read package member");
+        return -1;
+    }
+
+    *buff = data->buffer;
+    data->remaining -= r;
+    return r;
+}
+
+static int member_close(struct archive *a, void *client_data)
+{
+    (void)a;
+
+    struct member_data *data = (struct member_data *)client_data;
+
+    close(data->fd);
+    free(data->buffer);
+    free(data);
+
+    return ARCHIVE_OK;
+}
+
+static void ar_index_add(struct opkg_ar_index *index, const char *name,
+                         off_t offset, off_t size)
+{
+    struct ar_member *member;
+
+    index->members = xrealloc(index->members,
+                              (index->n_members + 1) * sizeof(*member));
+    member = &index->members[index->n_members++];
+    member->name = xstrdup(name);
+    member->offset = offset;
+    member->size = size;
+}
+
+static void ar_index_clear(struct opkg_ar_index *index)
+{
+    unsigned int i;
+
+    for (i = 0; i < index->n_members; i++)
+        free(index->members[i].name);
+    free(index->members);
+    index->members = NULL;
+    index->n_members = 0;
+}
+
+static int read_at(int fd, void *buf, size_t len, off_t offset)
+{
+    ssize_t r;
+
+    do {
+        r = pread(fd, buf, len, offset);
+    } while (r < 0 && errno == EINTR);
+
+    return (r == (ssize_t) len) ? 0 : -1;
+}
+
+/* Index the members of an ar archive from their headers. Both the GNU and
+ * the BSD ways of storing names are understood.
+ */
+static int ar_index_scan_ar(struct opkg_ar_index *index, int fd)
+{
+    char header[AR_HEADER_LEN];
+    char name[AR_NAME_MAX + 1];
+    char size_field[11];
+    char *end;
+    off_t pos = AR_MAGIC_LEN;
+    off_t size;
+    size_t len;
+
+    while (pos + AR_HEADER_LEN <= index->size) {
+        if (read_at(fd, header, AR_HEADER_LEN, pos) < 0)
+            return -1;
+        if (header[58] != '`' || header[59] != '\n')
+            return -1;
+        pos += AR_HEADER_LEN;
+
+        memcpy(size_field, header + 48, 10);
+        size_field[10] = '\0';
+        size = strtoll(size_field, &end, 10);
+        if (end == size_field || size < 0 || size > index->size - pos)
+            return -1;
+
+        len = 16;
+        while (len > 0 && header[len - 1] == ' ')
+            len--;
+        memcpy(name, header, len);
+        name[len] = '\0';
+
+        if (strncmp(name, "#1/", 3) == 0) {
+            len = strtoul(name + 3, NULL, 10);
+            if (len > AR_NAME_MAX || (off_t) len > size
+                    || read_at(fd, name, len, pos) < 0)
+                return -1;
+            name[len] = '\0';
+            pos += len;
+            size -= len;
+        } else if (len > 1 && name[len - 1] == '/' && name[0] != '/') {
+            name[len - 1] = '\0';
+        }
+
+        ar_index_add(index, name, pos, size);
+        pos += size + (size & 1);
+    }
+
+    return 0;
+}
+
+/* Index the members of a package libarchive has to read, such as a tar.gz.
+ * Only the names are known then.
+ */
+static int ar_index_scan_outer(struct opkg_ar_index *index)
+{
+    struct archive *outer;
+    struct archive_entry *entry;
+    int eof;
+
+    outer = open_outer(index->filename);
+    if (!outer)
+        return -1;
+
+    while (1) {
+        entry = read_header(outer, &eof);
+        if (!entry)
+            break;
+        transform_dest_path(entry, NULL);
+        ar_index_add(index, archive_entry_pathname(entry), -1, 0);
+    }
+
     archive_read_free(outer);
+    return eof ? 0 : -1;
+}
+
+static int ar_index_scan(struct opkg_ar_index *index, int fd)
+{
+    char magic[AR_MAGIC_LEN];
+    struct stat st;
+    int r;
+
+    ar_index_clear(index);
+
+    if (fstat(fd, &st) != 0) {
+        opkg_perror(ERROR, "Failed to stat package '%s'", index->filename);
+        return -1;
+    }
+    index->dev = st.st_dev;
+    index->ino = st.st_ino;
+    index->size = st.st_size;
+    index->mtime = st.st_mtim;
+
+    if (read_at(fd, magic, AR_MAGIC_LEN, 0) == 0
+            && memcmp(magic, AR_MAGIC, AR_MAGIC_LEN) == 0) {
+        r = ar_index_scan_ar(index, fd);
+        if (r < 0)
+            opkg_msg(ERROR, "Failed to read ar headers of package '%s'.\n",
+                     index->filename);
+    } else {
+        r = ar_index_scan_outer(index);
+    }
+
+    return r;
+}
+
+static int ar_index_is_current(struct opkg_ar_index *index, int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && st.st_dev == index->dev
+        && st.st_ino == index->ino && st.st_size == index->size
+        && st.st_mtim.tv_sec == index->mtime.tv_sec
+        && st.st_mtim.tv_nsec == index->mtime.tv_nsec;
+}
+
+static struct ar_member *ar_index_find(struct opkg_ar_index *index,
+                                       const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < index->n_members; i++)
+        if (strcmp(index->members[i].name, name) == 0)
+            return &index->members[i];
+
     return NULL;
 }
 
+/* Open '<prefix>.tar.*' from the indexed package, with only the decompressor
+ * its name calls for, on a thread of its own if threaded is set. Returns NULL
+ * if there is no such member or on error.
+ */
+static struct archive *open_member(struct opkg_ar_index *index,
+                                   const char *prefix, int threaded)
+{
+    const struct inner_filter *filter;
+    struct ar_member *member = NULL;
+    struct member_data *mdata;
+    archive_read_callback *read;
+    archive_close_callback *close_cb;
+    void *data;
+    char *arname = NULL;
+    int fd;
+
+    fd = open(index->filename, O_RDONLY);
+    if (fd < 0) {
+        opkg_perror(ERROR, "Failed to open package '%s'", index->filename);
+        return NULL;
+    }
+
+    /* The package may have been downloaded again since it was indexed. */
+    if (!ar_index_is_current(index, fd) && ar_index_scan(index, fd) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    for (filter = inner_filters; filter->ext; filter++) {
+        free(arname);
+        sprintf_alloc(&arname, "%s.tar.%s", prefix, filter->ext);
+        member = ar_index_find(index, arname);
+        if (member)
+            break;
+    }
+    if (!member) {
+        opkg_msg(DEBUG, "No %s.tar.* in package '%s'.\n", prefix,
+                 index->filename);
+        free(arname);
+        close(fd);
+        return NULL;
+    }
+
+    if (member->offset < 0) {
+        /* Not an ar archive: read through the package to the member. */
+        close(fd);
+        data = extract_outer(index->filename, arname);
+        free(arname);
+        if (!data)
+            return NULL;
+        read = inner_read;
+        close_cb = inner_close;
+    } else {
+        free(arname);
+        if (lseek(fd, member->offset, SEEK_SET) < 0) {
+            opkg_perror(ERROR, "Failed to seek in package '%s'",
+                        index->filename);
+            close(fd);
+            return NULL;
+        }
+
+        mdata = (struct member_data *)xmalloc(sizeof(struct member_data));
+        mdata->fd = fd;
+        mdata->remaining = member->size;
+        mdata->buffer = xmalloc(EXTRACT_BUFFER_LEN);
+        data = mdata;
+        read = member_read;
+        close_cb = member_close;
+    }
+
+#ifdef HAVE_PTHREAD
+    if (threaded)
+        return open_inner_piped(filter, data, read, close_cb);
+#else
+    (void)threaded;
+#endif
+    return open_inner(filter, data, read, close_cb);
+}
+
 static struct archive *open_compressed_file(const char *filename)
 {
     struct archive *ar;
@@ -823,33 +1532,49 @@ cleanup:
  * Glue layer.
  */
 
-struct opkg_ar *ar_open_pkg_control_archive(const char *filename)
+struct opkg_ar_index *ar_index_open(const char *filename)
+{
+    struct opkg_ar_index *index;
+    int fd, r;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        opkg_perror(ERROR, "Failed to open package '%s'", filename);
+        return NULL;
+    }
+
+    index = (struct opkg_ar_index *)xcalloc(1, sizeof(struct opkg_ar_index));
+    index->filename = xstrdup(filename);
+
+    r = ar_index_scan(index, fd);
+    close(fd);
+    if (r < 0) {
+        ar_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+const char *ar_index_filename(struct opkg_ar_index *index)
+{
+    return index->filename;
+}
+
+void ar_index_free(struct opkg_ar_index *index)
+{
+    ar_index_clear(index);
+    free(index->filename);
+    free(index);
+}
+
+struct opkg_ar *ar_index_open_control(struct opkg_ar_index *index)
 {
     struct opkg_ar *ar;
 
     ar = (struct opkg_ar *)xmalloc(sizeof(struct opkg_ar));
 
-    ar->ar = extract_outer(filename, "control.tar.gz");
-#if HAVE_XZ
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "control.tar.xz");
-    }
-#endif
-#if HAVE_BZIP2
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "control.tar.bz2");
-    }
-#endif
-#if HAVE_LZ4
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "control.tar.lz4");
-    }
-#endif
-#if HAVE_ZSTD
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "control.tar.zst");
-    }
-#endif
+    ar->ar = open_member(index, "control", 0);
     if (!ar->ar) {
         free(ar);
         return NULL;
@@ -865,34 +1590,13 @@ struct opkg_ar *ar_open_pkg_control_archive(const char *filename)
     return ar;
 }
 
-struct opkg_ar *ar_open_pkg_data_archive(const char *filename)
+struct opkg_ar *ar_index_open_data(struct opkg_ar_index *index)
 {
     struct opkg_ar *ar;
 
     ar = (struct opkg_ar *)xmalloc(sizeof(struct opkg_ar));
 
-    ar->ar = extract_outer(filename, "data.tar.gz");
-#if HAVE_XZ
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "data.tar.xz");
-    }
-#endif
-#if HAVE_BZIP2
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "data.tar.bz2");
-    }
-#endif
-#if HAVE_LZ4
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "data.tar.lz4");
-    }
-#endif
-#if HAVE_ZSTD
-    if (!ar->ar) {
-        ar->ar = extract_outer(filename, "data.tar.zst");
-    }
-#endif
-
+    ar->ar = open_member(index, "data", extract_threaded());
     if (!ar->ar) {
         free(ar);
         return NULL;
@@ -914,6 +1618,36 @@ struct opkg_ar *ar_open_pkg_data_archive(const char *filename)
     return ar;
 }
 
+struct opkg_ar *ar_open_pkg_control_archive(const char *filename)
+{
+    struct opkg_ar_index *index;
+    struct opkg_ar *ar;
+
+    index = ar_index_open(filename);
+    if (!index)
+        return NULL;
+
+    ar = ar_index_open_control(index);
+    ar_index_free(index);
+
+    return ar;
+}
+
+struct opkg_ar *ar_open_pkg_data_archive(const char *filename)
+{
+    struct opkg_ar_index *index;
+    struct opkg_ar *ar;
+
+    index = ar_index_open(filename);
+    if (!index)
+        return NULL;
+
+    ar = ar_index_open_data(index);
+    ar_index_free(index);
+
+    return ar;
+}
+
 struct opkg_ar *ar_open_compressed_file(const char *filename)
 {
     struct opkg_ar *ar;
@@ -958,14 +1692,31 @@ int ar_extract_file_to_stream(struct opkg_ar *ar, const char *filename,
     return extract_file_to_stream(ar->ar, filename, stream);
 }
 
+char *ar_extract_file_to_buffer(struct opkg_ar *ar, const char *filename,
+                                size_t *len)
+{
+    return extract_file_to_buffer(ar->ar, filename, len);
+}
+
 int ar_extract_paths_to_stream(struct opkg_ar *ar, FILE * stream)
 {
     return extract_paths_to_stream(ar->ar, stream);
 }
 
+int ar_extract_paths(struct opkg_ar *ar, ar_path_fn fn, void *data)
+{
+    return extract_paths(ar->ar, fn, data);
+}
+
 int ar_extract_all(struct opkg_ar *ar, const char *prefix, long unsigned int *size)
 {
-    return extract_all(ar->ar, prefix, ar->extract_flags, size);
+    return extract_all(ar->ar, prefix, ar->extract_flags, size, NULL, NULL);
+}
+
+int ar_extract_all_md5(struct opkg_ar *ar, const char *prefix,
+                       long unsigned int *size, ar_md5_fn fn, void *data)
+{
+    return extract_all(ar->ar, prefix, ar->extract_flags, size, fn, data);
 }
 
 void ar_close(struct opkg_ar *ar)
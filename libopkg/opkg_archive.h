@@ -19,6 +19,8 @@
 #ifndef OPKG_ARCHIVE_H
 #define OPKG_ARCHIVE_H
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,14 +30,41 @@ struct opkg_ar {
     int extract_flags;
 };
 
+/* Called for each file of an archive; link_target is NULL unless the file
+ * is a symlink. A non-zero return stops the walk. */
+typedef int (*ar_path_fn) (const char *path, mode_t mode,
+                           const char *link_target, void *data);
+
+/* Called for each regular file ar_extract_all_md5() extracts, with the path it
+ * is extracted to. Returns where the md5sum of the file's data is to be stored,
+ * replacing any string already there, or NULL if it is not wanted. */
+typedef char **(*ar_md5_fn) (const char *path, void *data);
+
+/* The members of a package file and where they lie in it, so the control
+ * and data archives can be opened without scanning the package each time.
+ * An index notices when its package file is replaced and indexes it again.
+ */
+struct opkg_ar_index;
+
+struct opkg_ar_index *ar_index_open(const char *filename);
+const char *ar_index_filename(struct opkg_ar_index *index);
+void ar_index_free(struct opkg_ar_index *index);
+struct opkg_ar *ar_index_open_control(struct opkg_ar_index *index);
+struct opkg_ar *ar_index_open_data(struct opkg_ar_index *index);
+
 struct opkg_ar *ar_open_pkg_control_archive(const char *filename);
 struct opkg_ar *ar_open_pkg_data_archive(const char *filename);
 struct opkg_ar *ar_open_compressed_file(const char *filename);
 int ar_copy_to_stream(struct opkg_ar *ar, FILE * stream);
 int ar_extract_file_to_stream(struct opkg_ar *ar, const char *filename,
                               FILE * stream);
+char *ar_extract_file_to_buffer(struct opkg_ar *ar, const char *filename,
+                                size_t *len);
 int ar_extract_paths_to_stream(struct opkg_ar *ar, FILE * stream);
+int ar_extract_paths(struct opkg_ar *ar, ar_path_fn fn, void *data);
 int ar_extract_all(struct opkg_ar *ar, const char *prefix, long unsigned int *size);
+int ar_extract_all_md5(struct opkg_ar *ar, const char *prefix,
+                       long unsigned int *size, ar_md5_fn fn, void *data);
 int gz_write_archive(const char *filename, const char *gz_filename);
 void ar_close(struct opkg_ar *ar);
 
@@ -27,12 +27,17 @@
 #include <signal.h>
 #include <unistd.h>
 #include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "opkg_conf.h"
 #include "opkg_cmd.h"
 #include "opkg_message.h"
 #include "release.h"
+#include "list_diff.h"
 #include "pkg.h"
+#include "pkg_src.h"
 #include "pkg_dest.h"
 #include "pkg_parse.h"
 #include "sprintf_alloc.h"
@@ -50,6 +55,8 @@
 static void print_pkg(pkg_t * pkg)
 {
     char *version = pkg_version_str_alloc(pkg);
+
+    pkg_hash_load_cold_fields(pkg);
     printf("%s - %s", pkg->name, version);
     if (opkg_config->size) {
 	if(pkg->state_status == SS_INSTALLED || pkg->state_status == SS_UNPACKED)
@@ -69,9 +76,11 @@ static void write_status_files_if_changed(void)
 {
     if (opkg_state_changed && !opkg_config->noaction) {
         opkg_msg(INFO, "Writing status file.\n");
-        opkg_conf_write_status_files();
-        pkg_write_changed_filelists();
-        if (!opkg_config->offline_root)
+        opkg_conf_write_db();
+        /* The batch durability mode has synced what it wrote already. */
+        if (!opkg_config->offline_root
+                && strcmp(opkg_config->durability,
+                          OPKG_CONF_DURABILITY_SYNC) == 0)
             sync();
     } else {
         opkg_msg(DEBUG, "Nothing to be done.\n");
@@ -86,6 +95,407 @@ static void sigint_handler(int sig)
     exit(128 + sig);
 }
 
+/* A list fetched by a parallel update, to be put in place. */
+struct update_list {
+    pkg_src_t *src;             /* the list of a feed, or */
+    release_list_t *list;       /* one of the lists of a dist */
+    char *cache_location;
+    int patched;                /* brought up to date from its diffs */
+    int err;
+};
+
+/* A dist updated along with the others. */
+struct update_dist {
+    pkg_src_t *src;
+    char *list_file_name;
+    release_t *release;
+    release_list_t *lists;
+    unsigned int n_lists;
+    int err;
+};
+
+static void update_list_install(struct update_list *ul)
+{
+    if (ul->patched)
+        ul->err = 0;
+    else if (!ul->cache_location)
+        ul->err = -1;
+    else if (ul->list)
+        ul->err = release_list_install(ul->list, ul->cache_location);
+    else
+        ul->err = pkg_src_install_list(ul->src, ul->cache_location);
+}
+
+#ifdef HAVE_PTHREAD
+struct update_list_queue {
+    struct update_list *lists;
+    unsigned int n_lists;
+    unsigned int next;
+    pthread_mutex_t mutex;
+};
+
+static void *update_lists_install(void *data)
+{
+    struct update_list_queue *queue = (struct update_list_queue *)data;
+    struct update_list *ul;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->mutex);
+        ul = NULL;
+        if (queue->next < queue->n_lists)
+            ul = &queue->lists[queue->next++];
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (!ul)
+            break;
+
+        update_list_install(ul);
+    }
+
+    return NULL;
+}
+#endif
+
+/*
+ * Verify and unpack the fetched lists, on as many threads as are used to
+ * parse them.
+ */
+static void opkg_update_install_lists(struct update_list *lists,
+                                      unsigned int n_lists)
+{
+    unsigned int i;
+
+#ifdef HAVE_PTHREAD
+    struct update_list_queue queue;
+    pthread_t *threads;
+    long n_threads = opkg_config->parse_threads;
+    unsigned int n = 0;
+    int err;
+
+    if (n_threads <= 0)
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > (long)n_lists)
+        n_threads = n_lists;
+
+    if (n_threads > 1) {
+        queue.lists = lists;
+        queue.n_lists = n_lists;
+        queue.next = 0;
+        pthread_mutex_init(&queue.mutex, NULL);
+
+        threads = xcalloc(n_threads - 1, sizeof(pthread_t));
+        for (i = 0; i < n_threads - 1; i++) {
+            err = pthread_create(&threads[n], NULL, update_lists_install,
+                                 &queue);
+            if (err != 0) {
+                /* The threads that did start pick up the slack. */
+                opkg_msg(DEBUG, "Can't start update thread: %s.\n",
+                         strerror(err));
+                break;
+            }
+            n++;
+        }
+
+        update_lists_install(&queue);
+
+        for (i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        free(threads);
+        pthread_mutex_destroy(&queue.mutex);
+        return;
+    }
+#endif
+
+    for (i = 0; i < n_lists; i++)
+        update_list_install(&lists[i]);
+}
+
+static char *update_list_url(struct update_list *ul)
+{
+    if (ul->list)
+        return xstrdup(ul->list->url);
+    return pkg_src_list_url(ul->src);
+}
+
+/* Patches the lists there are local copies of, leaving the others to be
+ * downloaded in full.
+ */
+static void opkg_update_patch_lists(struct update_list *lists,
+                                    unsigned int n_lists)
+{
+    char **urls, **list_file_names;
+    const char **sha256s;
+    int *results;
+    unsigned int *patch_lists;
+    unsigned int i, n = 0;
+
+    urls = xcalloc(n_lists, sizeof(*urls));
+    list_file_names = xcalloc(n_lists, sizeof(*list_file_names));
+    sha256s = xcalloc(n_lists, sizeof(*sha256s));
+    results = xcalloc(n_lists, sizeof(*results));
+    patch_lists = xcalloc(n_lists, sizeof(*patch_lists));
+
+    for (i = 0; i < n_lists; i++) {
+        release_list_t *list = lists[i].list;
+
+        if (list) {
+            char *subpath;
+
+            /* The patched list is checked against the Release file, and
+             * nothing vouches for the patches of a list it has no SHA256
+             * for. */
+            sprintf_alloc(&subpath, "%.*s",
+                          (int)(strlen(list->subpath) - (list->gzip ? 3 : 0)),
+                          list->subpath);
+            sha256s[n] = release_file_sha256(list->release, subpath);
+            free(subpath);
+            if (!sha256s[n])
+                continue;
+            list_file_names[n] = xstrdup(list->list_file_name);
+        } else {
+            sprintf_alloc(&list_file_names[n], "%s/%s",
+                          opkg_config->lists_dir, lists[i].src->name);
+        }
+        urls[n] = update_list_url(&lists[i]);
+        patch_lists[n++] = i;
+    }
+    if (n)
+        list_diff_update_multi((const char **)urls,
+                               (const char **)list_file_names,
+                               sha256s, results, n);
+
+    for (i = 0; i < n; i++) {
+        lists[patch_lists[i]].patched = results[i] == 0;
+        free(urls[i]);
+        free(list_file_names[i]);
+    }
+    free(patch_lists);
+    free(urls);
+    free(list_file_names);
+    free(sha256s);
+    free(results);
+}
+
+/*
+ * Update all the dists and feeds together: fetch the Release files and the
+ * lists of the feeds at once, then those of the dists, and put them in place
+ * on worker threads. Each source is then finished in turn, counting failures
+ * as the one by one update does.
+ *
+ * With index_diffs, the lists of the feeds are rather patched along with
+ * those of the dists once the Release files are in, and only those that
+ * can't be are downloaded with the lists of the dists.
+ */
+static int opkg_update_parallel(void)
+{
+    struct update_dist *dists = NULL;
+    struct update_dist *dist;
+    struct update_list *lists;
+    pkg_src_t **srcs = NULL;
+    pkg_src_list_elt_t *iter;
+    char **urls, **cache_locations;
+    unsigned int *url_lists;
+    int *sig_index;
+    unsigned int n_dists = 0, n_srcs = 0, n_lists, n_urls = 0;
+    unsigned int i, j, k;
+    int failures = 0;
+    int err;
+
+    for (iter = void_list_first(&opkg_config->dist_src_list); iter;
+            iter = void_list_next(&opkg_config->dist_src_list, iter)) {
+        dists = xrealloc(dists, (n_dists + 1) * sizeof(*dists));
+        memset(&dists[n_dists], 0, sizeof(*dists));
+        dists[n_dists++].src = (pkg_src_t *) iter->data;
+    }
+    for (iter = void_list_first(&opkg_config->pkg_src_list); iter;
+            iter = void_list_next(&opkg_config->pkg_src_list, iter)) {
+        srcs = xrealloc(srcs, (n_srcs + 1) * sizeof(*srcs));
+        srcs[n_srcs++] = (pkg_src_t *) iter->data;
+    }
+
+    /* First the Release files, the lists of the feeds and their
+     * signatures.
+     */
+    urls = xcalloc(n_dists + 2 * n_srcs, sizeof(*urls));
+    cache_locations = xcalloc(n_dists + 2 * n_srcs, sizeof(*cache_locations));
+    sig_index = xcalloc(n_srcs, sizeof(*sig_index));
+    for (i = 0; i < n_dists; i++)
+        sprintf_alloc(&urls[n_urls++], "%s/dists/%s/Release",
+                      dists[i].src->value, dists[i].src->name);
+    for (i = 0; i < n_srcs && !opkg_config->index_diffs; i++)
+        urls[n_urls++] = pkg_src_list_url(srcs[i]);
+    for (i = 0; i < n_srcs; i++) {
+        sig_index[i] = -1;
+        urls[n_urls] = pkg_src_signature_url(srcs[i]);
+        if (urls[n_urls])
+            sig_index[i] = n_urls++;
+    }
+    opkg_download_cache_multi((const char **)urls, cache_locations, n_urls);
+
+    n_lists = n_srcs;
+    for (i = 0; i < n_dists; i++) {
+        dist = &dists[i];
+        sprintf_alloc(&dist->list_file_name, "%s/%s", opkg_config->lists_dir,
+                      dist->src->name);
+
+        if (!cache_locations[i]) {
+            dist->err = -1;
+            continue;
+        }
+        dist->err = file_copy(cache_locations[i], dist->list_file_name);
+        if (dist->err)
+            continue;
+
+        opkg_msg(NOTICE, "Downloaded release files for dist %s.\n",
+                 dist->src->name);
+        dist->release = release_new();
+        err = release_init_from_file(dist->release, dist->list_file_name);
+        if (!err && !release_comps_supported(dist->release,
+                                             dist->src->extra_data))
+            err = -1;
+        if (err) {
+            unlink(dist->list_file_name);
+            dist->err = err;
+            continue;
+        }
+
+        dist->lists = release_lists(dist->release, dist->src,
+                                    opkg_config->lists_dir, &dist->n_lists);
+        n_lists += dist->n_lists;
+    }
+
+    lists = xcalloc(n_lists, sizeof(*lists));
+    for (i = 0; i < n_srcs; i++) {
+        lists[i].src = srcs[i];
+        if (opkg_config->index_diffs)
+            continue;
+        lists[i].cache_location = cache_locations[n_dists + i];
+        cache_locations[n_dists + i] = NULL;
+    }
+    for (i = 0, k = n_srcs; i < n_dists; i++) {
+        for (j = 0; j < dists[i].n_lists; j++, k++)
+            lists[k].list = &dists[i].lists[j];
+    }
+
+    if (opkg_config->index_diffs)
+        opkg_update_patch_lists(lists, n_lists);
+
+    /* Then the lists of the dists, and of the feeds not fetched yet. */
+    for (i = 0; i < n_urls; i++)
+        free(urls[i]);
+    free(urls);
+    urls = xcalloc(n_lists, sizeof(*urls));
+    url_lists = xcalloc(n_lists, sizeof(*url_lists));
+    n_urls = 0;
+    for (k = 0; k < n_lists; k++) {
+        if (lists[k].patched || (k < n_srcs && !opkg_config->index_diffs))
+            continue;
+        url_lists[n_urls] = k;
+        urls[n_urls++] = update_list_url(&lists[k]);
+    }
+    if (n_urls) {
+        char **list_locations = xcalloc(n_urls, sizeof(*list_locations));
+
+        opkg_download_cache_multi((const char **)urls, list_locations, n_urls);
+        for (i = 0; i < n_urls; i++)
+            lists[url_lists[i]].cache_location = list_locations[i];
+        free(list_locations);
+    }
+    for (i = 0; i < n_urls; i++)
+        free(urls[i]);
+
+    /* The lists of the dists go in first: the feeds may include them as
+     * well, once they have been loaded, and must overwrite them as updating
+     * one source after the other does.
+     */
+    opkg_update_install_lists(&lists[n_srcs], n_lists - n_srcs);
+
+    /* Fall back on the uncompressed lists of the dists where the gzipped
+     * ones failed, as release_download() does.
+     */
+    n_urls = 0;
+    for (k = n_srcs; k < n_lists; k++) {
+        if (lists[k].err && release_list_ungzip(lists[k].list) == 0) {
+            url_lists[n_urls] = k;
+            urls[n_urls++] = lists[k].list->url;
+        }
+    }
+    if (n_urls) {
+        char **list_locations = xcalloc(n_urls, sizeof(*list_locations));
+
+        opkg_download_cache_multi((const char **)urls, list_locations, n_urls);
+        for (i = 0; i < n_urls; i++) {
+            k = url_lists[i];
+            free(lists[k].cache_location);
+            lists[k].cache_location = list_locations[i];
+            update_list_install(&lists[k]);
+        }
+        free(list_locations);
+    }
+    free(urls);
+    free(url_lists);
+
+    opkg_update_install_lists(lists, n_srcs);
+
+    for (i = 0, k = n_srcs; i < n_dists; i++) {
+        dist = &dists[i];
+        for (j = 0; j < dist->n_lists; j++, k++) {
+            char *list_file_name;
+
+            if (lists[k].err) {
+                dist->err = 1;
+                continue;
+            }
+            if (!opkg_config->feed_index)
+                continue;
+
+            sprintf_alloc(&list_file_name, "%s%s",
+                          dist->lists[j].list_file_name,
+                          opkg_config->compress_list_files ? ".gz" : "");
+            pkg_hash_index_file(list_file_name, 0);
+            free(list_file_name);
+        }
+
+        if (dist->err) {
+            if (dist->release)
+                unlink(dist->list_file_name);
+            failures++;
+        }
+    }
+
+    for (i = 0; i < n_srcs; i++) {
+        if (lists[i].err) {
+            failures++;
+            continue;
+        }
+
+        err = pkg_src_finish_update(srcs[i], sig_index[i] < 0 ? NULL
+                                    : cache_locations[sig_index[i]]);
+        if (err)
+            failures++;
+    }
+
+    for (i = 0; i < n_lists; i++)
+        free(lists[i].cache_location);
+    free(lists);
+    for (i = 0; i < n_dists + 2 * n_srcs; i++)
+        free(cache_locations[i]);
+    free(cache_locations);
+    free(sig_index);
+    for (i = 0; i < n_dists; i++) {
+        release_lists_free(dists[i].lists, dists[i].n_lists);
+        if (dists[i].release) {
+            release_deinit(dists[i].release);
+            free(dists[i].release);
+        }
+        free(dists[i].list_file_name);
+    }
+    free(dists);
+    free(srcs);
+
+    return failures;
+}
+
 static int opkg_update_cmd(int argc, char **argv)
 {
     char *tmp, *dtemp;
@@ -105,6 +515,9 @@ static int opkg_update_cmd(int argc, char **argv)
             return -1;
     }
 
+    if (opkg_config->parallel_downloads > 1)
+        return opkg_update_parallel();
+
     failures = 0;
 
     sprintf_alloc(&tmp, "%s/update-XXXXXX", opkg_config->tmp_dir);
@@ -481,11 +894,14 @@ static int opkg_distupgrade_cmd(int argc, char **argv)
 static int opkg_download_cmd(int argc, char **argv)
 {
     int i, err = 0;
+    unsigned int j;
     char *arg;
     pkg_t *pkg;
+    pkg_vec_t *pkgs;
     int r;
 
     pkg_info_preinstall_check();
+    pkgs = pkg_vec_alloc();
     for (i = 0; i < argc; i++) {
         arg = argv[i];
 
@@ -501,6 +917,17 @@ static int opkg_download_cmd(int argc, char **argv)
             continue;
         }
 
+        pkg_vec_insert(pkgs, pkg);
+    }
+
+    /* Fill the cache in one go, the copies below are then cache hits. */
+    if (pkgs->len > 1 && opkg_config->parallel_downloads > 1
+            && !opkg_config->volatile_cache)
+        opkg_download_pkgs(pkgs, NULL, NULL);
+
+    for (j = 0; j < pkgs->len; j++) {
+        pkg = pkgs->pkgs[j];
+
         r = opkg_download_pkg_to_dir(pkg, ".");
         if (r != 0) {
             err = -1;
@@ -511,6 +938,7 @@ static int opkg_download_cmd(int argc, char **argv)
         }
     }
 
+    pkg_vec_free(pkgs);
     return err;
 }
 
@@ -530,9 +958,13 @@ static int opkg_list_find_cmd(int argc, char **argv, int use_desc)
     for (i = 0; i < available->len; i++) {
         pkg = available->pkgs[i];
         /* if we have package name or pattern and pkg does not match, then skip it */
-        if (pkg_name && fnmatch(pkg_name, pkg->name, 0) &&
-           (!use_desc || !pkg->description || fnmatch(pkg_name, pkg->description, 0)))
-            continue;
+        if (pkg_name && fnmatch(pkg_name, pkg->name, 0)) {
+            if (!use_desc)
+                continue;
+            pkg_hash_load_cold_fields(pkg);
+            if (!pkg->description || fnmatch(pkg_name, pkg->description, 0))
+                continue;
+        }
         print_pkg(pkg);
     }
     pkg_vec_free(available);
@@ -32,6 +32,9 @@
 #include "opkg_conf.h"
 #include "pkg_vec.h"
 #include "pkg.h"
+#include "pkg_hash.h"
+#include "file_commit.h"
+#include "file_index.h"
 #include "xregex.h"
 #include "sprintf_alloc.h"
 #include "opkg_message.h"
@@ -88,8 +91,15 @@ static opkg_option_t options[] = {
     {"overwrite_no_owner", OPKG_OPT_TYPE_BOOL, &_conf.overwrite_no_owner},
     {"combine", OPKG_OPT_TYPE_BOOL, &_conf.combine},
     {"cache_local_files", OPKG_OPT_TYPE_BOOL, &_conf.cache_local_files},
+    {"cache_by_checksum", OPKG_OPT_TYPE_BOOL, &_conf.cache_by_checksum},
     {"verbose_status_file", OPKG_OPT_TYPE_BOOL, &_conf.verbose_status_file},
     {"compress_list_files", OPKG_OPT_TYPE_BOOL, &_conf.compress_list_files},
+    {"durability", OPKG_OPT_TYPE_STRING, &_conf.durability},
+    {"extract_threads", OPKG_OPT_TYPE_INT, &_conf.extract_threads},
+    {"feed_index", OPKG_OPT_TYPE_BOOL, &_conf.feed_index},
+    {"file_index", OPKG_OPT_TYPE_BOOL, &_conf.file_index},
+    {"parse_threads", OPKG_OPT_TYPE_INT, &_conf.parse_threads},
+    {"status_snapshot", OPKG_OPT_TYPE_BOOL, &_conf.status_snapshot},
 #if defined(HAVE_GPGME)
     {"gpg_dir", OPKG_OPT_TYPE_STRING, &_conf.gpg_dir},
     {"gpg_trust_level", OPKG_OPT_TYPE_STRING, &_conf.gpg_trust_level},
@@ -101,11 +111,15 @@ static opkg_option_t options[] = {
 #if defined(HAVE_PATHFINDER)
     {"check_x509_path", OPKG_OPT_TYPE_BOOL, &_conf.check_x509_path},
 #endif
+#if defined(HAVE_SHA256)
+    {"index_diffs", OPKG_OPT_TYPE_BOOL, &_conf.index_diffs},
+#endif
 #if defined(HAVE_CURL)
     {"connect_timeout_ms", OPKG_OPT_TYPE_INT, &_conf.connect_timeout_ms},
     {"transfer_timeout_ms", OPKG_OPT_TYPE_INT, &_conf.transfer_timeout_ms},
     {"follow_location", OPKG_OPT_TYPE_BOOL, &_conf.follow_location},
     {"http_auth", OPKG_OPT_TYPE_STRING, &_conf.http_auth},
+    {"parallel_downloads", OPKG_OPT_TYPE_INT, &_conf.parallel_downloads},
 #endif
 #if defined(HAVE_SSLCURL) && defined(HAVE_CURL)
     {"ssl_engine", OPKG_OPT_TYPE_STRING, &_conf.ssl_engine},
@@ -523,7 +537,7 @@ int opkg_conf_write_status_files(void)
     list_for_each_entry(iter, &opkg_config->pkg_dest_list.head, node) {
         dest = (pkg_dest_t *) iter->data;
 
-        dest->status_fp = fopen(dest->status_file_name, "w");
+        dest->status_fp = file_commit_open(dest->status_file_name);
         if (dest->status_fp == NULL && errno != EROFS) {
             opkg_perror(ERROR, "Can't open status file %s",
                         dest->status_file_name);
@@ -559,7 +573,8 @@ int opkg_conf_write_status_files(void)
     list_for_each_entry(iter, &opkg_config->pkg_dest_list.head, node) {
         dest = (pkg_dest_t *) iter->data;
         if (dest->status_fp) {
-            r = fclose(dest->status_fp);
+            r = file_commit_close(dest->status_fp);
+            dest->status_fp = NULL;
             if (r == EOF) {
                 opkg_perror(ERROR, "Couldn't close %s", dest->status_file_name);
                 ret = -1;
@@ -570,6 +585,41 @@ int opkg_conf_write_status_files(void)
     return ret;
 }
 
+/* Writes the status files and the changed file lists out as one transaction,
+ * then the indexes built from them, which record the files they were built
+ * from as they are once in place. */
+int opkg_conf_write_db(void)
+{
+    pkg_dest_list_elt_t *iter;
+    pkg_dest_t *dest;
+    int ret = 0;
+
+    if (opkg_config->noaction)
+        return 0;
+
+    if (opkg_conf_write_status_files() != 0)
+        ret = -1;
+    if (pkg_write_changed_filelists() != 0)
+        ret = -1;
+    if (file_commit() != 0)
+        ret = -1;
+
+    if (ret == 0 && opkg_config->status_snapshot) {
+        /* The text status file stays authoritative; a snapshot that can't
+         * be written is just rebuilt on the next load. */
+        list_for_each_entry(iter, &opkg_config->pkg_dest_list.head, node) {
+            dest = (pkg_dest_t *) iter->data;
+            if (file_exists(dest->status_file_name))
+                pkg_hash_index_file(dest->status_file_name, 1);
+        }
+    }
+
+    if (file_index_write() != 0)
+        ret = -1;
+
+    return ret;
+}
+
 char *root_filename_alloc(char *filename)
 {
     char *root_filename;
@@ -682,6 +732,7 @@ int opkg_conf_load(void)
     char *tmp, *tmp_dir_base, **tmp_val;
     glob_t globbuf;
     char *etc_opkg_conf_pattern;
+    nv_pair_list_elt_t *l;
 
     opkg_config->restrict_to_default_dest = 0;
     opkg_config->default_dest = NULL;
@@ -778,10 +829,7 @@ int opkg_conf_load(void)
     }
 
     pkg_hash_init();
-    hash_table_init("file-hash", &opkg_config->file_hash,
-                    OPKG_CONF_DEFAULT_HASH_LEN);
-    hash_table_init("obs-file-hash", &opkg_config->obs_file_hash,
-                    OPKG_CONF_DEFAULT_HASH_LEN / 16);
+    file_tree_init("file-tree", &opkg_config->file_tree);
 
     if (opkg_config->intercepts_dir == NULL)
         opkg_config->intercepts_dir = xstrdup(DATADIR "/opkg/intercept");
@@ -820,6 +868,15 @@ int opkg_conf_load(void)
     if (opkg_config->signature_type == NULL)
         opkg_config->signature_type = xstrdup(OPKG_CONF_DEFAULT_SIGNATURE_TYPE);
 
+    if (opkg_config->durability == NULL) {
+        opkg_config->durability = xstrdup(OPKG_CONF_DEFAULT_DURABILITY);
+    } else if (strcmp(opkg_config->durability, OPKG_CONF_DURABILITY_SYNC) != 0
+            && strcmp(opkg_config->durability, OPKG_CONF_DURABILITY_BATCH) != 0) {
+        opkg_msg(ERROR, "Unrecognized durability %s.\n",
+                 opkg_config->durability);
+        goto err3;
+    }
+
 #if defined(HAVE_GPGME)
     if (opkg_config->gpg_dir == NULL){
         opkg_config->gpg_dir = xstrdup(OPKG_CONF_GPG_DEFAULT_DIR);
@@ -856,6 +913,15 @@ int opkg_conf_load(void)
         nv_pair_list_append(&opkg_config->arch_list, HOST_CPU_STR, "10");
     }
 
+    /* Architectures are looked up for every package read, keep the first
+     * entry for each name as the list walk used to. */
+    hash_table_init("arch-hash", &opkg_config->arch_hash, 16);
+    list_for_each_entry(l, &opkg_config->arch_list.head, node) {
+        nv_pair_t *nv = (nv_pair_t *) l->data;
+        if (!hash_table_get(&opkg_config->arch_hash, nv->name))
+            hash_table_insert(&opkg_config->arch_hash, nv->name, nv);
+    }
+
     /* Even if there is no conf file, we'll need at least one dest. */
     if (nv_pair_list_empty(&opkg_config->tmp_dest_list)) {
         nv_pair_list_append(&opkg_config->tmp_dest_list,
@@ -879,8 +945,8 @@ int opkg_conf_load(void)
 
  err4:
     pkg_hash_deinit();
-    hash_table_deinit(&opkg_config->file_hash);
-    hash_table_deinit(&opkg_config->obs_file_hash);
+    file_tree_deinit(&opkg_config->file_tree);
+    hash_table_deinit(&opkg_config->arch_hash);
 
     r = rmdir(opkg_config->tmp_dir);
     if (r == -1)
@@ -928,18 +994,20 @@ void opkg_conf_deinit(void)
     pkg_src_list_deinit(&opkg_config->dist_src_list);
     pkg_dest_list_deinit(&opkg_config->pkg_dest_list);
     nv_pair_list_deinit(&opkg_config->arch_list);
+    hash_table_deinit(&opkg_config->arch_hash);
     str_list_deinit(&opkg_config->exclude_list);
     str_list_deinit(&opkg_config->ignore_recommends_list);
 
     if (opkg_config->verbosity >= DEBUG) {
         hash_print_stats(&opkg_config->pkg_hash);
-        hash_print_stats(&opkg_config->file_hash);
-        hash_print_stats(&opkg_config->obs_file_hash);
+        file_tree_print_stats(&opkg_config->file_tree);
+        arena_print_stats(&opkg_config->pkg_arena);
     }
 
     pkg_hash_deinit();
-    hash_table_deinit(&opkg_config->file_hash);
-    hash_table_deinit(&opkg_config->obs_file_hash);
+    file_index_deinit();
+    file_commit_deinit();
+    file_tree_deinit(&opkg_config->file_tree);
 
     for (i = 0; options[i].name; i++) {
         if (options[i].type == OPKG_OPT_TYPE_STRING) {
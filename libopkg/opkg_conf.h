@@ -27,7 +27,9 @@
 extern "C" {
 #endif
 
+#include "arena.h"
 #include "hash_table.h"
+#include "file_tree.h"
 #include "pkg_src_list.h"
 #include "pkg_dest_list.h"
 #include "nv_pair_list.h"
@@ -51,6 +53,9 @@ extern "C" {
 #define OPKG_CONF_DEFAULT_HASH_LEN 1024
 
 #define OPKG_CONF_DEFAULT_SIGNATURE_TYPE "gpg"
+#define OPKG_CONF_DURABILITY_SYNC "sync"
+#define OPKG_CONF_DURABILITY_BATCH "batch"
+#define OPKG_CONF_DEFAULT_DURABILITY OPKG_CONF_DURABILITY_SYNC
 #define OPKG_CONF_GPG_DEFAULT_DIR OPKG_CONF_DEFAULT_CONF_FILE_DIR "/gpg"
 #define OPKG_CONF_GPG_TRUST_ONLY "TrustOnly"
 #define OPKG_CONF_GPG_TRUST_ANY "TrustAny"
@@ -62,6 +67,7 @@ typedef struct opkg_conf {
     pkg_dest_list_t pkg_dest_list;
     pkg_dest_list_t tmp_dest_list;
     nv_pair_list_t arch_list;
+    hash_table_t arch_hash;     /* arch_list entries by name */
     str_list_t exclude_list;
     str_list_t ignore_recommends_list;
 
@@ -120,9 +126,17 @@ typedef struct opkg_conf {
     int volatile_cache;
     int combine;
     int cache_local_files;
+    int cache_by_checksum;
     int host_cache_dir;
     int verbose_status_file;
     int compress_list_files;
+    char *durability;
+    int extract_threads;
+    int feed_index;
+    int file_index;
+    int index_diffs;
+    int parse_threads;
+    int status_snapshot;
     int short_description;
 
     /* ssl options: used only when opkg is configured with '--enable-curl',
@@ -131,6 +145,7 @@ typedef struct opkg_conf {
     int connect_timeout_ms;
     int transfer_timeout_ms;
     int follow_location;
+    int parallel_downloads;
 
     /* ssl-curl options: used only when opkg is configured with
      * '--enable-ssl-curl', otherwise always NULL or 0.
@@ -172,8 +187,9 @@ typedef struct opkg_conf {
     char *signature_ca_path;
 
     hash_table_t pkg_hash;
-    hash_table_t file_hash;
-    hash_table_t obs_file_hash;
+    file_tree_t file_tree;
+    hash_table_t pkg_str_pool;
+    arena_t pkg_arena;
 } opkg_conf_t;
 
 enum opkg_option_type {
@@ -197,6 +213,7 @@ int opkg_conf_load(void);
 void opkg_conf_deinit(void);
 
 int opkg_conf_write_status_files(void);
+int opkg_conf_write_db(void);
 char *root_filename_alloc(char *filename);
 
 int opkg_conf_get_option(char *option, void *value);
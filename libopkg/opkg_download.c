@@ -21,10 +21,12 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
 #include "opkg_download.h"
 #include "opkg_message.h"
@@ -113,11 +115,13 @@ static int opkg_download_file(const char *src, const char *dest)
  * \param cb callback for curl download progress
  * \param data data to pass to progress callback
  * \param use_cache 1 if file is downloaded into cache or 0 otherwise
+ * \param checksums FILE_CHECKSUM_* kinds to take of the file as it downloads
  * \return 0 if success, -1 if error occurs
  *
  */
 static int opkg_download_internal(const char *src, const char *dest,
-                           curl_progress_func cb, void *data, int use_cache)
+                           curl_progress_func cb, void *data, int use_cache,
+                           int checksums)
 {
     int ret;
 
@@ -142,7 +146,7 @@ static int opkg_download_internal(const char *src, const char *dest,
         return ret;
     }
 
-    return opkg_download_backend(src, dest, cb, data, use_cache);
+    return opkg_download_backend(src, dest, cb, data, use_cache, checksums);
 }
 
 /** \brief get_cache_location: generate cached file path
@@ -190,7 +194,7 @@ static char *get_cache_location(const char *src)
 static int opkg_download_direct(const char *src, const char *dest,
                          curl_progress_func cb, void *data)
 {
-    return opkg_download_internal(src, dest, cb, data, 0);
+    return opkg_download_internal(src, dest, cb, data, 0, 0);
 }
 
 
@@ -208,7 +212,7 @@ char *opkg_download_cache(const char *src, curl_progress_func cb, void *data)
     int err;
 
     cache_location = get_cache_location(src);
-    err = opkg_download_internal(src, cache_location, cb, data, 1);
+    err = opkg_download_internal(src, cache_location, cb, data, 1, 0);
     if (err) {
         free(cache_location);
         cache_location = NULL;
@@ -216,6 +220,81 @@ char *opkg_download_cache(const char *src, curl_progress_func cb, void *data)
     return cache_location;
 }
 
+/* Runs the downloads of remote files into the cache through the backend. */
+static void opkg_download_jobs(struct opkg_download_job *jobs,
+                               unsigned int count, curl_progress_func cb,
+                               void *data)
+{
+    unsigned int i;
+    int r;
+
+    if (!count)
+        return;
+
+    r = file_mkdir_hier(opkg_config->cache_dir, 0755);
+    if (r != 0)
+        opkg_perror(ERROR, "Creating cache dir %s failed",
+                opkg_config->cache_dir);
+
+    for (i = 0; i < count; i++)
+        opkg_msg(NOTICE, "Downloading %s.\n", jobs[i].src);
+
+    /* Error message already printed. */
+    if (opkg_download_set_env() != 0)
+        return;
+
+    opkg_download_backend_multi(jobs, count, cb, data);
+}
+
+void opkg_download_cache_multi(const char **srcs, char **cache_locations,
+                               unsigned int count)
+{
+    struct opkg_download_job *jobs;
+    unsigned int i, n = 0;
+    int err;
+
+    if (opkg_config->parallel_downloads < 2) {
+        for (i = 0; i < count; i++)
+            cache_locations[i] = opkg_download_cache(srcs[i], NULL, NULL);
+        return;
+    }
+
+    jobs = xcalloc(count, sizeof(*jobs));
+
+    for (i = 0; i < count; i++) {
+        cache_locations[i] = get_cache_location(srcs[i]);
+
+        if (str_starts_with(srcs[i], "file:")) {
+            err = opkg_download_internal(srcs[i], cache_locations[i], NULL,
+                                         NULL, 1, 0);
+            if (err) {
+                free(cache_locations[i]);
+                cache_locations[i] = NULL;
+            }
+            continue;
+        }
+
+        jobs[n].src = srcs[i];
+        jobs[n].dest = cache_locations[i];
+        jobs[n].use_cache = 1;
+        jobs[n].result = -1;
+        n++;
+    }
+
+    opkg_download_jobs(jobs, n, NULL, NULL);
+
+    for (i = 0, n = 0; i < count; i++) {
+        if (str_starts_with(srcs[i], "file:"))
+            continue;
+        if (jobs[n++].result != 0) {
+            free(cache_locations[i]);
+            cache_locations[i] = NULL;
+        }
+    }
+
+    free(jobs);
+}
+
 int opkg_download(const char *src, const char *dest_file_name,
                   curl_progress_func cb, void *data)
 {
@@ -280,6 +359,121 @@ char *pkg_download_signature(pkg_t * pkg)
     return sig_file;
 }
 
+/* The checksum pkg_verify() will want, to be taken as the package downloads. */
+static int pkg_download_checksums(pkg_t * pkg)
+{
+#ifdef HAVE_SHA256
+    if (pkg->sha256sum)
+        return FILE_CHECKSUM_SHA256;
+#endif
+    if (pkg->md5sum)
+        return FILE_CHECKSUM_MD5;
+    return 0;
+}
+
+/* With cache_by_checksum, where pkg is kept in the cache whatever URL it was
+ * fetched from: under the checksum the feed gives it. NULL otherwise, and
+ * when the checksum isn't one, as it then can't be trusted as a file name.
+ */
+static char *get_pkg_checksum_location(pkg_t * pkg)
+{
+    const char *checksum = NULL;
+    size_t len = 0;
+    char *location;
+
+    if (!opkg_config->cache_by_checksum)
+        return NULL;
+
+#ifdef HAVE_SHA256
+    checksum = pkg->sha256sum;
+    len = 64;
+#endif
+    if (!checksum) {
+        checksum = pkg->md5sum;
+        len = 32;
+    }
+    if (!checksum)
+        return NULL;
+    if (strlen(checksum) != len
+            || strspn(checksum, "0123456789abcdefABCDEF") != len) {
+        opkg_msg(DEBUG, "Not caching %s under malformed checksum %s.\n",
+                 pkg->name, checksum);
+        return NULL;
+    }
+
+    sprintf_alloc(&location, "%s/%s", opkg_config->cache_dir, checksum);
+    return location;
+}
+
+/* Gives the file at from the name to as well, replacing any file there along
+ * with what was recorded about it. Local packages which were only symlinked
+ * into the cache are left alone.
+ */
+static void pkg_cache_link(const char *from, const char *to)
+{
+    struct stat st;
+    char *stamp;
+
+    if (lstat(from, &st) != 0 || S_ISLNK(st.st_mode))
+        return;
+    if (unlink(to) != 0 && errno != ENOENT) {
+        opkg_perror(DEBUG, "Failed to remove %s", to);
+        return;
+    }
+    /* The stamp of a download to the name is no good for from. */
+    sprintf_alloc(&stamp, "%s.@stamp", to);
+    if (unlink(stamp) != 0 && errno != ENOENT)
+        opkg_perror(DEBUG, "Failed to remove %s", stamp);
+    free(stamp);
+    opkg_checksum_forget(to);
+    if (link(from, to) != 0)
+        opkg_perror(DEBUG, "Failed to link %s to %s", to, from);
+}
+
+/* Keeps the package just downloaded to the cache under its checksum too. */
+static void pkg_cache_add(pkg_t * pkg)
+{
+    char *checksum_location = get_pkg_checksum_location(pkg);
+
+    if (checksum_location) {
+        pkg_cache_link(pkg->local_filename, checksum_location);
+        free(checksum_location);
+    }
+}
+
+/* Points pkg at a valid copy of it in the cache or, failing that, at where
+ * it is to be downloaded from url. A copy cached under its checksum is
+ * preferred, and the location of url then made to refer to it as well.
+ * Returns what pkg_verify() does for the copy found: 0 if it is valid, 1 if
+ * there is none.
+ */
+static int pkg_cache_lookup(pkg_t * pkg, const char *url)
+{
+    char *checksum_location = get_pkg_checksum_location(pkg);
+    int r;
+
+    free(pkg->local_filename);
+
+    if (checksum_location) {
+        pkg->local_filename = checksum_location;
+        r = pkg_verify(pkg);
+        if (r == 0) {
+            char *url_location = get_cache_location(url);
+
+            pkg_cache_link(checksum_location, url_location);
+            free(url_location);
+            return 0;
+        }
+        free(checksum_location);
+    }
+
+    pkg->local_filename = get_cache_location(url);
+    r = pkg_verify(pkg);
+    if (r == 0)
+        pkg_cache_add(pkg);
+    return r;
+}
+
 /** \brief opkg_download_pkg: download and verify a package
  *
  * \param pkg the package to download
@@ -295,14 +489,13 @@ int opkg_download_pkg(pkg_t * pkg)
     if (!url)
         return -1;
 
-    pkg->local_filename = get_cache_location(url);
-
     /* Check if valid package exists in cache */
-    err = pkg_verify(pkg);
+    err = pkg_cache_lookup(pkg, url);
     if (err != 1)
         goto cleanup;
 
-    err = opkg_download_internal(url, pkg->local_filename, NULL, NULL, 1);
+    err = opkg_download_internal(url, pkg->local_filename, NULL, NULL, 1,
+                                 pkg_download_checksums(pkg));
     if (err) {
 	free(pkg->local_filename);
 	pkg->local_filename = NULL;
@@ -311,12 +504,117 @@ int opkg_download_pkg(pkg_t * pkg)
 
     /* Ensure downloaded package is valid. */
     err = pkg_verify(pkg);
+    if (!err)
+        pkg_cache_add(pkg);
 
  cleanup:
     free(url);
     return err;
 }
 
+static int opkg_download_pkgs_one_by_one(pkg_vec_t * pkgs)
+{
+    unsigned int i;
+    pkg_t *pkg;
+    int err = 0;
+
+    for (i = 0; i < pkgs->len; i++) {
+        pkg = pkgs->pkgs[i];
+        if (pkg->local_filename)
+            continue;
+
+        if (opkg_download_pkg(pkg) != 0) {
+            free(pkg->local_filename);
+            pkg->local_filename = NULL;
+            err = -1;
+        }
+    }
+
+    return err;
+}
+
+int opkg_download_pkgs(pkg_vec_t * pkgs, curl_progress_func cb, void *data)
+{
+    struct opkg_download_job *jobs;
+    pkg_t **job_pkgs;
+    pkg_t *pkg;
+    char *url;
+    unsigned int i, count = 0;
+    int err = 0;
+    int r;
+
+    if (opkg_config->parallel_downloads < 2)
+        return opkg_download_pkgs_one_by_one(pkgs);
+
+    jobs = xcalloc(pkgs->len, sizeof(*jobs));
+    job_pkgs = xcalloc(pkgs->len, sizeof(*job_pkgs));
+
+    for (i = 0; i < pkgs->len; i++) {
+        pkg = pkgs->pkgs[i];
+        if (pkg->local_filename)
+            continue;
+
+        url = get_pkg_url(pkg);
+        if (!url) {
+            err = -1;
+            continue;
+        }
+
+        /* Local feeds have nothing to gain from parallel downloads. */
+        if (str_starts_with(url, "file:")) {
+            free(url);
+            if (opkg_download_pkg(pkg) != 0) {
+                free(pkg->local_filename);
+                pkg->local_filename = NULL;
+                err = -1;
+            }
+            continue;
+        }
+
+        r = pkg_cache_lookup(pkg, url);
+        if (r != 1) {
+            /* Either a valid package is in the cache or a corrupt one was
+             * just removed from it.
+             */
+            if (r != 0) {
+                free(pkg->local_filename);
+                pkg->local_filename = NULL;
+                err = -1;
+            }
+            free(url);
+            continue;
+        }
+
+        jobs[count].src = url;
+        jobs[count].dest = pkg->local_filename;
+        jobs[count].checksums = pkg_download_checksums(pkg);
+        jobs[count].result = -1;
+        job_pkgs[count] = pkg;
+        count++;
+    }
+
+    opkg_download_jobs(jobs, count, cb, data);
+
+    for (i = 0; i < count; i++) {
+        pkg = job_pkgs[i];
+        r = jobs[i].result;
+        if (r == 0)
+            r = pkg_verify(pkg);
+        if (r == 0)
+            pkg_cache_add(pkg);
+        if (r != 0) {
+            free(pkg->local_filename);
+            pkg->local_filename = NULL;
+            err = -1;
+        }
+        free((char *)jobs[i].src);
+    }
+
+    free(jobs);
+    free(job_pkgs);
+    return err;
+}
+
 int opkg_download_pkg_to_dir(pkg_t * pkg, const char *dir)
 {
     char *dest_file_name;
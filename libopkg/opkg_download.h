@@ -34,7 +34,19 @@ typedef int (*curl_progress_func) (void *data, double t, double d,
 int opkg_download(const char *src, const char *dest_file_name,
                   curl_progress_func cb, void *data);
 char *opkg_download_cache(const char *src, curl_progress_func cb, void *data);
+/* Downloads each of srcs into the cache like opkg_download_cache(), several
+ * at a time if parallel_downloads allows. cache_locations[i] is set to the
+ * cached copy of srcs[i], or NULL if it could not be downloaded.
+ */
+void opkg_download_cache_multi(const char **srcs, char **cache_locations,
+                               unsigned int count);
 int opkg_download_pkg(pkg_t * pkg);
+/* Downloads and verifies those of pkgs not in the cache yet, several at a time
+ * if parallel_downloads allows, reporting their overall progress through cb.
+ * Returns 0 if all of them could be fetched, -1 otherwise; the local_filename
+ * of those that could not is left NULL.
+ */
+int opkg_download_pkgs(pkg_vec_t * pkgs, curl_progress_func cb, void *data);
 int opkg_download_pkg_to_dir(pkg_t * pkg, const char *dir);
 char *pkg_download_signature(pkg_t * pkg);
 
@@ -54,9 +66,34 @@ void opkg_download_cleanup(void);
 /* Backend download function, defined in opkg_download_curl.c or
  * opkg_download_wget.c depending on which backend is enabled. This should only
  * be called from opkg_download.c.
+ *
+ * checksums is a mask of the FILE_CHECKSUM_* kinds to take of the file as it
+ * is downloaded into the cache, which a backend may ignore.
  */
 int opkg_download_backend(const char *src, const char *dest,
-                          curl_progress_func cb, void *data, int use_cache);
+                          curl_progress_func cb, void *data, int use_cache,
+                          int checksums);
+
+/* A file fetched by opkg_download_backend_multi(). */
+struct opkg_download_job {
+    const char *src;
+    const char *dest;
+    int checksums;
+    /* Set if dest is the cached copy of src, to be checked against the
+     * server and kept or resumed as opkg_download_backend() would.
+     * Otherwise dest must not exist yet.
+     */
+    int use_cache;
+    /* Set to 0 if the file was downloaded or -1 otherwise. */
+    int result;
+};
+
+/* Downloads each job's src as dest, at most parallel_downloads at a time
+ * from each server. The backend may also fetch them one after the other.
+ */
+void opkg_download_backend_multi(struct opkg_download_job *jobs,
+                                 unsigned int count, curl_progress_func cb,
+                                 void *data);
 
 #ifdef __cplusplus
 }
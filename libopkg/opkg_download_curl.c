@@ -25,11 +25,14 @@
 #include <ctype.h>
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "opkg_download.h"
 #include "opkg_message.h"
 #include "opkg_utils.h"
+#include "opkg_verify.h"
 
 #include "sprintf_alloc.h"
 #include "file_util.h"
@@ -46,12 +49,64 @@
 static CURL *curl = NULL;
 static CURL *opkg_curl_init(curl_progress_func cb, void *data);
 
-static size_t dummy_write(char *ptr, size_t size, size_t nmemb, void *userdata)
+/* What a cached file was downloaded from, kept in <file>.@stamp. */
+struct file_stamp {
+    /* Size of the file once complete, -1 while it is partial. */
+    long long size;
+    /* Modification time given by the server, or -1. */
+    long filetime;
+    char *etag;
+};
+
+/* A download into dest, revalidating or resuming a cached copy of src with
+ * a conditional request where its stamp allows.
+ */
+struct curl_download {
+    CURL *handle;
+    const char *src;
+    const char *dest;
+    int use_cache;
+    int checksums;
+    /* Set if the stamp of dest is kept up to date. */
+    int stamped;
+    struct file_stamp stamp;
+    /* Set if only the end of a partial copy was requested. */
+    int ranged;
+    struct curl_slist *headers;
+    /* The destination is only opened once data arrives for it, as only
+     * then is it known whether the copy is replaced or completed.
+     */
+    FILE *file;
+    struct file_checksum *sums;
+    /* ETag of the response. */
+    char *etag;
+};
+
+static int download_open(struct curl_download *dl);
+
+/** \brief download_write: curl callback that writes data to the destination
+ * and takes its checksums on the way
+ *
+ * \param ptr data received
+ * \param size size of each data element
+ * \param nmemb number of data elements
+ * \param userdata the curl_download to write to
+ * \return number of bytes written
+ *
+ */
+static size_t download_write(char *ptr, size_t size, size_t nmemb,
+                             void *userdata)
 {
-    (void)ptr;
-    (void)userdata;
+    struct curl_download *dl = userdata;
+    size_t written;
 
-    return size * nmemb;
+    if (!dl->file && download_open(dl) != 0)
+        return 0;
+
+    written = fwrite(ptr, 1, size * nmemb, dl->file);
+    if (dl->sums)
+        file_checksum_update(dl->sums, ptr, written);
+    return written;
 }
 
 /** \brief header_write: curl callback that extracts HTTP ETag header
@@ -65,16 +120,19 @@ static size_t dummy_write(char *ptr, size_t size, size_t nmemb, void *userdata)
  */
 static size_t header_write(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
-    char prefix[5];
+    char prefix[5] = "";
     unsigned long i;
     for (i = 0; (i < 5) && (i < size * nmemb); ++i)
         prefix[i] = tolower(ptr[i]);
     if (str_starts_with(prefix, "etag:")) {
         char **out = userdata;
-        char *start = strchr(ptr, '"') + 1;
-        char *end = strrchr(ptr, '"');
-        if (end > start)
+        char *start = memchr(ptr, '"', size * nmemb);
+        char *end = start ? memrchr(ptr, '"', size * nmemb) : NULL;
+        if (start && end > ++start) {
+            /* Only the last response after redirects counts. */
+            free(*out);
             *out = strndup(start, end - start);
+        }
     }
     return size * nmemb;
 }
@@ -142,219 +200,326 @@ static CURLcode curl_ssl_ctx_function(CURL * curl, void *sslctx, void *parm)
 #endif                          /* HAVE_PATHFINDER && HAVE_OPENSSL */
 #endif                          /* HAVE_SSLCURL */
 
-/** \brief create_file_stamp: creates stamp for file
+/* Point the given handle at src. */
+static void curl_set_url(CURL * handle, const char *src)
+{
+    curl_easy_setopt(handle, CURLOPT_URL, src);
+
+#ifdef HAVE_SSLCURL
+    if (opkg_config->ftp_explicit_ssl) {
+        /*
+         * This is what enables explicit FTP SSL mode on curl's side As per
+         * the official documentation at
+         * http://curl.haxx.se/libcurl/c/curl_easy_setopt.html : "This
+         * option was known as CURLOPT_FTP_SSL up to 7.16.4, and the
+         * constants were known as CURLFTPSSL_*"
+         */
+        curl_easy_setopt(handle, CURLOPT_USE_SSL, CURLUSESSL_ALL);
+
+        /*
+         * If a URL with the ftps:// scheme is passed to curl, then it
+         * considers it's implicit mode. Thus, we need to fix it before
+         * invoking curl.
+         */
+        char *fixed_src = replace_token_in_str(src, "ftps://", "ftp://");
+        curl_easy_setopt(handle, CURLOPT_URL, fixed_src);
+        free(fixed_src);
+    }
+#endif                          /* HAVE_SSLCURL */
+}
+
+/** \brief read_file_stamp: reads the stamp of a cached file
  *
  * \param file_name absolute file name
- * \param stamp stamp data for file
- * \return 0 if success, -1 if error occurs
+ * \param stamp filled in with the stamp, whose etag is to be freed
+ * \return 0 if success, -1 if there is no usable stamp
  *
  */
-static int create_file_stamp(const char *file_name, char *stamp)
+static int read_file_stamp(const char *file_name, struct file_stamp *stamp)
 {
     FILE *file;
     char *file_path;
+    char buf[1024];
+    char *etag;
+    int n = 0;
+    int r = -1;
 
     sprintf_alloc(&file_path, "%s.@stamp", file_name);
-    file = fopen(file_path, "wb");
-    if (file == NULL) {
-        opkg_msg(ERROR, "Failed to open file %s\n", file_path);
-        free(file_path);
+    file = fopen(file_path, "r");
+    free(file_path);
+    if (!file)
         return -1;
+
+    /* Stamps from before sizes and times were kept don't parse, the file
+     * is then downloaded again.
+     */
+    if (fgets(buf, sizeof(buf), file)
+            && sscanf(buf, "%lld %ld %n", &stamp->size, &stamp->filetime,
+                      &n) == 2 && n > 0) {
+        etag = buf + n;
+        etag[strcspn(etag, "\n")] = '\0';
+        stamp->etag = *etag ? xstrdup(etag) : NULL;
+        r = 0;
     }
-    fwrite(stamp, strlen(stamp), 1, file);
+
     fclose(file);
-    free(file_path);
-    return 0;
+    return r;
 }
 
-#define STAMP_BUF_SIZE 10
-/** \brief check_file_stamp: compares provided stamp with existing file stamp
+/** \brief write_file_stamp: creates or replaces the stamp of a cached file
  *
  * \param file_name absolute file name
- * \param stamp stamp data to compare with existing file stamp
- * \return 0 if both stamps are equal or -1 otherwise
+ * \param stamp stamp data for file
+ * \return 0 if success, -1 if error occurs
  *
  */
-static int check_file_stamp(const char *file_name, char *stamp)
+static int write_file_stamp(const char *file_name,
+                            const struct file_stamp *stamp)
 {
     FILE *file;
-    char stamp_buf[STAMP_BUF_SIZE];
     char *file_path;
-    int size;
-    int diff = 0;
     int r;
 
     sprintf_alloc(&file_path, "%s.@stamp", file_name);
-    if (!file_exists(file_path)) {
-        free(file_path);
-        return -1;
-    }
-    file = fopen(file_path, "rb");
+    file = fopen(file_path, "w");
     if (file == NULL) {
         opkg_msg(ERROR, "Failed to open file %s\n", file_path);
         free(file_path);
         return -1;
     }
-    while (*stamp) {
-        size = fread(stamp_buf, 1, STAMP_BUF_SIZE, file);
-        if ((size == 0) && ferror(file)) {
-            opkg_msg(ERROR, "Failed to read from file %s\n", file_path);
-            diff = -1;
-            break;
-        }
-        diff = ((size < STAMP_BUF_SIZE) && (size != (int)strlen(stamp)))
-                || ((size == STAMP_BUF_SIZE) && (strlen(stamp) < STAMP_BUF_SIZE))
-                || memcmp(stamp_buf, stamp, size);
-        if (diff)
-            break;
-        stamp += STAMP_BUF_SIZE;
-    }
-
+    fprintf(file, "%lld %ld %s\n", stamp->size, stamp->filetime,
+            stamp->etag ? stamp->etag : "");
     r = fclose(file);
     if (r != 0)
         opkg_msg(ERROR, "Failed to close file %s\n", file_path);
     free(file_path);
-    return diff;
+    return r;
 }
 
-/** \brief opkg_validate_cached_file: check if file exists in cache
- *
- * \param src absolute URI of remote file
- * \param cache_location absolute name of cached file
- * \return 0 if file exists in cache and is completely downloaded.
- *         1 if file needs further downloading.
- *         -1 if error occurs.
- */
-static int opkg_validate_cached_file(const char *src, const char *cache_location)
+static void remove_file_stamp(const char *file_name)
 {
-    CURLcode res;
-    FILE *file;
-    long resume_from = 0;
-    char *etag = NULL;
-    double src_size = -1;
-    int ret = 1;
+    char *file_path;
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &dummy_write);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &header_write);
-    curl_easy_setopt(curl, CURLOPT_WRITEHEADER, &etag);
-    curl_easy_setopt(curl, CURLOPT_HEADER, 1);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1);  // remove body
+    sprintf_alloc(&file_path, "%s.@stamp", file_name);
+    unlink(file_path);
+    free(file_path);
+}
 
-    res = curl_easy_perform(curl);
-    if (res) {
-        long error_code;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &error_code);
-        opkg_msg(ERROR, "Failed to download %s headers: %s.\n", src,
-                 curl_easy_strerror(res));
-        ret = -1;
-        goto cleanup;
-    }
-    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &src_size);
+static void download_add_header(struct curl_download *dl, const char *name,
+                                const char *value)
+{
+    char *header;
 
-    int match = 0;
-    if (file_exists(cache_location)) {
-        if (etag && (check_file_stamp(cache_location, etag) == 0))
-            match = 1;
-        else
-            unlink(cache_location);
-    }
-    if (!match && etag) {
-        int r = create_file_stamp(cache_location, etag);
-        if (r != 0)
-            opkg_msg(ERROR, "Failed to create stamp for %s.\n", cache_location);
+    sprintf_alloc(&header, "%s: %s", name, value);
+    dl->headers = curl_slist_append(dl->headers, header);
+    free(header);
+}
+
+/* Makes the request for src conditional on the cached copy at dest being
+ * out of date, or asks for what is missing of a partial copy. Other
+ * requests replace dest.
+ */
+static void download_validate(struct curl_download *dl)
+{
+    struct stat st;
+    char *value;
+    char date[64];
+    struct tm tm;
+    time_t t;
+
+    if (!dl->use_cache || !(str_starts_with(dl->src, "http://")
+                            || str_starts_with(dl->src, "https://")))
+        return;
+    dl->stamped = 1;
+
+    if (read_file_stamp(dl->dest, &dl->stamp) != 0)
+        return;
+    if (stat(dl->dest, &st) != 0
+            || (!dl->stamp.etag && dl->stamp.filetime < 0)) {
+        free(dl->stamp.etag);
+        dl->stamp.etag = NULL;
+        return;
     }
 
-    file = fopen(cache_location, "ab");
-    if (!file) {
-        opkg_msg(ERROR, "Failed to open cache file %s\n", cache_location);
-        ret = -1;
-        goto cleanup;
+    if (dl->stamp.etag) {
+        sprintf_alloc(&value, "\"%s\"", dl->stamp.etag);
+    } else {
+        t = dl->stamp.filetime;
+        gmtime_r(&t, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        value = xstrdup(date);
     }
-    fseek(file, 0, SEEK_END);
-    resume_from = ftell(file);
-    fclose(file);
 
-    if (resume_from < src_size)
-        curl_easy_setopt(curl, CURLOPT_RESUME_FROM, resume_from);
-    else {
-        ret = 0;
-        goto cleanup;
+    if (dl->stamp.size == st.st_size) {
+        /* Complete, the server answers 304 if it is still current. */
+        if (dl->stamp.etag)
+            download_add_header(dl, "If-None-Match", value);
+        else
+            download_add_header(dl, "If-Modified-Since", value);
+    } else if (dl->stamp.size < 0 && st.st_size > 0) {
+        /* Partial, the server sends the rest if it is still current or
+         * the whole file otherwise.
+         */
+        char *range;
+
+        sprintf_alloc(&range, "%lld-", (long long)st.st_size);
+        curl_easy_setopt(dl->handle, CURLOPT_RANGE, range);
+        free(range);
+        download_add_header(dl, "If-Range", value);
+        dl->ranged = 1;
     }
+    free(value);
 
-cleanup:
-    free(etag);
+    curl_easy_setopt(dl->handle, CURLOPT_HTTPHEADER, dl->headers);
+}
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NULL);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
-    curl_easy_setopt(curl, CURLOPT_WRITEHEADER, NULL);
-    curl_easy_setopt(curl, CURLOPT_HEADER, 0);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 0);
-    return ret;
+/* Sets up handle, which points at src already, to download it. */
+static void download_setup(struct curl_download *dl, CURL * handle,
+                           const char *src, const char *dest, int use_cache,
+                           int checksums)
+{
+    memset(dl, 0, sizeof(*dl));
+    dl->handle = handle;
+    dl->src = src;
+    dl->dest = dest;
+    dl->use_cache = use_cache;
+    dl->checksums = checksums;
+    dl->stamp.size = -1;
+    dl->stamp.filetime = -1;
+
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &download_write);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, dl);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, &header_write);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &dl->etag);
+    curl_easy_setopt(handle, CURLOPT_FILETIME, 1L);
+
+    download_validate(dl);
 }
 
-/* Download using curl backend. */
-int opkg_download_backend(const char *src, const char *dest,
-                          curl_progress_func cb, void *data, int use_cache)
+/* Opens the destination once the response is in, to be completed or
+ * replaced.
+ */
+static int download_open(struct curl_download *dl)
 {
-    CURLcode res;
-    FILE *file;
-    int ret;
+    long code = 0;
+    int append;
 
-    curl = opkg_curl_init(cb, data);
-    if (!curl)
+    curl_easy_getinfo(dl->handle, CURLINFO_RESPONSE_CODE, &code);
+    append = dl->ranged && code == 206;
+
+    dl->file = fopen(dl->dest, append ? "ab" : "wb");
+    if (!dl->file) {
+        opkg_perror(ERROR, "Failed to open destination file %s", dl->dest);
         return -1;
+    }
 
-    curl_easy_setopt(curl, CURLOPT_URL, src);
+    /* Checksums are only taken of files downloaded in one go; a resumed
+     * download is read back when it is verified.
+     */
+    opkg_checksum_forget(dl->dest);
+    if (append)
+        return 0;
+
+    if (dl->checksums)
+        dl->sums = file_checksum_new(dl->checksums);
+
+    if (dl->stamped) {
+        free(dl->stamp.etag);
+        dl->stamp.etag = dl->etag ? xstrdup(dl->etag) : NULL;
+        dl->stamp.size = -1;
+        curl_easy_getinfo(dl->handle, CURLINFO_FILETIME, &dl->stamp.filetime);
+        if (dl->stamp.etag || dl->stamp.filetime >= 0)
+            write_file_stamp(dl->dest, &dl->stamp);
+        else
+            remove_file_stamp(dl->dest);
+    }
 
-#ifdef HAVE_SSLCURL
-    if (opkg_config->ftp_explicit_ssl) {
-        /*
-         * This is what enables explicit FTP SSL mode on curl's side As per
-         * the official documentation at
-         * http://curl.haxx.se/libcurl/c/curl_easy_setopt.html : "This
-         * option was known as CURLOPT_FTP_SSL up to 7.16.4, and the
-         * constants were known as CURLFTPSSL_*"
-         */
-        curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_ALL);
+    return 0;
+}
 
-        /*
-         * If a URL with the ftps:// scheme is passed to curl, then it
-         * considers it's implicit mode. Thus, we need to fix it before
-         * invoking curl.
+/* Completes a download once curl is done with it. Returns 0 if dest holds
+ * src, -1 otherwise.
+ */
+static int download_finish(struct curl_download *dl, CURLcode res)
+{
+    struct stat st;
+    long code = 0;
+    int r = 0;
+
+    curl_easy_getinfo(dl->handle, CURLINFO_RESPONSE_CODE, &code);
+    if (res != CURLE_OK) {
+        opkg_msg(ERROR, "Failed to download %s: %s.\n", dl->src,
+                 curl_easy_strerror(res));
+        /* A partial copy the server won't complete is started over next
+         * time.
          */
-        char *fixed_src = replace_token_in_str(src, "ftps://", "ftp://");
-        curl_easy_setopt(curl, CURLOPT_URL, fixed_src);
-        free(fixed_src);
+        if (dl->ranged && code == 416) {
+            unlink(dl->dest);
+            remove_file_stamp(dl->dest);
+        }
+    } else if (code == 304) {
+        opkg_msg(DEBUG, "%s is up to date.\n", dl->dest);
+    } else if (!dl->file && download_open(dl) != 0) {
+        /* An empty file gets no data written to it. */
+        res = CURLE_WRITE_ERROR;
     }
-#endif                          /* HAVE_SSLCURL */
 
-    if (use_cache) {
-        ret = opkg_validate_cached_file(src, dest);
-        if (ret <= 0)
-            return ret;
-    } else {
-        unlink(dest);
+    if (dl->file)
+        r = fclose(dl->file);
+    dl->file = NULL;
+
+    if (dl->sums) {
+        char *md5sum, *sha256sum;
+
+        file_checksum_finish(dl->sums, &md5sum, &sha256sum);
+        if (res == CURLE_OK && r == 0)
+            opkg_checksum_record(dl->dest, md5sum, sha256sum);
+        free(md5sum);
+        free(sha256sum);
+        dl->sums = NULL;
     }
 
-    file = fopen(dest, "ab");
-    if (!file) {
-        opkg_msg(ERROR, "Failed to open destination file %s\n", dest);
-        return -1;
+    /* Mark the copy complete. */
+    if (res == CURLE_OK && r == 0 && code != 304 && dl->stamped
+            && (dl->stamp.etag || dl->stamp.filetime >= 0)
+            && stat(dl->dest, &st) == 0) {
+        dl->stamp.size = st.st_size;
+        write_file_stamp(dl->dest, &dl->stamp);
     }
 
-    res = 0;
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
-    res = curl_easy_perform(curl);
-    fclose(file);
-    if (res) {
-        long error_code;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &error_code);
-        opkg_msg(ERROR, "Failed to download %s: %s.\n", src,
-                 curl_easy_strerror(res));
+    curl_easy_setopt(dl->handle, CURLOPT_WRITEFUNCTION, NULL);
+    curl_easy_setopt(dl->handle, CURLOPT_WRITEDATA, NULL);
+    curl_easy_setopt(dl->handle, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(dl->handle, CURLOPT_HEADERDATA, NULL);
+    curl_easy_setopt(dl->handle, CURLOPT_HTTPHEADER, NULL);
+    curl_easy_setopt(dl->handle, CURLOPT_RANGE, NULL);
+    curl_slist_free_all(dl->headers);
+    dl->headers = NULL;
+    free(dl->etag);
+    dl->etag = NULL;
+    free(dl->stamp.etag);
+    dl->stamp.etag = NULL;
+
+    return (res == CURLE_OK && r == 0) ? 0 : -1;
+}
+
+/* Download using curl backend. */
+int opkg_download_backend(const char *src, const char *dest,
+                          curl_progress_func cb, void *data, int use_cache,
+                          int checksums)
+{
+    struct curl_download dl;
+    CURLcode res;
+
+    curl = opkg_curl_init(cb, data);
+    if (!curl)
         return -1;
-    }
 
-    return 0;
+    curl_set_url(curl, src);
+
+    download_setup(&dl, curl, src, dest, use_cache, checksums);
+    res = curl_easy_perform(curl);
+    return download_finish(&dl, res);
 }
 
 void opkg_download_cleanup(void)
@@ -374,102 +539,111 @@ void opkg_download_cleanup(void)
         opkg_msg(DEBUG, "Cannot set CURL option '%s'.\n", #opt);    \
 } while (0)
 
-static CURL *opkg_curl_init(curl_progress_func cb, void *data)
+/* Apply the configured options to a new easy handle. Returns 0 on success or
+ * -1 on error.
+ */
+static int opkg_curl_setup(CURL * curl)
 {
     int r;
 
-    if (curl == NULL) {
-        curl = curl_easy_init();
-
 #ifdef HAVE_SSLCURL
-#ifdef HAVE_OPENSSL
-        openssl_init();
-#endif                          /* HAVE_OPENSSL */
-
-        if (opkg_config->ssl_engine) {
-            /* use crypto engine */
-            r = curl_easy_setopt(curl, CURLOPT_SSLENGINE,
-                    opkg_config->ssl_engine);
-            if (r != CURLE_OK) {
-                opkg_msg(ERROR, "Can't set crypto engine '%s'.\n",
-                         opkg_config->ssl_engine);
-
-                opkg_download_cleanup();
-                return NULL;
-            }
-            /* set the crypto engine as default */
-            r = curl_easy_setopt(curl, CURLOPT_SSLENGINE_DEFAULT, 1L);
-            if (r != CURLE_OK) {
-                opkg_msg(ERROR, "Can't set crypto engine '%s' as default.\n",
-                         opkg_config->ssl_engine);
-
-                opkg_download_cleanup();
-                return NULL;
-            }
+    if (opkg_config->ssl_engine) {
+        /* use crypto engine */
+        r = curl_easy_setopt(curl, CURLOPT_SSLENGINE,
+                opkg_config->ssl_engine);
+        if (r != CURLE_OK) {
+            opkg_msg(ERROR, "Can't set crypto engine '%s'.\n",
+                     opkg_config->ssl_engine);
+            return -1;
+        }
+        /* set the crypto engine as default */
+        r = curl_easy_setopt(curl, CURLOPT_SSLENGINE_DEFAULT, 1L);
+        if (r != CURLE_OK) {
+            opkg_msg(ERROR, "Can't set crypto engine '%s' as default.\n",
+                     opkg_config->ssl_engine);
+            return -1;
         }
+    }
+
+    /* cert & key can only be in PEM case in the same file */
+    if (opkg_config->ssl_key_passwd)
+        setopt(CURLOPT_SSLKEYPASSWD, opkg_config->ssl_key_passwd);
+
+    /* sets the client certificate and its type */
+    if (opkg_config->ssl_cert_type)
+        setopt(CURLOPT_SSLCERTTYPE, opkg_config->ssl_cert_type);
 
-        /* cert & key can only be in PEM case in the same file */
-        if (opkg_config->ssl_key_passwd)
-            setopt(CURLOPT_SSLKEYPASSWD, opkg_config->ssl_key_passwd);
-
-        /* sets the client certificate and its type */
-        if (opkg_config->ssl_cert_type)
-            setopt(CURLOPT_SSLCERTTYPE, opkg_config->ssl_cert_type);
-
-        /* SSL cert name isn't mandatory */
-        if (opkg_config->ssl_cert)
-            setopt(CURLOPT_SSLCERT, opkg_config->ssl_cert);
-
-        /* sets the client key and its type */
-        if (opkg_config->ssl_key_type)
-            setopt(CURLOPT_SSLKEYTYPE, opkg_config->ssl_key_type);
-        if (opkg_config->ssl_key)
-            setopt(CURLOPT_SSLKEY, opkg_config->ssl_key);
-
-        /* Should we verify the peer certificate ? */
-        if (opkg_config->ssl_dont_verify_peer)
-            /*
-             * CURLOPT_SSL_VERIFYPEER default is nonzero (curl => 7.10)
-             */
-            setopt(CURLOPT_SSL_VERIFYPEER, 0);
+    /* SSL cert name isn't mandatory */
+    if (opkg_config->ssl_cert)
+        setopt(CURLOPT_SSLCERT, opkg_config->ssl_cert);
+
+    /* sets the client key and its type */
+    if (opkg_config->ssl_key_type)
+        setopt(CURLOPT_SSLKEYTYPE, opkg_config->ssl_key_type);
+    if (opkg_config->ssl_key)
+        setopt(CURLOPT_SSLKEY, opkg_config->ssl_key);
+
+    /* Should we verify the peer certificate ? */
+    if (opkg_config->ssl_dont_verify_peer)
+        /*
+         * CURLOPT_SSL_VERIFYPEER default is nonzero (curl => 7.10)
+         */
+        setopt(CURLOPT_SSL_VERIFYPEER, 0);
 #if defined(HAVE_PATHFINDER) && defined(HAVE_OPENSSL)
-        else if (opkg_config->check_x509_path) {
-                setopt(CURLOPT_SSL_CTX_FUNCTION, curl_ssl_ctx_function);
-                setopt(CURLOPT_SSL_CTX_DATA, NULL);
-        }
+    else if (opkg_config->check_x509_path) {
+            setopt(CURLOPT_SSL_CTX_FUNCTION, curl_ssl_ctx_function);
+            setopt(CURLOPT_SSL_CTX_DATA, NULL);
+    }
 #endif
 
-        /* certification authority file and/or path */
-        if (opkg_config->ssl_ca_file)
-            setopt(CURLOPT_CAINFO, opkg_config->ssl_ca_file);
-        if (opkg_config->ssl_ca_path)
-            setopt(CURLOPT_CAPATH, opkg_config->ssl_ca_path);
+    /* certification authority file and/or path */
+    if (opkg_config->ssl_ca_file)
+        setopt(CURLOPT_CAINFO, opkg_config->ssl_ca_file);
+    if (opkg_config->ssl_ca_path)
+        setopt(CURLOPT_CAPATH, opkg_config->ssl_ca_path);
 #endif
 
-        if (opkg_config->connect_timeout_ms > 0) {
-            long timeout_ms = opkg_config->connect_timeout_ms;
-            setopt(CURLOPT_CONNECTTIMEOUT_MS, timeout_ms);
-        }
+    if (opkg_config->connect_timeout_ms > 0) {
+        long timeout_ms = opkg_config->connect_timeout_ms;
+        setopt(CURLOPT_CONNECTTIMEOUT_MS, timeout_ms);
+    }
 
-        if (opkg_config->transfer_timeout_ms > 0) {
-            long timeout_ms = opkg_config->transfer_timeout_ms;
-            setopt(CURLOPT_TIMEOUT_MS, timeout_ms);
-        }
+    if (opkg_config->transfer_timeout_ms > 0) {
+        long timeout_ms = opkg_config->transfer_timeout_ms;
+        setopt(CURLOPT_TIMEOUT_MS, timeout_ms);
+    }
 
-        if (opkg_config->follow_location)
-            setopt(CURLOPT_FOLLOWLOCATION, 1);
+    if (opkg_config->follow_location)
+        setopt(CURLOPT_FOLLOWLOCATION, 1);
 
-        setopt(CURLOPT_FAILONERROR, 1);
-        int use_proxy = opkg_config->http_proxy || opkg_config->ftp_proxy
-                || opkg_config->https_proxy;
-        if (use_proxy) {
-            setopt(CURLOPT_PROXYUSERNAME, opkg_config->proxy_user);
-            setopt(CURLOPT_PROXYPASSWORD, opkg_config->proxy_passwd);
-            setopt(CURLOPT_PROXYAUTH, CURLAUTH_ANY);
-        }
-        if (opkg_config->http_auth) {
-            setopt(CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-            setopt(CURLOPT_USERPWD, opkg_config->http_auth);
+    setopt(CURLOPT_FAILONERROR, 1);
+    int use_proxy = opkg_config->http_proxy || opkg_config->ftp_proxy
+            || opkg_config->https_proxy;
+    if (use_proxy) {
+        setopt(CURLOPT_PROXYUSERNAME, opkg_config->proxy_user);
+        setopt(CURLOPT_PROXYPASSWORD, opkg_config->proxy_passwd);
+        setopt(CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+    }
+    if (opkg_config->http_auth) {
+        setopt(CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+        setopt(CURLOPT_USERPWD, opkg_config->http_auth);
+    }
+
+    return 0;
+}
+
+static CURL *opkg_curl_init(curl_progress_func cb, void *data)
+{
+    if (curl == NULL) {
+        curl = curl_easy_init();
+
+#if defined(HAVE_SSLCURL) && defined(HAVE_OPENSSL)
+        openssl_init();
+#endif
+
+        if (opkg_curl_setup(curl) != 0) {
+            opkg_download_cleanup();
+            return NULL;
         }
     }
 
@@ -481,3 +655,160 @@ static CURL *opkg_curl_init(curl_progress_func cb, void *data)
 
     return curl;
 }
+
+/* A download run by opkg_download_backend_multi(). */
+struct multi_job {
+    struct opkg_download_job *job;
+    struct curl_download dl;
+    double dltotal;
+    double dlnow;
+    struct multi_progress *progress;
+};
+
+struct multi_progress {
+    struct multi_job *jobs;
+    unsigned int count;
+    curl_progress_func cb;
+    void *data;
+};
+
+/* Reports the progress of all the downloads together. */
+static int multi_progress(void *userdata, curl_off_t dltotal,
+                          curl_off_t dlnow, curl_off_t ultotal,
+                          curl_off_t ulnow)
+{
+    struct multi_job *mj = userdata;
+    struct multi_progress *progress = mj->progress;
+    double total = 0, now = 0;
+    unsigned int i;
+
+    (void)ultotal;
+    (void)ulnow;
+
+    mj->dltotal = dltotal;
+    mj->dlnow = dlnow;
+
+    for (i = 0; i < progress->count; i++) {
+        total += progress->jobs[i].dltotal;
+        now += progress->jobs[i].dlnow;
+    }
+
+    return progress->cb(progress->data, total, now, 0, 0);
+}
+
+static void multi_job_finish(struct multi_job *mj, CURLcode res)
+{
+    struct opkg_download_job *job = mj->job;
+    CURL *handle = mj->dl.handle;
+
+    job->result = download_finish(&mj->dl, res);
+    /* Cached files are kept so that they can be resumed. */
+    if (job->result != 0 && !job->use_cache)
+        unlink(job->dest);
+
+    curl_easy_cleanup(handle);
+    mj->dl.handle = NULL;
+}
+
+void opkg_download_backend_multi(struct opkg_download_job *jobs,
+                                 unsigned int count, curl_progress_func cb,
+                                 void *data)
+{
+    CURLM *multi;
+    CURLMcode mc;
+    CURLMsg *msg;
+    CURL *handle;
+    struct multi_job *mjobs, *mj;
+    struct multi_progress progress;
+    unsigned int i;
+    int running, pending;
+
+    for (i = 0; i < count; i++)
+        jobs[i].result = -1;
+
+    /* Sets up the library the first time round. */
+    if (!opkg_curl_init(NULL, NULL))
+        return;
+
+    multi = curl_multi_init();
+    if (!multi) {
+        opkg_msg(ERROR, "Failed to start parallel downloads.\n");
+        return;
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)opkg_config->parallel_downloads);
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                      (long)opkg_config->parallel_downloads);
+
+    mjobs = xcalloc(count, sizeof(*mjobs));
+    progress.jobs = mjobs;
+    progress.count = count;
+    progress.cb = cb;
+    progress.data = data;
+
+    for (i = 0; i < count; i++) {
+        mj = &mjobs[i];
+        mj->job = &jobs[i];
+        mj->progress = &progress;
+
+        handle = curl_easy_init();
+        if (!handle || opkg_curl_setup(handle) != 0) {
+            opkg_msg(ERROR, "Failed to set up download of %s.\n", jobs[i].src);
+            if (handle)
+                curl_easy_cleanup(handle);
+            continue;
+        }
+
+        curl_set_url(handle, jobs[i].src);
+        curl_easy_setopt(handle, CURLOPT_PRIVATE, mj);
+        curl_easy_setopt(handle, CURLOPT_NOPROGRESS, (long)(cb == NULL));
+        if (cb) {
+            curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, &multi_progress);
+            curl_easy_setopt(handle, CURLOPT_XFERINFODATA, mj);
+        }
+        download_setup(&mj->dl, handle, jobs[i].src, jobs[i].dest,
+                       jobs[i].use_cache, jobs[i].checksums);
+
+        mc = curl_multi_add_handle(multi, handle);
+        if (mc != CURLM_OK) {
+            opkg_msg(ERROR, "Failed to start download of %s: %s.\n",
+                     jobs[i].src, curl_multi_strerror(mc));
+            multi_job_finish(mj, CURLE_FAILED_INIT);
+        }
+    }
+
+    do {
+        mc = curl_multi_perform(multi, &running);
+        if (mc == CURLM_OK && running)
+            mc = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        if (mc != CURLM_OK) {
+            opkg_msg(ERROR, "Parallel downloads failed: %s.\n",
+                     curl_multi_strerror(mc));
+            running = 0;
+        }
+
+        while ((msg = curl_multi_info_read(multi, &pending))) {
+            char *priv;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+            mj = (struct multi_job *)priv;
+            curl_multi_remove_handle(multi, mj->dl.handle);
+            multi_job_finish(mj, msg->data.result);
+        }
+    } while (running);
+
+    /* Anything left over was cut short by an error. */
+    for (i = 0; i < count; i++) {
+        mj = &mjobs[i];
+        if (mj->dl.handle) {
+            curl_multi_remove_handle(multi, mj->dl.handle);
+            multi_job_finish(mj, CURLE_ABORTED_BY_CALLBACK);
+        }
+    }
+
+    curl_multi_cleanup(multi);
+    free(mjobs);
+}
@@ -37,7 +37,8 @@
  * so we are precluded from using most features anyway.
  */
 int opkg_download_backend(const char *src, const char *dest,
-                          curl_progress_func cb, void *data, int use_cache)
+                          curl_progress_func cb, void *data, int use_cache,
+                          int checksums)
 {
     int res;
     const char *argv[8];
@@ -47,6 +48,7 @@ int opkg_download_backend(const char *src, const char *dest,
     (void)cb;
     (void)data;
     (void)use_cache;
+    (void)checksums;
 
     unlink(dest);
 
@@ -70,6 +72,18 @@ int opkg_download_backend(const char *src, const char *dest,
     return 0;
 }
 
+void opkg_download_backend_multi(struct opkg_download_job *jobs,
+                                 unsigned int count, curl_progress_func cb,
+                                 void *data)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        jobs[i].result = opkg_download_backend(jobs[i].src, jobs[i].dest, cb,
+                                               data, jobs[i].use_cache,
+                                               jobs[i].checksums);
+}
+
 void opkg_download_cleanup(void)
 {
     /* Nothing to do. */
@@ -22,6 +22,8 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <dirent.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -42,6 +44,7 @@
 #include "opkg_conf.h"
 
 #include "sprintf_alloc.h"
+#include "file_commit.h"
 #include "file_util.h"
 #include "xsystem.h"
 #include "xfuncs.h"
@@ -59,7 +62,7 @@ static int update_file_ownership(pkg_t * new_pkg, pkg_t * old_pkg)
             iter; iter = niter, niter = file_list_next(new_list, niter)) {
         file_info_t *new_file = (file_info_t *)iter->data;
         pkg_t *owner = file_hash_get_file_owner(new_file->path);
-        pkg_t *obs = hash_table_get(&opkg_config->obs_file_hash, new_file->path);
+        pkg_t *obs = file_hash_get_obs_owner(new_file->path);
 
         opkg_msg(DEBUG2, "%s: new_pkg=%s wants file %s, from owner=%s\n",
                  __func__, new_pkg->name, new_file->path,
@@ -82,8 +85,7 @@ static int update_file_ownership(pkg_t * new_pkg, pkg_t * old_pkg)
             pkg_t *owner = file_hash_get_file_owner(old_file->path);
             if (!owner || (owner == old_pkg)) {
                 /* obsolete */
-                hash_table_insert(&opkg_config->obs_file_hash, old_file->path,
-                                  old_pkg);
+                file_hash_set_obs_owner(old_file->path, old_pkg);
             }
         }
         pkg_free_installed_files(old_pkg);
@@ -203,7 +205,8 @@ static int unpack_pkg_control_files(pkg_t * pkg)
                       cf_name[0] == '/' ? (cf_name + 1) : cf_name);
 
         /* Can't get an md5sum now, (file isn't extracted yet).
-         * We'll wait until resolve_conffiles */
+         * It is computed as the file is extracted, or failing that
+         * in resolve_conffiles */
         conffile_list_append(&pkg->conffiles, cf_name_in_dest, NULL);
 
         free(cf_name);
@@ -555,7 +558,7 @@ static int check_data_file_clashes(pkg_t * pkg, pkg_t * old_pkg)
             }
 
             /* Pre-existing files are OK if they are obsolete */
-            obs = hash_table_get(&opkg_config->obs_file_hash, filename);
+            obs = file_hash_get_obs_owner(filename);
             if (obs) {
                 opkg_msg(INFO,
                          "Pre-exiting file %s is obsolete." " obs_pkg=%s\n",
@@ -746,11 +749,57 @@ static int remove_obsolesced_files(pkg_t * pkg, pkg_t * old_pkg)
     return err;
 }
 
+/* Copies the control files unpack_pkg_control_files() left in
+ * tmp_unpack_dir to info_dir. Returns 1 if one of them isn't a regular
+ * file, without copying anything. */
+static int copy_maintainer_scripts(pkg_t * pkg)
+{
+    DIR *dir;
+    struct dirent *de;
+    struct stat st;
+    char *src, *dest;
+    int pass, ret = 0;
+
+    /* Check every file first, so that nothing is left half copied. */
+    for (pass = 0; pass < 2 && ret == 0; pass++) {
+        dir = opendir(pkg->tmp_unpack_dir);
+        if (!dir)
+            return 1;
+
+        while (ret == 0 && (de = readdir(dir)) != NULL) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+                continue;
+
+            sprintf_alloc(&src, "%s/%s", pkg->tmp_unpack_dir, de->d_name);
+            if (pass == 0) {
+                if (lstat(src, &st) != 0 || !S_ISREG(st.st_mode))
+                    ret = 1;
+            } else {
+                sprintf_alloc(&dest, "%s/%s.%s", pkg->dest->info_dir,
+                              pkg->name, de->d_name);
+                ret = file_copy(src, dest);
+                free(dest);
+            }
+            free(src);
+        }
+
+        closedir(dir);
+    }
+
+    return ret;
+}
+
 static int install_maintainer_scripts(pkg_t * pkg, pkg_t * old_pkg)
 {
     int ret;
     char *prefix;
 
+    /* Save decompressing control.tar.* again when it was all unpacked
+     * already. */
+    ret = copy_maintainer_scripts(pkg);
+    if (ret != 1)
+        return ret;
+
     sprintf_alloc(&prefix, "%s.", pkg->name);
     ret = pkg_extract_control_files_to_dir_with_prefix(pkg, pkg->dest->info_dir,
                                                        prefix);
@@ -788,6 +837,7 @@ static int install_data_files(pkg_t * pkg)
      * check_data_file_clashes() for more details. */
 
     opkg_msg(INFO, "Extracting data files to %s.\n", pkg->dest->root_dir);
+    file_commit_touch(pkg->dest->root_dir);
     err = pkg_extract_data_files_to_dir(pkg, pkg->dest->root_dir);
     if (err) {
         return err;
@@ -828,7 +878,8 @@ static int resolve_conffiles(pkg_t * pkg)
         cf = (conffile_t *) iter->data;
         root_filename = root_filename_alloc(cf->name);
 
-        /* Might need to initialize the md5sum for each conffile */
+        /* Conffiles get their md5sum as they are extracted; any that
+         * weren't in the data archive still need one */
         if (cf->value == NULL) {
             cf->value = file_md5sum_alloc(root_filename);
         }
@@ -947,9 +998,20 @@ int opkg_install_pkg(pkg_t * pkg, pkg_t * old_pkg)
         }
     }
 
+    /* Hold on to the file list read from data.tar.* for the whole install:
+     * the ownership, clash and obsolete file checks below would otherwise
+     * each decompress the archive again. */
+    if (pkg_get_installed_files(pkg) == NULL) {
+        opkg_msg(ERROR, "Failed to read the file list of %s.\n",
+                 pkg->local_filename);
+        return -1;
+    }
+
     err = update_file_ownership(pkg, old_pkg);
-    if (err)
+    if (err) {
+        pkg_free_installed_files(pkg);
         return -1;
+    }
 
     /* this next section we do with SIGINT blocked to prevent inconsistency
      * between opkg database and filesystem */
@@ -980,8 +1042,10 @@ int opkg_install_pkg(pkg_t * pkg, pkg_t * old_pkg)
     if (err)
         goto UNWIND_POSTRM_UPGRADE_OLD_PKG;
 
-    if (opkg_config->noaction)
+    if (opkg_config->noaction) {
+        pkg_free_installed_files(pkg);
         return 0;
+    }
 
     /* point of no return: no unwinding after this */
     if (old_pkg) {
@@ -1058,6 +1122,7 @@ int opkg_install_pkg(pkg_t * pkg, pkg_t * old_pkg)
         ab_pkg->state_status = pkg->state_status;
 
     sigprocmask(SIG_UNBLOCK, &newset, &oldset);
+    pkg_free_installed_files(pkg);
     return 0;
 
  UNWIND_POSTRM_UPGRADE_OLD_PKG:
@@ -1087,5 +1152,6 @@ int opkg_install_pkg(pkg_t * pkg, pkg_t * old_pkg)
              pkg->name);
 
     sigprocmask(SIG_UNBLOCK, &newset, &oldset);
+    pkg_free_installed_files(pkg);
     return -1;
 }
@@ -18,14 +18,19 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "file_util.h"
 #include "opkg_conf.h"
 #include "opkg_message.h"
 #include "opkg_verify.h"
+#include "sprintf_alloc.h"
+#include "xfuncs.h"
 
 #ifdef HAVE_GPGME
 #include "opkg_gpg.h"
@@ -55,15 +60,147 @@ int opkg_verify_openssl_signature(const char *file, const char *sigfile)
 }
 #endif
 
-int opkg_verify_md5sum(const char *file, const char *md5sum)
+/* The checksums of a file in the cache are recorded beside it, together with
+ * the size, inode and mtime the file had when they were taken. Verifying the
+ * file again only reads it if it has changed since.
+ */
+#define SUMS_SUFFIX ".@sums"
+
+enum { SUM_MD5, SUM_SHA256, SUM_COUNT };
+
+static int file_is_cached(const char *file)
+{
+    const char *cache_dir = opkg_config->cache_dir;
+    size_t len;
+
+    if (!cache_dir)
+        return 0;
+
+    len = strlen(cache_dir);
+    return strncmp(file, cache_dir, len) == 0 && file[len] == '/';
+}
+
+/* Read the checksums recorded for file into sums, leaving NULL those that were
+ * not recorded. Returns 0 if the record is still good for the file or -1
+ * otherwise.
+ */
+static int sums_read(const char *file, char *sums[SUM_COUNT])
 {
+    struct stat st;
+    FILE *f;
+    char *sums_file;
+    long long size, mtime_sec, mtime_nsec;
+    unsigned long long ino;
+    char md5sum[33], sha256sum[65];
     int r;
-    char *file_md5sum;
 
-    if (!file_exists(file))
+    if (stat(file, &st) != 0)
+        return -1;
+
+    sprintf_alloc(&sums_file, "%s%s", file, SUMS_SUFFIX);
+    f = fopen(sums_file, "r");
+    free(sums_file);
+    if (!f)
         return -1;
 
-    file_md5sum = file_md5sum_alloc(file);
+    r = fscanf(f, "%lld %llu %lld %lld %32s %64s", &size, &ino, &mtime_sec,
+               &mtime_nsec, md5sum, sha256sum);
+    fclose(f);
+    if (r != 6 || size != (long long)st.st_size || ino != st.st_ino
+            || mtime_sec != (long long)st.st_mtim.tv_sec
+            || mtime_nsec != (long long)st.st_mtim.tv_nsec)
+        return -1;
+
+    sums[SUM_MD5] = strcmp(md5sum, "-") ? xstrdup(md5sum) : NULL;
+    sums[SUM_SHA256] = strcmp(sha256sum, "-") ? xstrdup(sha256sum) : NULL;
+    return 0;
+}
+
+static void sums_write(const char *file, const char *sums[SUM_COUNT])
+{
+    struct stat st;
+    FILE *f;
+    char *sums_file;
+
+    if (stat(file, &st) != 0)
+        return;
+
+    sprintf_alloc(&sums_file, "%s%s", file, SUMS_SUFFIX);
+    f = fopen(sums_file, "w");
+    if (!f) {
+        opkg_perror(DEBUG, "Failed to record checksums in %s", sums_file);
+        free(sums_file);
+        return;
+    }
+
+    fprintf(f, "%lld %llu %lld %lld %s %s\n", (long long)st.st_size,
+            (unsigned long long)st.st_ino, (long long)st.st_mtim.tv_sec,
+            (long long)st.st_mtim.tv_nsec,
+            sums[SUM_MD5] ? sums[SUM_MD5] : "-",
+            sums[SUM_SHA256] ? sums[SUM_SHA256] : "-");
+    if (fclose(f) != 0) {
+        opkg_perror(DEBUG, "Failed to record checksums in %s", sums_file);
+        unlink(sums_file);
+    }
+    free(sums_file);
+}
+
+/* Returns the checksum of the given kind for file in a string the caller must
+ * free, or NULL on error. Files in the cache are only read if no checksum of
+ * that kind is recorded for them, which is then recorded.
+ */
+static char *file_checksum_alloc(const char *file, int kind)
+{
+    char *sums[SUM_COUNT] = { NULL, NULL };
+    char *sum;
+    int cached = file_is_cached(file);
+
+    if (!file_exists(file))
+        return NULL;
+
+    if (!cached || sums_read(file, sums) != 0 || !sums[kind]) {
+        free(sums[kind]);
+#ifdef HAVE_SHA256
+        if (kind == SUM_SHA256)
+            sums[kind] = file_sha256sum_alloc(file);
+        else
+#endif
+            sums[kind] = file_md5sum_alloc(file);
+
+        if (cached && sums[kind])
+            sums_write(file, (const char **)sums);
+    }
+
+    sum = sums[kind];
+    free(sums[!kind]);
+    return sum;
+}
+
+void opkg_checksum_record(const char *file, const char *md5sum,
+                          const char *sha256sum)
+{
+    const char *sums[SUM_COUNT] = { md5sum, sha256sum };
+
+    if ((md5sum || sha256sum) && file_is_cached(file))
+        sums_write(file, sums);
+}
+
+void opkg_checksum_forget(const char *file)
+{
+    char *sums_file;
+
+    sprintf_alloc(&sums_file, "%s%s", file, SUMS_SUFFIX);
+    if (unlink(sums_file) != 0 && errno != ENOENT)
+        opkg_perror(DEBUG, "Failed to remove %s", sums_file);
+    free(sums_file);
+}
+
+int opkg_verify_md5sum(const char *file, const char *md5sum)
+{
+    int r;
+    char *file_md5sum;
+
+    file_md5sum = file_checksum_alloc(file, SUM_MD5);
     if (!file_md5sum)
         return -1;
 
@@ -79,10 +216,7 @@ int opkg_verify_sha256sum(const char *file, const char *sha256sum)
     int r;
     char *file_sha256sum;
 
-    if (!file_exists(file))
-        return -1;
-
-    file_sha256sum = file_sha256sum_alloc(file);
+    file_sha256sum = file_checksum_alloc(file, SUM_SHA256);
     if (!file_sha256sum)
         return -1;
 
@@ -23,6 +23,15 @@
 extern "C" {
 #endif
 
+/* Records the checksums of a file in the cache so that verifying it again
+ * need not read it. Either checksum may be NULL; files outside the cache are
+ * ignored.
+ */
+void opkg_checksum_record(const char *file, const char *md5sum,
+                          const char *sha256sum);
+/* Drops any checksums recorded for file. */
+void opkg_checksum_forget(const char *file);
+
 int opkg_verify_md5sum(const char *file, const char *md5sum);
 int opkg_verify_sha256sum(const char *file, const char *sha256sum);
 int opkg_verify_signature(const char *file, const char *sigfile);
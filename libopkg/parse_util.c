@@ -54,44 +54,53 @@ char *parse_simple(const char *type, const char *line)
  */
 char **parse_list(const char *raw, unsigned int *count, const char sep,
                   int skip_field)
+{
+    return parse_list_n(raw, strlen(raw), count, sep, skip_field);
+}
+
+/*
+ * Same as parse_list(), for the first len bytes of raw, which need not be
+ * terminated.
+ */
+char **parse_list_n(const char *raw, size_t len, unsigned int *count,
+                    const char sep, int skip_field)
 {
     char **depends = NULL;
-    const char *start, *end;
+    const char *start, *end, *raw_end = raw + len;
     int line_count = 0;
 
     /* skip past the "Field:" marker */
     if (!skip_field) {
-        while (*raw && *raw != ':')
+        while (raw < raw_end && *raw != ':')
+            raw++;
+        if (raw < raw_end)
             raw++;
-        raw++;
     }
 
-    if (line_is_blank(raw)) {
-        *count = line_count;
-        return NULL;
-    }
+    while (raw < raw_end && isspace(*raw))
+        raw++;
 
-    while (*raw) {
+    while (raw < raw_end) {
         depends = xrealloc(depends, sizeof(char *) * (line_count + 1));
 
-        while (isspace(*raw))
+        while (raw < raw_end && isspace(*raw))
             raw++;
 
         start = raw;
-        while (*raw != sep && *raw)
+        while (raw < raw_end && *raw != sep)
             raw++;
         end = raw;
 
-        while (end > start && isspace(*end))
+        while (end > start && end < raw_end && isspace(*end))
             end--;
 
-        if (sep == ' ')
+        if (sep == ' ' && end < raw_end)
             end++;
 
         depends[line_count] = xstrndup(start, end - start);
 
         line_count++;
-        if (*raw == sep)
+        if (raw < raw_end && *raw == sep)
             raw++;
     }
 
@@ -181,3 +190,32 @@ int parse_from_stream_nomalloc(parse_line_t parse_line, void *ptr, FILE * fp,
 
     return ret;
 }
+
+/*
+ * Feed the lines of the buffer at *buf to parse_field until it returns
+ * non-zero or end is reached, and leave *buf past the last line consumed.
+ * The lines are passed in place, without their newline and unterminated.
+ */
+int parse_from_buffer(parse_field_t parse_field, void *ptr, const char **buf,
+                      const char *end, uint mask)
+{
+    const char *line = *buf;
+    const char *nl;
+    int r = 0;
+
+    while (line < end && r == 0) {
+        nl = memchr(line, '\n', end - line);
+        if (nl == NULL) {
+            opkg_msg(ERROR, "Missing new line character" " at end of file!\n");
+            parse_field(ptr, line, end - line, mask);
+            line = end;
+            break;
+        }
+
+        r = parse_field(ptr, line, nl - line, mask);
+        line = nl + 1;
+    }
+
+    *buf = line;
+    return 0;
+}
@@ -24,13 +24,14 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <libgen.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 
 #include "pkg.h"
 
 #include "pkg_parse.h"
+#include "file_commit.h"
+#include "file_index.h"
 #include "pkg_extract.h"
 #include "opkg_download.h"
 #include "opkg_message.h"
@@ -117,6 +118,7 @@ static void pkg_init(pkg_t * pkg)
     pkg->provides = NULL;
     pkg->filename = NULL;
     pkg->local_filename = NULL;
+    pkg->ar_index = NULL;
     pkg->tmp_unpack_dir = NULL;
     pkg->md5sum = NULL;
     pkg->sha256sum = NULL;
@@ -125,8 +127,11 @@ static void pkg_init(pkg_t * pkg)
     pkg->priority = NULL;
     pkg->source = NULL;
     conffile_list_init(&pkg->conffiles);
+    pkg->stanza_file = NULL;
+    pkg->stanza_offset = 0;
     pkg->installed_files = NULL;
     pkg->installed_files_ref_cnt = 0;
+    pkg->owned_files = NULL;
     pkg->essential = 0;
     pkg->provided_by_hand = 0;
 
@@ -145,22 +150,19 @@ pkg_t *pkg_new(void)
     return pkg;
 }
 
-static void compound_depend_deinit(compound_depend_t * depends)
+static void str_array_free(char **array, unsigned int count)
 {
-    int i;
-    for (i = 0; i < depends->possibility_count; i++) {
-        depend_t *d;
-        d = depends->possibilities[i];
-        free(d->version);
-        free(d);
-    }
-    free(depends->possibilities);
+    unsigned int i;
+
+    if (!array)
+        return;
+    for (i = 0; i < count; i++)
+        free(array[i]);
+    free(array);
 }
 
 void pkg_deinit(pkg_t * pkg)
 {
-    unsigned int i;
-
     free(pkg->name);
     pkg->name = NULL;
 
@@ -178,13 +180,13 @@ void pkg_deinit(pkg_t * pkg)
     /* owned by opkg_conf_t */
     pkg->src = NULL;
 
-    free(pkg->architecture);
+    /* interned, owned by pkg_str_pool */
     pkg->architecture = NULL;
 
-    free(pkg->maintainer);
+    /* interned, owned by pkg_str_pool */
     pkg->maintainer = NULL;
 
-    free(pkg->section);
+    /* interned, owned by pkg_str_pool */
     pkg->section = NULL;
 
     free(pkg->description);
@@ -195,28 +197,27 @@ void pkg_deinit(pkg_t * pkg)
     pkg->state_flag = SF_OK;
     pkg->state_status = SS_NOT_INSTALLED;
 
-    if (pkg->replaces) {
-        for (i = 0; i < pkg->replaces_count; i++)
-            compound_depend_deinit(&pkg->replaces[i]);
-        free(pkg->replaces);
-    }
-
-    if (pkg->depends) {
-        unsigned int count = pkg->pre_depends_count + pkg->depends_count
-            + pkg->recommends_count + pkg->suggests_count;
-
-        for (i = 0; i < count; i++)
-            compound_depend_deinit(&pkg->depends[i]);
-        free(pkg->depends);
-    }
-
-    if (pkg->conflicts) {
-        for (i = 0; i < pkg->conflicts_count; i++)
-            compound_depend_deinit(&pkg->conflicts[i]);
-        free(pkg->conflicts);
-    }
+    /* only left if the package never made it into the hash */
+    str_array_free(pkg->pre_depends_str, pkg->pre_depends_count);
+    pkg->pre_depends_str = NULL;
+    str_array_free(pkg->depends_str, pkg->depends_count);
+    pkg->depends_str = NULL;
+    str_array_free(pkg->recommends_str, pkg->recommends_count);
+    pkg->recommends_str = NULL;
+    str_array_free(pkg->suggests_str, pkg->suggests_count);
+    pkg->suggests_str = NULL;
+    str_array_free(pkg->conflicts_str, pkg->conflicts_count);
+    pkg->conflicts_str = NULL;
+    str_array_free(pkg->replaces_str, pkg->replaces_count);
+    pkg->replaces_str = NULL;
+    str_array_free(pkg->provides_str, pkg->provides_count);
+    pkg->provides_str = NULL;
 
-    free(pkg->provides);
+    /* allocated from pkg_arena, owned by the package hash */
+    pkg->replaces = NULL;
+    pkg->depends = NULL;
+    pkg->conflicts = NULL;
+    pkg->provides = NULL;
 
     pkg->pre_depends_count = 0;
     pkg->provides_count = 0;
@@ -227,6 +228,10 @@ void pkg_deinit(pkg_t * pkg)
     free(pkg->local_filename);
     pkg->local_filename = NULL;
 
+    if (pkg->ar_index)
+        ar_index_free(pkg->ar_index);
+    pkg->ar_index = NULL;
+
     /* CLEANUP: It'd be nice to pullin the cleanup function from
      * opkg_install.c here. See comment in
      * opkg_install.c:cleanup_temporary_files */
@@ -239,10 +244,10 @@ void pkg_deinit(pkg_t * pkg)
     free(pkg->sha256sum);
     pkg->sha256sum = NULL;
 
-    free(pkg->priority);
+    /* interned, owned by pkg_str_pool */
     pkg->priority = NULL;
 
-    free(pkg->source);
+    /* interned, owned by pkg_str_pool */
     pkg->source = NULL;
 
     conffile_list_deinit(&pkg->conffiles);
@@ -250,55 +255,39 @@ void pkg_deinit(pkg_t * pkg)
     if (opkg_config->verbose_status_file)
         nv_pair_list_deinit(&pkg->userfields);
 
+    /* interned, owned by pkg_str_pool */
+    pkg->stanza_file = NULL;
+
     /* XXX: QUESTION: Is forcing this to 1 correct? I suppose so,
      * since if they are calling deinit, they should know. Maybe do an
      * assertion here instead? */
     pkg->installed_files_ref_cnt = 1;
     pkg_free_installed_files(pkg);
+    while (pkg->owned_files)
+        file_node_set_owner(pkg->owned_files, NULL);
     pkg->essential = 0;
 
-    free(pkg->tags);
+    /* interned, owned by pkg_str_pool */
     pkg->tags = NULL;
 }
 
 int pkg_init_from_file(pkg_t * pkg, const char *filename)
 {
-    int fd, err = 0;
-    FILE *control_file;
-    char *control_path, *tmp;
+    int err;
+    char *control;
+    size_t len;
 
     pkg_init(pkg);
 
     pkg->local_filename = xstrdup(filename);
 
-    tmp = xstrdup(filename);
-    sprintf_alloc(&control_path, "%s/%s.control.XXXXXX", opkg_config->tmp_dir,
-                  basename(tmp));
-    free(tmp);
-    fd = mkstemp(control_path);
-    if (fd == -1) {
-        opkg_perror(ERROR, "Failed to make temp file %s", control_path);
-        err = -1;
-        goto err0;
-    }
-
-    control_file = fdopen(fd, "r+");
-    if (control_file == NULL) {
-        opkg_perror(ERROR, "Failed to fdopen %s", control_path);
-        close(fd);
-        err = -1;
-        goto err1;
-    }
-
-    err = pkg_extract_control_file_to_stream(pkg, control_file);
-    if (err) {
+    control = pkg_extract_control_file_to_buffer(pkg, &len);
+    if (control == NULL) {
         opkg_msg(ERROR, "Failed to extract control file from %s.\n", filename);
-        goto err2;
+        return -1;
     }
 
-    rewind(control_file);
-
-    err = pkg_parse_from_stream(pkg, control_file, 0);
+    err = pkg_parse_from_buffer(pkg, control, len, 0);
     if (err) {
         if (err == 1) {
             opkg_msg(ERROR, "Malformed package file %s.\n", filename);
@@ -306,12 +295,7 @@ int pkg_init_from_file(pkg_t * pkg, const char *filename)
         err = -1;
     }
 
- err2:
-    fclose(control_file);
- err1:
-    unlink(control_path);
- err0:
-    free(control_path);
+    free(control);
 
     return err;
 }
@@ -331,15 +315,20 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg)
     if (!oldpkg->dest)
         oldpkg->dest = newpkg->dest;
     if (!oldpkg->architecture)
-        oldpkg->architecture = xstrdup(newpkg->architecture);
+        oldpkg->architecture = newpkg->architecture;
     if (!oldpkg->arch_priority)
         oldpkg->arch_priority = newpkg->arch_priority;
     if (!oldpkg->section)
-        oldpkg->section = xstrdup(newpkg->section);
+        oldpkg->section = newpkg->section;
     if (!oldpkg->maintainer)
-        oldpkg->maintainer = xstrdup(newpkg->maintainer);
+        oldpkg->maintainer = newpkg->maintainer;
     if (!oldpkg->description)
         oldpkg->description = xstrdup(newpkg->description);
+    /* Cold fields newpkg has not read yet only fill in those oldpkg lacks. */
+    if (!oldpkg->stanza_file) {
+        oldpkg->stanza_file = newpkg->stanza_file;
+        oldpkg->stanza_offset = newpkg->stanza_offset;
+    }
 
     if (!oldpkg->depends_count && !oldpkg->pre_depends_count
         && !oldpkg->recommends_count && !oldpkg->suggests_count) {
@@ -363,7 +352,6 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg)
         oldpkg->provides_count = newpkg->provides_count;
         newpkg->provides_count = 0;
 
-        free(oldpkg->provides);
         oldpkg->provides = newpkg->provides;
         newpkg->provides = NULL;
     }
@@ -399,7 +387,7 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg)
     if (!oldpkg->installed_size)
         oldpkg->installed_size = newpkg->installed_size;
     if (!oldpkg->priority)
-        oldpkg->priority = xstrdup(newpkg->priority);
+        oldpkg->priority = newpkg->priority;
 
     if (opkg_config->verbose_status_file) {
         if (nv_pair_list_empty(&oldpkg->userfields)) {
@@ -408,7 +396,7 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg)
     }
 
     if (!oldpkg->source)
-        oldpkg->source = xstrdup(newpkg->source);
+        oldpkg->source = newpkg->source;
 
     if (nv_pair_list_empty(&oldpkg->conffiles)) {
         list_splice_init(&newpkg->conffiles.head, &oldpkg->conffiles.head);
@@ -855,6 +843,8 @@ pkg_state_status_t pkg_state_status_from_str(const char *str)
 
 void pkg_formatted_info(FILE * fp, pkg_t * pkg, const char *fields_filter)
 {
+    pkg_hash_load_cold_fields(pkg);
+
     pkg_formatted_field(fp, pkg, "Package", NULL);
     pkg_formatted_field(fp, pkg, "Version", fields_filter);
     pkg_formatted_field(fp, pkg, "Depends", fields_filter);
@@ -893,6 +883,9 @@ void pkg_print_status(pkg_t * pkg, FILE * file)
             || pkg->state_status == SS_UNPACKED
             || pkg->state_status == SS_HALF_INSTALLED);
 
+    if (opkg_config->verbose_status_file)
+        pkg_hash_load_cold_fields(pkg);
+
     pkg_formatted_field(file, pkg, "Package", NULL);
     pkg_formatted_field(file, pkg, "Version", NULL);
     pkg_formatted_field(file, pkg, "Depends", NULL);
@@ -1105,17 +1098,35 @@ char *pkg_version_str_alloc(pkg_t * pkg)
     return version;
 }
 
-/*
- * XXX: this should be broken into two functions
- */
+/* Adds a file of the data archive of a package that isn't installed yet to
+ * its installed_files. */
+static int pkg_append_data_file(const char *path, mode_t mode,
+                                const char *link_target, void *data)
+{
+    pkg_t *pkg = data;
+    char *installed_file_name;
+
+    if (*path == '.') {
+        path++;
+    }
+    if (*path == '/') {
+        path++;
+    }
+    sprintf_alloc(&installed_file_name, "%s%s", pkg->dest->root_dir, path);
+    file_list_append(pkg->installed_files, installed_file_name, mode,
+                     (char *)link_target);
+    free(installed_file_name);
+
+    return 0;
+}
+
 file_list_t *pkg_get_installed_files(pkg_t * pkg)
 {
-    int err, fd;
+    int err;
     char *list_file_name = NULL;
     FILE *list_file = NULL;
     char *line;
     char *installed_file_name;
-    int list_from_package;
 
     pkg->installed_files_ref_cnt++;
 
@@ -1129,60 +1140,31 @@ file_list_t *pkg_get_installed_files(pkg_t * pkg)
      * For installed packages, look at the package.list file in the database.
      * For uninstalled packages, get the file list directly from the package.
      */
-    if (pkg->state_status == SS_NOT_INSTALLED || pkg->dest == NULL)
-        list_from_package = 1;
-    else
-        list_from_package = 0;
-
-    if (list_from_package) {
+    if (pkg->state_status == SS_NOT_INSTALLED || pkg->dest == NULL) {
         if (pkg->local_filename == NULL) {
             return pkg->installed_files;
         }
-        /* XXX: CLEANUP: Maybe rewrite this to avoid using a temporary
-         * file. In other words, change deb_extract so that it can
-         * simply return the file list as a char *[] rather than
-         * insisting on writing it to a FILE * as it does now. */
-        sprintf_alloc(&list_file_name, "%s/%s.list.XXXXXX",
-                      opkg_config->tmp_dir, pkg->name);
-        fd = mkstemp(list_file_name);
-        if (fd == -1) {
-            opkg_perror(ERROR, "Failed to make temp file %s.", list_file_name);
-            free(list_file_name);
-            return pkg->installed_files;
-        }
-        list_file = fdopen(fd, "r+");
-        if (list_file == NULL) {
-            opkg_perror(ERROR, "Failed to fdopen temp file %s.",
-                        list_file_name);
-            close(fd);
-            unlink(list_file_name);
-            free(list_file_name);
-            return pkg->installed_files;
-        }
-        err = pkg_extract_data_file_names_to_stream(pkg, list_file);
+        err = pkg_extract_data_file_names(pkg, pkg_append_data_file, pkg);
         if (err) {
             opkg_msg(ERROR, "Error extracting file list from %s.\n",
                      pkg->local_filename);
-            fclose(list_file);
-            unlink(list_file_name);
-            free(list_file_name);
             file_list_deinit(pkg->installed_files);
             pkg->installed_files = NULL;
             return NULL;
         }
-        rewind(list_file);
-    } else {
-        sprintf_alloc(&list_file_name, "%s/%s.list", pkg->dest->info_dir,
-                      pkg->name);
-        list_file = fopen(list_file_name, "r");
-        if (list_file == NULL) {
-            if (pkg->state_status != SS_HALF_INSTALLED)
-                opkg_perror(ERROR, "Failed to open %s", list_file_name);
-            free(list_file_name);
-            return pkg->installed_files;
-        }
+        return pkg->installed_files;
+    }
+
+    sprintf_alloc(&list_file_name, "%s/%s.list", pkg->dest->info_dir,
+                  pkg->name);
+    list_file = fopen(file_commit_path(list_file_name), "r");
+    if (list_file == NULL) {
+        if (pkg->state_status != SS_HALF_INSTALLED)
+            opkg_perror(ERROR, "Failed to open %s", list_file_name);
         free(list_file_name);
+        return pkg->installed_files;
     }
+    free(list_file_name);
 
     while (1) {
         char *file_name;
@@ -1190,6 +1172,8 @@ file_list_t *pkg_get_installed_files(pkg_t * pkg)
         mode_t mode = 0;
         char *link_target = NULL;
         char *readlink_buf = NULL;
+        struct stat file_stat;
+        int unmatched_offline_root;
 
         line = file_read_line_alloc(list_file);
         if (line == NULL) {
@@ -1207,31 +1191,19 @@ file_list_t *pkg_get_installed_files(pkg_t * pkg)
             mode = (mode_t)strtoul(mode_str, NULL, 0);
         }
 
-        if (list_from_package) {
-            if (*file_name == '.') {
-                file_name++;
-            }
-            if (*file_name == '/') {
-                file_name++;
-            }
-            sprintf_alloc(&installed_file_name, "%s%s", pkg->dest->root_dir,
-                          file_name);
+        unmatched_offline_root = opkg_config->offline_root
+                && !str_starts_with(file_name, opkg_config->offline_root);
+        if (unmatched_offline_root) {
+            sprintf_alloc(&installed_file_name, "%s%s",
+                          opkg_config->offline_root, file_name);
         } else {
-            struct stat file_stat;
-            int unmatched_offline_root = opkg_config->offline_root
-                    && !str_starts_with(file_name, opkg_config->offline_root);
-            if (unmatched_offline_root) {
-                sprintf_alloc(&installed_file_name, "%s%s",
-                              opkg_config->offline_root, file_name);
-            } else {
-                // already contains root_dir as header -> ABSOLUTE
-                sprintf_alloc(&installed_file_name, "%s", file_name);
-            }
-            if (!mode && xlstat(installed_file_name, &file_stat) == 0)
-                mode = file_stat.st_mode;
-            if (!link_target && S_ISLNK(mode))
-                link_target = readlink_buf = file_readlink_alloc(installed_file_name);
+            // already contains root_dir as header -> ABSOLUTE
+            sprintf_alloc(&installed_file_name, "%s", file_name);
         }
+        if (!mode && xlstat(installed_file_name, &file_stat) == 0)
+            mode = file_stat.st_mode;
+        if (!link_target && S_ISLNK(mode))
+            link_target = readlink_buf = file_readlink_alloc(installed_file_name);
         file_list_append(pkg->installed_files, installed_file_name, mode, link_target);
         free(installed_file_name);
         free(readlink_buf);
@@ -1240,11 +1212,6 @@ file_list_t *pkg_get_installed_files(pkg_t * pkg)
 
     fclose(list_file);
 
-    if (list_from_package) {
-        unlink(list_file_name);
-        free(list_file_name);
-    }
-
     return pkg->installed_files;
 }
 
@@ -1274,8 +1241,11 @@ void pkg_remove_installed_files_list(pkg_t * pkg)
     sprintf_alloc(&list_file_name, "%s/%s.list", pkg->dest->info_dir,
                   pkg->name);
 
-    if (!opkg_config->noaction)
+    if (!opkg_config->noaction) {
+        file_commit_cancel(list_file_name);
         (void)unlink(list_file_name);
+        file_index_list_changed(0);
+    }
 
     free(list_file_name);
 }
@@ -1365,18 +1335,16 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
 
 int pkg_arch_supported(pkg_t * pkg)
 {
-    nv_pair_list_elt_t *l;
+    nv_pair_t *nv;
 
     if (!pkg->architecture)
         return 1;
 
-    list_for_each_entry(l, &opkg_config->arch_list.head, node) {
-        nv_pair_t *nv = (nv_pair_t *) l->data;
-        if (strcmp(nv->name, pkg->architecture) == 0) {
-            opkg_msg(DEBUG, "Arch %s (priority %s) supported for pkg %s.\n",
-                     nv->name, nv->value, pkg->name);
-            return 1;
-        }
+    nv = hash_table_get(&opkg_config->arch_hash, pkg->architecture);
+    if (nv) {
+        opkg_msg(DEBUG, "Arch %s (priority %s) supported for pkg %s.\n",
+                 nv->name, nv->value, pkg->name);
+        return 1;
     }
 
     opkg_msg(DEBUG, "Arch %s unsupported for pkg %s.\n", pkg->architecture,
@@ -1394,8 +1362,13 @@ void pkg_info_preinstall_check(void)
     pkg_hash_fetch_all_installed(installed_pkgs, INSTALLED);
     for (i = 0; i < installed_pkgs->len; i++) {
         pkg_t *pkg = installed_pkgs->pkgs[i];
-        file_list_t *installed_files = pkg_get_installed_files(pkg);    /* this causes installed_files to be cached */
+        file_list_t *installed_files;
         file_list_elt_t *iter, *niter;
+
+        if (opkg_config->file_index && file_index_load_pkg(pkg) == 0)
+            continue;
+
+        installed_files = pkg_get_installed_files(pkg);  /* this causes installed_files to be cached */
         if (installed_files == NULL) {
             opkg_msg(ERROR,
                      "Failed to determine installed " "files for pkg %s.\n",
@@ -1410,84 +1383,83 @@ void pkg_info_preinstall_check(void)
         }
         pkg_free_installed_files(pkg);
     }
+    if (i == installed_pkgs->len)
+        file_index_loaded();
     pkg_vec_free(installed_pkgs);
 }
 
-struct pkg_write_filelist_data {
-    pkg_t *pkg;
-    FILE *stream;
-};
-
-static void pkg_write_filelist_helper(const char *key, void *entry_,
-                                      void *data_)
+static void pkg_write_filelist_helper(file_node_t * node, FILE * stream)
 {
-    struct pkg_write_filelist_data *data = data_;
-    pkg_t *entry = entry_;
-    if (entry == data->pkg) {
-        char *installed_file_name;
-        struct stat file_stat;
-        mode_t mode = 0;
-        char *link_target = NULL;
-        size_t size;
-        int unmatched_offline_root = opkg_config->offline_root
-                && !str_starts_with(key, opkg_config->offline_root);
-        char *entry = xstrdup(key);
-
-        size = strlen(entry);
-        if (size > 0 && entry[size-1] == '/')
-            entry[size-1] = '\0';
-
-        if (unmatched_offline_root) {
-            sprintf_alloc(&installed_file_name, "%s%s",
-                          opkg_config->offline_root, entry);
-        } else {
-            // already contains root_dir as header -> ABSOLUTE
-            sprintf_alloc(&installed_file_name, "%s", entry);
-        }
+    char *installed_file_name;
+    struct stat file_stat;
+    mode_t mode = 0;
+    char *link_target = NULL;
+    char *entry = file_node_path_alloc(node);
+    int unmatched_offline_root = opkg_config->offline_root
+            && !str_starts_with(entry, opkg_config->offline_root);
+    size_t size;
+
+    size = strlen(entry);
+    if (size > 0 && entry[size-1] == '/')
+        entry[size-1] = '\0';
+
+    if (unmatched_offline_root) {
+        sprintf_alloc(&installed_file_name, "%s%s",
+                      opkg_config->offline_root, entry);
+    } else {
+        // already contains root_dir as header -> ABSOLUTE
+        sprintf_alloc(&installed_file_name, "%s", entry);
+    }
 
-        if (xlstat(installed_file_name, &file_stat) == 0) {
-            mode = file_stat.st_mode;
-            if (S_ISLNK(mode))
-                link_target = file_readlink_alloc(installed_file_name);
-        }
+    if (xlstat(installed_file_name, &file_stat) == 0) {
+        mode = file_stat.st_mode;
+        if (S_ISLNK(mode))
+            link_target = file_readlink_alloc(installed_file_name);
+    }
 
-        if (link_target)
-            fprintf(data->stream, "%s\t%#03o\t%s\n", entry, (unsigned int)mode, link_target);
-        else if (mode)
-            fprintf(data->stream, "%s\t%#03o\n", entry, (unsigned int)mode);
-        else
-            fprintf(data->stream, "%s\n", entry);
+    if (link_target)
+        fprintf(stream, "%s\t%#03o\t%s\n", entry, (unsigned int)mode, link_target);
+    else if (mode)
+        fprintf(stream, "%s\t%#03o\n", entry, (unsigned int)mode);
+    else
+        fprintf(stream, "%s\n", entry);
 
-        free(entry);
-        free(link_target);
-        free(installed_file_name);
-    }
+    free(entry);
+    free(link_target);
+    free(installed_file_name);
 }
 
 int pkg_write_filelist(pkg_t * pkg)
 {
-    struct pkg_write_filelist_data data;
+    FILE *stream;
     char *list_file_name;
+    file_node_t *node;
 
     sprintf_alloc(&list_file_name, "%s/%s.list", pkg->dest->info_dir,
                   pkg->name);
 
     opkg_msg(INFO, "Creating %s file for pkg %s.\n", list_file_name, pkg->name);
 
-    data.stream = fopen(list_file_name, "w");
-    if (!data.stream) {
+    stream = file_commit_open(list_file_name);
+    if (!stream) {
         opkg_perror(ERROR, "Failed to open %s", list_file_name);
         free(list_file_name);
+        file_index_list_changed(-1);
         return -1;
     }
 
-    data.pkg = pkg;
-    hash_table_foreach(&opkg_config->file_hash, pkg_write_filelist_helper,
-                       &data);
-    fclose(data.stream);
+    for (node = pkg->owned_files; node; node = node->owned_next)
+        pkg_write_filelist_helper(node, stream);
+    if (file_commit_close(stream) != 0) {
+        opkg_perror(ERROR, "Failed to write %s", list_file_name);
+        free(list_file_name);
+        file_index_list_changed(-1);
+        return -1;
+    }
     free(list_file_name);
 
     pkg->state_flag &= ~SF_FILELIST_CHANGED;
+    file_index_list_changed(0);
 
     return 0;
 }
@@ -1590,6 +1562,7 @@ int pkg_verify(pkg_t * pkg)
 	opkg_msg(NOTICE, "Removing corrupt package file %s.\n",
              pkg->local_filename);
 	unlink(pkg->local_filename);
+	opkg_checksum_forget(pkg->local_filename);
 	return err;
     }
     else
@@ -36,6 +36,7 @@ extern "C" {
 #endif
 
 struct opkg_config;
+struct opkg_ar_index;
 
 #define ARRAY_SIZE(array) sizeof(array) / sizeof((array)[0])
 
@@ -106,13 +107,10 @@ struct abstract_pkg {
    Pre-Depends, Provides, Suggests, Recommends, Enhances), should each
    be handled by a single struct in pkg_t
 
-   All string fields for which there is a small set of possible
-   values, (section, maintainer, architecture, maybe version?), that
-   are reused among different packages -- for all such packages we
-   should move from "char *"s to some atom datatype to share data
-   storage and use less memory. We might even do reference counting,
-   but probably not since most often we only create new pkg_t structs,
-   we don't often free them.  */
+   String fields for which there is a small set of possible values
+   (architecture, section, maintainer, priority, source, tags) are
+   interned with pkg_hash_intern(): packages share one copy per value
+   and the strings can be compared by pointer. Maybe version too?  */
 struct pkg {
     char *name;
     unsigned long epoch;
@@ -121,11 +119,11 @@ struct pkg {
     int force_reinstall;
     pkg_src_t *src;
     pkg_dest_t *dest;
-    char *architecture;
-    char *section;
-    char *maintainer;
+    const char *architecture;
+    const char *section;
+    const char *maintainer;
     char *description;
-    char *tags;
+    const char *tags;
     pkg_state_want_t state_want;
     pkg_vec_t *wanted_by;
     pkg_state_flag_t state_flag;
@@ -157,15 +155,22 @@ struct pkg {
 
     char *filename;
     char *local_filename;
+    /* The members of local_filename, see pkg_extract.c. */
+    struct opkg_ar_index *ar_index;
     char *tmp_unpack_dir;
     char *md5sum;
     char *sha256sum;
     unsigned long size;     /* in bytes */
     unsigned long installed_size;   /* in bytes */
-    char *priority;
-    char *source;
+    const char *priority;
+    const char *source;
     conffile_list_t conffiles;
     nv_pair_list_t userfields;
+    /* Where the stanza of a package from a feed list starts. Set until its
+     * cold fields (PFM_COLD and user fields) have been read, see
+     * pkg_hash_load_cold_fields(). */
+    const char *stanza_file;
+    off_t stanza_offset;
     time_t installed_time;
     /* As pointer for lazy evaluation */
     file_list_t *installed_files;
@@ -174,6 +179,10 @@ struct pkg {
      * installed_files list was being freed from an inner loop while
      * still being used within an outer loop. */
     int installed_files_ref_cnt;
+    /* The files file_hash says this package owns, linked through
+     * owned_next, so that its filelist can be written without walking
+     * file_hash. */
+    file_node_t *owned_files;
     int essential;
     int arch_priority;
     /* Adding this flag, to "force" opkg to choose a "provided_by_hand"
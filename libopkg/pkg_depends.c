@@ -107,7 +107,7 @@ int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg)
     for (i = 0; i < vec->len; i++) {
         int match = (strcmp(pkg->name, pkgs[i]->name) == 0)
                 && (pkg_compare_versions(pkg, pkgs[i]) == 0)
-                && (strcmp(pkg->architecture, pkgs[i]->architecture) == 0);
+                && (pkg->architecture == pkgs[i]->architecture);
         if (match)
             return 1;
     }
@@ -256,7 +256,7 @@ void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg)
     pkg->provides_count++;
     if (!abstract_pkg_vec_contains(ab_pkg->provided_by, ab_pkg))
         abstract_pkg_vec_insert(ab_pkg->provided_by, ab_pkg);
-    pkg->provides = xcalloc(pkg->provides_count, sizeof(abstract_pkg_t *));
+    pkg->provides = pkg_hash_alloc(pkg->provides_count, sizeof(abstract_pkg_t *));
     pkg->provides[0] = ab_pkg;
 
     for (i = 1; i < pkg->provides_count; i++) {
@@ -270,6 +270,7 @@ void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg)
         abstract_pkg_vec_insert(provided_abpkg->provided_by, ab_pkg);
     }
     free(pkg->provides_str);
+    pkg->provides_str = NULL;
 }
 
 void buildConflicts(pkg_t * pkg)
@@ -280,7 +281,7 @@ void buildConflicts(pkg_t * pkg)
     if (!pkg->conflicts_count)
         return;
 
-    conflicts = pkg->conflicts = xcalloc(pkg->conflicts_count,
+    conflicts = pkg->conflicts = pkg_hash_alloc(pkg->conflicts_count,
             sizeof(compound_depend_t));
     for (i = 0; i < pkg->conflicts_count; i++) {
         parseDepends(conflicts, pkg->conflicts_str[i]);
@@ -289,6 +290,7 @@ void buildConflicts(pkg_t * pkg)
         conflicts++;
     }
     free(pkg->conflicts_str);
+    pkg->conflicts_str = NULL;
 }
 
 void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
@@ -299,7 +301,7 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
     if (!pkg->replaces_count)
         return;
 
-    replaces = pkg->replaces = xcalloc(pkg->replaces_count,
+    replaces = pkg->replaces = pkg_hash_alloc(pkg->replaces_count,
             sizeof(compound_depend_t));
 
     for (i = 0; i < pkg->replaces_count; i++) {
@@ -322,6 +324,7 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
         replaces++;
     }
     free(pkg->replaces_str);
+    pkg->replaces_str = NULL;
 }
 
 void buildDepends(pkg_t * pkg)
@@ -335,7 +338,7 @@ void buildDepends(pkg_t * pkg)
     if (!count)
         return;
 
-    depends = pkg->depends = xcalloc(count, sizeof(compound_depend_t));
+    depends = pkg->depends = pkg_hash_alloc(count, sizeof(compound_depend_t));
 
     for (i = 0; i < pkg->pre_depends_count; i++) {
         parseDepends(depends, pkg->pre_depends_str[i]);
@@ -344,6 +347,7 @@ void buildDepends(pkg_t * pkg)
         depends++;
     }
     free(pkg->pre_depends_str);
+    pkg->pre_depends_str = NULL;
 
     for (i = 0; i < pkg->depends_count; i++) {
         parseDepends(depends, pkg->depends_str[i]);
@@ -351,6 +355,7 @@ void buildDepends(pkg_t * pkg)
         depends++;
     }
     free(pkg->depends_str);
+    pkg->depends_str = NULL;
 
     for (i = 0; i < pkg->recommends_count; i++) {
         parseDepends(depends, pkg->recommends_str[i]);
@@ -359,6 +364,7 @@ void buildDepends(pkg_t * pkg)
         depends++;
     }
     free(pkg->recommends_str);
+    pkg->recommends_str = NULL;
 
     for (i = 0; i < pkg->suggests_count; i++) {
         parseDepends(depends, pkg->suggests_str[i]);
@@ -367,6 +373,7 @@ void buildDepends(pkg_t * pkg)
         depends++;
     }
     free(pkg->suggests_str);
+    pkg->suggests_str = NULL;
 }
 
 const char *constraint_to_str(version_constraint_t c)
@@ -532,7 +539,7 @@ void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
 
 static depend_t *depend_init(void)
 {
-    depend_t *d = xcalloc(1, sizeof(depend_t));
+    depend_t *d = pkg_hash_alloc(1, sizeof(depend_t));
     d->constraint = NONE;
     d->version = NULL;
     d->pkg = NULL;
@@ -543,7 +550,7 @@ static depend_t *depend_init(void)
 static int parseDepends(compound_depend_t * compound_depend,
                         const char *depend_str)
 {
-    char *pkg_name, buffer[2048];
+    char buffer[2048];
     unsigned int num_of_ors = 0;
     unsigned int i;
     const char *src;
@@ -559,7 +566,7 @@ static int parseDepends(compound_depend_t * compound_depend,
     compound_depend->type = DEPEND;
 
     compound_depend->possibility_count = num_of_ors + 1;
-    possibilities = xcalloc((num_of_ors + 1), sizeof(depend_t *));
+    possibilities = pkg_hash_alloc((num_of_ors + 1), sizeof(depend_t *));
     compound_depend->possibilities = possibilities;
 
     src = depend_str;
@@ -571,7 +578,9 @@ static int parseDepends(compound_depend_t * compound_depend,
                && (*src != '|'))
             *dest++ = *src++;
         *dest = '\0';
-        pkg_name = trim_xstrdup(buffer);
+
+        /* hook up the dependency to its abstract pkg */
+        possibilities[i]->pkg = ensure_abstract_pkg_by_name(buffer);
 
         /* now look at possible version info */
 
@@ -593,14 +602,12 @@ static int parseDepends(compound_depend_t * compound_depend,
             dest = buffer;
             while (*src && *src != ')')
                 *dest++ = *src++;
+            while (dest > buffer && isspace(dest[-1]))
+                dest--;
             *dest = '\0';
 
-            possibilities[i]->version = trim_xstrdup(buffer);
+            possibilities[i]->version = pkg_hash_strdup(buffer);
         }
-        /* hook up the dependency to its abstract pkg */
-        possibilities[i]->pkg = ensure_abstract_pkg_by_name(pkg_name);
-
-        free(pkg_name);
 
         /* now get past the ) and any possible | chars */
         while (*src && (isspace(*src) || (*src == ')') || (*src == '|')))
@@ -22,18 +22,54 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "opkg_conf.h"
 #include "opkg_message.h"
 #include "opkg_archive.h"
 #include "pkg_extract.h"
 #include "sprintf_alloc.h"
 
+/* Index the package file once, so that opening its control and data
+ * archives again and again doesn't scan it for them each time. */
+static struct opkg_ar_index *pkg_ar_index(pkg_t * pkg)
+{
+    if (!pkg->local_filename)
+        return NULL;
+
+    if (pkg->ar_index
+            && strcmp(ar_index_filename(pkg->ar_index),
+                      pkg->local_filename) != 0) {
+        ar_index_free(pkg->ar_index);
+        pkg->ar_index = NULL;
+    }
+
+    if (!pkg->ar_index)
+        pkg->ar_index = ar_index_open(pkg->local_filename);
+
+    return pkg->ar_index;
+}
+
+static struct opkg_ar *pkg_open_control_archive(pkg_t * pkg)
+{
+    struct opkg_ar_index *index = pkg_ar_index(pkg);
+
+    return index ? ar_index_open_control(index) : NULL;
+}
+
+static struct opkg_ar *pkg_open_data_archive(pkg_t * pkg)
+{
+    struct opkg_ar_index *index = pkg_ar_index(pkg);
+
+    return index ? ar_index_open_data(index) : NULL;
+}
+
 int pkg_extract_control_file_to_stream(pkg_t * pkg, FILE * stream)
 {
     int r;
     struct opkg_ar *ar;
 
-    ar = ar_open_pkg_control_archive(pkg->local_filename);
+    ar = pkg_open_control_archive(pkg);
     if (!ar) {
         opkg_msg(ERROR, "Failed to extract control.tar.* from package '%s'.\n",
                  pkg->local_filename);
@@ -49,6 +85,27 @@ int pkg_extract_control_file_to_stream(pkg_t * pkg, FILE * stream)
     return r;
 }
 
+char *pkg_extract_control_file_to_buffer(pkg_t * pkg, size_t *len)
+{
+    char *buffer;
+    struct opkg_ar *ar;
+
+    ar = pkg_open_control_archive(pkg);
+    if (!ar) {
+        opkg_msg(ERROR, "Failed to extract control.tar.* from package '%s'.\n",
+                 pkg->local_filename);
+        return NULL;
+    }
+
+    buffer = ar_extract_file_to_buffer(ar, "control", len);
+    if (!buffer)
+        opkg_msg(ERROR, "Failed to extract control file from package '%s'.\n",
+                 pkg->local_filename);
+
+    ar_close(ar);
+    return buffer;
+}
+
 int pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg, const char *dir,
                                                  const char *prefix)
 {
@@ -58,7 +115,7 @@ int pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg, const char *dir,
 
     sprintf_alloc(&dir_with_prefix, "%s/%s", dir, prefix);
 
-    ar = ar_open_pkg_control_archive(pkg->local_filename);
+    ar = pkg_open_control_archive(pkg);
     if (!ar) {
         opkg_msg(ERROR, "Failed to extract control.tar.* from package '%s'.\n",
                  pkg->local_filename);
@@ -83,19 +140,50 @@ int pkg_extract_control_files_to_dir(pkg_t * pkg, const char *dir)
     return pkg_extract_control_files_to_dir_with_prefix(pkg, dir, "");
 }
 
+/* Conffiles are named relative to the offline root, as root_filename_alloc()
+ * expects. Those still without an md5sum get it as they are extracted rather
+ * than by reading them back in resolve_conffiles(). */
+static char **conffile_md5sum_slot(const char *path, void *data)
+{
+    pkg_t *pkg = data;
+    conffile_list_elt_t *iter;
+    conffile_t *cf;
+    const char *offline_root = opkg_config->offline_root;
+
+    if (offline_root) {
+        size_t len = strlen(offline_root);
+        if (strncmp(path, offline_root, len) != 0)
+            return NULL;
+        path += len;
+    }
+
+    for (iter = nv_pair_list_first(&pkg->conffiles); iter;
+            iter = nv_pair_list_next(&pkg->conffiles, iter)) {
+        cf = (conffile_t *) iter->data;
+        if (cf->value == NULL && strcmp(cf->name, path) == 0)
+            return &cf->value;
+    }
+
+    return NULL;
+}
+
 int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir)
 {
     int r;
     struct opkg_ar *ar;
 
-    ar = ar_open_pkg_data_archive(pkg->local_filename);
+    ar = pkg_open_data_archive(pkg);
     if (!ar) {
         opkg_msg(ERROR, "Failed to extract data.tar.* from package '%s'.\n",
                  pkg->local_filename);
         return -1;
     }
 
-    r = ar_extract_all(ar, dir, &pkg->installed_size);
+    if (nv_pair_list_empty(&pkg->conffiles))
+        r = ar_extract_all(ar, dir, &pkg->installed_size);
+    else
+        r = ar_extract_all_md5(ar, dir, &pkg->installed_size,
+                               conffile_md5sum_slot, pkg);
     if (r < 0)
         opkg_msg(ERROR, "Failed to extract data files from package '%s'.\n",
                  pkg->local_filename);
@@ -109,7 +197,7 @@ int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * stream)
     int r;
     struct opkg_ar *ar;
 
-    ar = ar_open_pkg_data_archive(pkg->local_filename);
+    ar = pkg_open_data_archive(pkg);
     if (!ar) {
         opkg_msg(ERROR, "Failed to extract data.tar.* from package '%s'.\n",
                  pkg->local_filename);
@@ -125,3 +213,25 @@ int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * stream)
     ar_close(ar);
     return r;
 }
+
+int pkg_extract_data_file_names(pkg_t * pkg, ar_path_fn fn, void *data)
+{
+    int r;
+    struct opkg_ar *ar;
+
+    ar = pkg_open_data_archive(pkg);
+    if (!ar) {
+        opkg_msg(ERROR, "Failed to extract data.tar.* from package '%s'.\n",
+                 pkg->local_filename);
+        return -1;
+    }
+
+    r = ar_extract_paths(ar, fn, data);
+    if (r < 0)
+        opkg_msg(ERROR,
+                 "Failed to extract data file names from package '%s'.\n",
+                 pkg->local_filename);
+
+    ar_close(ar);
+    return r;
+}
@@ -22,18 +22,22 @@
 #define PKG_EXTRACT_H
 
 #include "pkg.h"
+#include "opkg_archive.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int pkg_extract_control_file_to_stream(pkg_t * pkg, FILE * stream);
+/* Returns the control file in a buffer the caller must free, or NULL. */
+char *pkg_extract_control_file_to_buffer(pkg_t * pkg, size_t *len);
 int pkg_extract_control_files_to_dir(pkg_t * pkg, const char *dir);
 int pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg,
                                                  const char *dir,
                                                  const char *prefix);
 int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir);
 int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * file);
+int pkg_extract_data_file_names(pkg_t * pkg, ar_path_fn fn, void *data);
 
 #ifdef __cplusplus
 }
@@ -22,15 +22,25 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "hash_table.h"
+#include "file_tree.h"
 #include "release.h"
 #include "pkg.h"
 #include "opkg_message.h"
 #include "opkg_archive.h"
 #include "pkg_vec.h"
 #include "pkg_hash.h"
+#include "pkg_index.h"
 #include "parse_util.h"
 #include "pkg_parse.h"
 #include "opkg_utils.h"
@@ -64,18 +74,61 @@ static void free_pkgs(const char *key, void *entry, void *data)
     free(ab_pkg);
 }
 
-static int pkg_hash_add_from_file(const char *file_name, pkg_src_t * src,
-                           pkg_dest_t * dest, int is_status_file)
+typedef void (*pkg_hash_parse_fn_t) (pkg_t * pkg, void *data);
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t pkg_hash_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Set while pkg_hash_load_feeds() has parser threads running. */
+static int pkg_hash_threaded;
+
+void pkg_hash_lock(void)
+{
+    if (pkg_hash_threaded)
+        pthread_mutex_lock(&pkg_hash_mutex);
+}
+
+void pkg_hash_unlock(void)
+{
+    if (pkg_hash_threaded)
+        pthread_mutex_unlock(&pkg_hash_mutex);
+}
+#else
+void pkg_hash_lock(void)
+{
+}
+
+void pkg_hash_unlock(void)
+{
+}
+#endif
+
+#define PKG_HASH_PARSE_CHUNK (1024 * 1024)
+
+/* The feed list pkg_hash_load_cold_fields() last read from. */
+static FILE *cold_fp;
+static const char *cold_file;
+
+/*
+ * Parse every stanza of file_name and hand the resulting packages over to fn.
+ * If lazy is set, the cold fields of the packages are left in the file.
+ * Fields in mask are skipped.
+ *
+ * The list is mapped, or decompressed into memory, and parsed in place.
+ */
+static int pkg_hash_parse_file(const char *file_name, int is_status_file,
+                               int lazy, uint mask, pkg_hash_parse_fn_t fn,
+                               void *data)
 {
     pkg_t *pkg;
-    FILE *fp = NULL;
-    char *buf = NULL, *bp = NULL;
-    const size_t len = 4096;
+    const char *stanza_file = NULL;
+    const char *start, *p, *end, *done;
+    char *bp = NULL;
+    void *map = NULL;
+    size_t size = 0;
     int ret = 0;
 
     if (opkg_config->compress_list_files  && !is_status_file) {
         struct opkg_ar *ar;
-        size_t size;
 
         ar = ar_open_compressed_file(file_name);
         if (!ar)
@@ -83,40 +136,62 @@ static int pkg_hash_add_from_file(const char *file_name, pkg_src_t * src,
 
         FILE *mfp = open_memstream(&bp, &size);
 
-        if (ar_copy_to_stream(ar, mfp) < 0) {
-            opkg_perror(ERROR, "Failed to open %s", file_name);
-            ret = -1;
-            goto cleanup;
-        }
+        ret = ar_copy_to_stream(ar, mfp);
         fclose(mfp);
-
-        fp = fmemopen(bp, size, "r");
-        if (fp == NULL) {
-            opkg_perror(ERROR, "Failed to open memory buffer: %s\n", strerror(errno));
+        ar_close(ar);
+        if (ret < 0) {
+            opkg_perror(ERROR, "Failed to open %s", file_name);
             ret = -1;
             goto cleanup;
         }
+        ret = 0;
+        start = bp;
     } else {
-        fp = fopen(file_name, "r");
-        if (fp == NULL) {
+        struct stat st;
+        int fd;
+
+        fd = open(file_name, O_RDONLY);
+        if (fd < 0) {
             opkg_perror(ERROR, "Failed to open %s", file_name);
-            ret = -1;
-            goto cleanup;
+            return -1;
+        }
+        if (fstat(fd, &st) < 0) {
+            opkg_perror(ERROR, "Failed to stat %s", file_name);
+            close(fd);
+            return -1;
+        }
+        size = st.st_size;
+        if (size) {
+            map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                opkg_perror(ERROR, "Failed to mmap %s", file_name);
+                close(fd);
+                return -1;
+            }
+            madvise(map, size, MADV_SEQUENTIAL);
         }
+        close(fd);
+        start = map;
+
+        if (lazy)
+            stanza_file = pkg_hash_intern(file_name);
     }
 
-    /* Remove UTF-8 BOM if present */
-    if (!(getc(fp) == 0xEF && getc(fp) == 0xBB && getc(fp) == 0xBF))
-        rewind(fp);
+    p = done = start;
+    end = start + size;
 
-    buf = xmalloc(len);
+    /* Remove UTF-8 BOM if present */
+    if (size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+        p += 3;
 
-    do {
+    while (p < end) {
         pkg = pkg_new();
-        pkg->src = src;
-        pkg->dest = dest;
+        if (stanza_file) {
+            pkg->stanza_file = stanza_file;
+            pkg->stanza_offset = p - start;
+        }
 
-        ret = parse_from_stream_nomalloc(pkg_parse_line, pkg, fp, 0, &buf, len);
+        ret = parse_from_buffer(pkg_parse_field, pkg, &p, end, mask);
         if (pkg->name == NULL) {
             /* probably just a blank line */
             ret = 1;
@@ -132,41 +207,130 @@ static int pkg_hash_add_from_file(const char *file_name, pkg_src_t * src,
             continue;
         }
 
-        if (!pkg->architecture) {
-            char *version_str = pkg_version_str_alloc(pkg);
-            opkg_msg(NOTICE,
-                     "Package %s version %s has no "
-                     "valid architecture, ignoring.\n", pkg->name, version_str);
-            free(version_str);
-            pkg_deinit(pkg);
-            free(pkg);
-            continue;
-        }
-        if (!pkg->arch_priority) {
-            char *version_str = pkg_version_str_alloc(pkg);
-            opkg_msg(DEBUG,
-                     "Package %s version %s is built for architecture %s "
-                     "which cannot be installed here, ignoring.\n", pkg->name,
-                     version_str, pkg->architecture);
-            free(version_str);
-            pkg_deinit(pkg);
-            free(pkg);
-            continue;
-        }
+        fn(pkg, data);
 
-        hash_insert_pkg(pkg, is_status_file);
-
-    } while (!feof(fp));
+        /* The pages parsed so far are clean, don't let them pile up. */
+        if (map && p - done >= PKG_HASH_PARSE_CHUNK) {
+            size_t n = (p - done) & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+            madvise((void *)done, n, MADV_DONTNEED);
+            done += n;
+        }
+    }
 
 cleanup:
-    free(buf);
-    if (fp)
-        fclose(fp);
+    if (map)
+        munmap(map, size);
     free(bp);
 
     return ret;
 }
 
+struct pkg_hash_add_ctx {
+    pkg_src_t *src;
+    pkg_dest_t *dest;
+    int is_status_file;
+};
+
+static void pkg_hash_add_pkg(pkg_t * pkg, void *data)
+{
+    struct pkg_hash_add_ctx *ctx = (struct pkg_hash_add_ctx *)data;
+
+    pkg->src = ctx->src;
+    pkg->dest = ctx->dest;
+
+    if (!pkg->architecture) {
+        char *version_str = pkg_version_str_alloc(pkg);
+        opkg_msg(NOTICE,
+                 "Package %s version %s has no "
+                 "valid architecture, ignoring.\n", pkg->name, version_str);
+        free(version_str);
+        pkg_deinit(pkg);
+        free(pkg);
+        return;
+    }
+    if (!pkg->arch_priority) {
+        char *version_str = pkg_version_str_alloc(pkg);
+        opkg_msg(DEBUG,
+                 "Package %s version %s is built for architecture %s "
+                 "which cannot be installed here, ignoring.\n", pkg->name,
+                 version_str, pkg->architecture);
+        free(version_str);
+        pkg_deinit(pkg);
+        free(pkg);
+        return;
+    }
+
+    hash_insert_pkg(pkg, ctx->is_status_file);
+}
+
+static void pkg_hash_index_pkg(pkg_t * pkg, void *data)
+{
+    pkg_index_writer_add((pkg_index_writer_t *) data, pkg);
+    pkg_deinit(pkg);
+    free(pkg);
+}
+
+static int pkg_hash_index_flags(int is_status_file)
+{
+    /* The status file is rewritten in place, so a same-sized rewrite within
+     * one mtime tick must not go unnoticed. */
+    return is_status_file ? PKG_INDEX_CHECKSUM : 0;
+}
+
+/*
+ * Write the binary index of a feed list or status file.
+ */
+int pkg_hash_index_file(const char *file_name, int is_status_file)
+{
+    pkg_index_writer_t *writer;
+    int r;
+
+    writer = pkg_index_writer_new(file_name,
+                                  pkg_hash_index_flags(is_status_file));
+    if (!writer)
+        return -1;
+
+    /* The index must hold every field, whatever the current command masks. */
+    r = pkg_hash_parse_file(file_name, is_status_file, 0, 0,
+                            pkg_hash_index_pkg, writer);
+
+    return pkg_index_writer_close(writer, r == 0);
+}
+
+/*
+ * Read the packages of a feed list or status file, from its index if there is
+ * one, and hand them over to fn.
+ */
+static int pkg_hash_read_file(const char *file_name, int is_status_file,
+                              pkg_hash_parse_fn_t fn, void *data)
+{
+    int flags = pkg_hash_index_flags(is_status_file);
+    int r;
+
+    if (is_status_file ? opkg_config->status_snapshot
+            : opkg_config->feed_index) {
+        r = pkg_index_foreach(file_name, flags, fn, data);
+        if (r == 1 && pkg_hash_index_file(file_name, is_status_file) == 0)
+            r = pkg_index_foreach(file_name, flags, fn, data);
+        if (r == 0)
+            return 0;
+    }
+
+    /* The status file is rewritten while its packages are alive, so only
+     * feed lists can be read lazily. */
+    return pkg_hash_parse_file(file_name, is_status_file, !is_status_file,
+                               opkg_config->pfm, fn, data);
+}
+
+static int pkg_hash_add_from_file(const char *file_name, pkg_src_t * src,
+                           pkg_dest_t * dest, int is_status_file)
+{
+    struct pkg_hash_add_ctx ctx = { src, dest, is_status_file };
+
+    return pkg_hash_read_file(file_name, is_status_file, pkg_hash_add_pkg,
+                              &ctx);
+}
+
 static int dist_hash_add_from_file(pkg_src_t * dist)
 {
     nv_pair_list_elt_t *l;
@@ -202,12 +366,275 @@ void pkg_hash_init(void)
 {
     hash_table_init("pkg-hash", &opkg_config->pkg_hash,
                     OPKG_CONF_DEFAULT_HASH_LEN);
+    hash_table_init("pkg-str-pool", &opkg_config->pkg_str_pool, 256);
+    arena_init("pkg-arena", &opkg_config->pkg_arena, 64 * 1024);
 }
 
 void pkg_hash_deinit(void)
 {
     hash_table_foreach(&opkg_config->pkg_hash, free_pkgs, NULL);
     hash_table_deinit(&opkg_config->pkg_hash);
+    hash_table_deinit(&opkg_config->pkg_str_pool);
+    arena_deinit(&opkg_config->pkg_arena);
+
+    if (cold_fp) {
+        fclose(cold_fp);
+        cold_fp = NULL;
+        cold_file = NULL;
+    }
+}
+
+/*
+ * Package fields with few distinct values (architecture, section, ...) share
+ * one copy per value, which lives as long as the package hash. Interned
+ * strings must not be freed and can be compared by pointer.
+ */
+const char *pkg_hash_intern(const char *str)
+{
+    const char *s;
+
+    if (!str)
+        return NULL;
+
+    pkg_hash_lock();
+    s = hash_table_intern(&opkg_config->pkg_str_pool, str);
+    pkg_hash_unlock();
+
+    return s;
+}
+
+const char *pkg_hash_intern_len(const char *str, size_t len)
+{
+    const char *s;
+
+    pkg_hash_lock();
+    s = hash_table_intern_len(&opkg_config->pkg_str_pool, str, len);
+    pkg_hash_unlock();
+
+    return s;
+}
+
+/*
+ * The dependency graph of the packages (depends, conflicts, replaces and
+ * provides) is allocated from pkg_arena. It is never freed piecemeal, but all
+ * at once by pkg_hash_deinit().
+ */
+void *pkg_hash_alloc(size_t nmemb, size_t size)
+{
+    return arena_calloc(&opkg_config->pkg_arena, nmemb, size);
+}
+
+char *pkg_hash_strdup(const char *str)
+{
+    return arena_strdup(&opkg_config->pkg_arena, str);
+}
+
+/*
+ * Read the cold fields of pkg from its feed list, if that has not been done
+ * yet. Fields pkg already has are kept.
+ */
+void pkg_hash_load_cold_fields(pkg_t * pkg)
+{
+    pkg_t *tmp;
+    char *buf;
+    const size_t len = 4096;
+    const char *file = pkg->stanza_file;
+    int r;
+
+    if (!file)
+        return;
+    pkg->stanza_file = NULL;
+
+    if (file != cold_file) {
+        if (cold_fp)
+            fclose(cold_fp);
+        cold_file = file;
+        cold_fp = fopen(file, "r");
+    }
+    if (!cold_fp) {
+        opkg_perror(ERROR, "Failed to open %s", file);
+        cold_file = NULL;
+        return;
+    }
+    if (fseeko(cold_fp, pkg->stanza_offset, SEEK_SET) < 0) {
+        opkg_perror(ERROR, "Failed to seek in %s", file);
+        return;
+    }
+
+    tmp = pkg_new();
+    buf = xmalloc(len);
+    r = parse_from_stream_nomalloc(pkg_parse_line, tmp, cold_fp,
+                                   PFM_ALL ^ (PFM_COLD | PFM_PACKAGE | PFM_VERSION),
+                                   &buf, len);
+    free(buf);
+
+    /* The list may have been replaced since it was loaded. */
+    if (r < 0 || !tmp->name || strcmp(tmp->name, pkg->name) != 0
+            || pkg_compare_versions_no_reinstall(tmp, pkg) != 0) {
+        opkg_msg(NOTICE, "Package list %s changed, details of %s are "
+                 "not available.\n", file, pkg->name);
+        goto cleanup;
+    }
+
+    if (!pkg->description) {
+        pkg->description = tmp->description;
+        tmp->description = NULL;
+    }
+    if (!pkg->maintainer)
+        pkg->maintainer = tmp->maintainer;
+    if (!pkg->source)
+        pkg->source = tmp->source;
+    if (!pkg->tags)
+        pkg->tags = tmp->tags;
+    if (opkg_config->verbose_status_file
+            && nv_pair_list_empty(&pkg->userfields))
+        list_splice_init(&tmp->userfields.head, &pkg->userfields.head);
+
+ cleanup:
+    pkg_deinit(tmp);
+    free(tmp);
+}
+
+struct pkg_hash_feed {
+    char *list_file;
+    pkg_src_t *src;
+    pkg_vec_t *pkgs;            /* parsed, not yet in the hash */
+    int r;
+};
+
+#ifdef HAVE_PTHREAD
+struct pkg_hash_feed_queue {
+    struct pkg_hash_feed *feeds;
+    unsigned int n_feeds;
+    unsigned int next;
+    pthread_mutex_t mutex;
+};
+
+static void pkg_hash_stage_pkg(pkg_t * pkg, void *data)
+{
+    pkg_vec_insert((pkg_vec_t *) data, pkg);
+}
+
+static void *pkg_hash_parse_feeds(void *data)
+{
+    struct pkg_hash_feed_queue *queue = (struct pkg_hash_feed_queue *)data;
+    struct pkg_hash_feed *feed;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->mutex);
+        feed = NULL;
+        if (queue->next < queue->n_feeds)
+            feed = &queue->feeds[queue->next++];
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (!feed)
+            break;
+
+        feed->pkgs = pkg_vec_alloc();
+        feed->r = pkg_hash_read_file(feed->list_file, 0, pkg_hash_stage_pkg,
+                                     feed->pkgs);
+    }
+
+    return NULL;
+}
+
+static unsigned int pkg_hash_parse_threads(unsigned int n_feeds)
+{
+    long n = opkg_config->parse_threads;
+
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > (long)n_feeds)
+        n = n_feeds;
+
+    return n > 1 ? n : 1;
+}
+
+/*
+ * Parse the feed lists on n_threads threads, the calling one included, then
+ * add their packages to the hash in feed order, as if the lists had been read
+ * one after the other.
+ */
+static int pkg_hash_add_feeds_parallel(struct pkg_hash_feed *feeds,
+                                       unsigned int n_feeds,
+                                       unsigned int n_threads)
+{
+    struct pkg_hash_feed_queue queue;
+    pthread_t *threads;
+    unsigned int i, j, n = 0;
+    int err, r = 0;
+
+    queue.feeds = feeds;
+    queue.n_feeds = n_feeds;
+    queue.next = 0;
+    pthread_mutex_init(&queue.mutex, NULL);
+
+    threads = xcalloc(n_threads - 1, sizeof(pthread_t));
+    pkg_hash_threaded = 1;
+    for (i = 0; i < n_threads - 1; i++) {
+        err = pthread_create(&threads[n], NULL, pkg_hash_parse_feeds, &queue);
+        if (err != 0) {
+            /* The threads that did start pick up the slack. */
+            opkg_msg(DEBUG, "Can't start parser thread: %s.\n",
+                     strerror(err));
+            break;
+        }
+        n++;
+    }
+
+    pkg_hash_parse_feeds(&queue);
+
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    pkg_hash_threaded = 0;
+    free(threads);
+    pthread_mutex_destroy(&queue.mutex);
+
+    for (i = 0; i < n_feeds; i++) {
+        struct pkg_hash_add_ctx ctx = { feeds[i].src, NULL, 0 };
+
+        for (j = 0; j < feeds[i].pkgs->len; j++) {
+            pkg_t *pkg = feeds[i].pkgs->pkgs[j];
+
+            if (r == 0) {
+                pkg_hash_add_pkg(pkg, &ctx);
+            } else {
+                /* An earlier list failed, stop where reading them in turn
+                 * would have. */
+                pkg_deinit(pkg);
+                free(pkg);
+            }
+        }
+        pkg_vec_free(feeds[i].pkgs);
+
+        if (feeds[i].r != 0)
+            r = -1;
+    }
+
+    return r;
+}
+#endif
+
+static int pkg_hash_add_feeds(struct pkg_hash_feed *feeds,
+                              unsigned int n_feeds)
+{
+    unsigned int i;
+    int r;
+
+#ifdef HAVE_PTHREAD
+    unsigned int n_threads = pkg_hash_parse_threads(n_feeds);
+
+    if (n_threads > 1)
+        return pkg_hash_add_feeds_parallel(feeds, n_feeds, n_threads);
+#endif
+
+    for (i = 0; i < n_feeds; i++) {
+        r = pkg_hash_add_from_file(feeds[i].list_file, feeds[i].src, NULL, 0);
+        if (r != 0)
+            return -1;
+    }
+
+    return 0;
 }
 
 /*
@@ -217,6 +644,8 @@ int pkg_hash_load_feeds(void)
 {
     pkg_src_list_elt_t *iter;
     pkg_src_t *src, *subdist;
+    struct pkg_hash_feed *feeds = NULL;
+    unsigned int i, n_feeds = 0;
     char *list_file;
     int r;
 
@@ -268,17 +697,24 @@ int pkg_hash_load_feeds(void)
         sprintf_alloc(&list_file, "%s/%s%s", opkg_config->lists_dir, src->name,
                       opkg_config->compress_list_files ? ".gz" : "" );
 
-        if (file_exists(list_file)) {
-            r = pkg_hash_add_from_file(list_file, src, NULL, 0);
-            if (r != 0) {
-                free(list_file);
-                return -1;
-            }
+        if (!file_exists(list_file)) {
+            free(list_file);
+            continue;
         }
-        free(list_file);
+
+        feeds = xrealloc(feeds, (n_feeds + 1) * sizeof(*feeds));
+        feeds[n_feeds].list_file = list_file;
+        feeds[n_feeds].src = src;
+        n_feeds++;
     }
 
-    return 0;
+    r = pkg_hash_add_feeds(feeds, n_feeds);
+
+    for (i = 0; i < n_feeds; i++)
+        free(feeds[i].list_file);
+    free(feeds);
+
+    return r;
 }
 
 /*
@@ -312,24 +748,26 @@ abstract_pkg_t *abstract_pkg_fetch_by_name(const char *pkg_name)
     return (abstract_pkg_t *) hash_table_get(&opkg_config->pkg_hash, pkg_name);
 }
 
-void abstract_pkgs_fetch_by_glob(const char *pkg_glob, abstract_pkg_vec_t *apkgs)
+struct abstract_pkgs_glob {
+    const char *pattern;
+    abstract_pkg_vec_t *apkgs;
+};
+
+static void abstract_pkgs_fetch_by_glob_helper(const char *key, void *entry,
+                                               void *data)
 {
-    unsigned int i;
-    hash_table_t *hash = &opkg_config->pkg_hash;
+    struct abstract_pkgs_glob *glob = (struct abstract_pkgs_glob *)data;
 
-    if (!hash)
-        return;
+    if (!fnmatch(glob->pattern, key, 0))
+        abstract_pkg_vec_insert(glob->apkgs, (abstract_pkg_t *) entry);
+}
 
-    for (i = 0; i < hash->n_buckets; i++) {
-        hash_entry_t *hash_entry = (hash->entries + i);
+void abstract_pkgs_fetch_by_glob(const char *pkg_glob, abstract_pkg_vec_t *apkgs)
+{
+    struct abstract_pkgs_glob glob = { pkg_glob, apkgs };
 
-        do {
-            if (hash_entry->key) {
-                if (!fnmatch(pkg_glob, hash_entry->key, 0))
-                    abstract_pkg_vec_insert(apkgs, hash_entry->data);
-            }
-        } while ((hash_entry = hash_entry->next));
-     }
+    hash_table_foreach(&opkg_config->pkg_hash,
+                       abstract_pkgs_fetch_by_glob_helper, &glob);
 }
 
 pkg_t *pkg_hash_fetch_best_installation_candidate(abstract_pkg_t * apkg,
@@ -893,32 +1331,66 @@ static const char *strip_offline_root(const char *file_name)
 
 void file_hash_remove(const char *file_name)
 {
+    file_node_t *node;
+
     file_name = strip_offline_root(file_name);
-    hash_table_remove(&opkg_config->file_hash, file_name);
+
+    node = file_tree_get(&opkg_config->file_tree, file_name);
+    if (node)
+        file_node_set_owner(node, NULL);
 }
 
 pkg_t *file_hash_get_file_owner(const char *file_name)
 {
+    file_node_t *node;
+
     file_name = strip_offline_root(file_name);
-    return hash_table_get(&opkg_config->file_hash, file_name);
+
+    node = file_tree_get(&opkg_config->file_tree, file_name);
+    return node ? node->owner : NULL;
 }
 
 void file_hash_set_file_owner(const char *file_name, pkg_t * owning_pkg)
 {
+    file_node_t *node;
     pkg_t *old_owning_pkg;
 
     file_name = strip_offline_root(file_name);
 
-    old_owning_pkg = hash_table_get(&opkg_config->file_hash, file_name);
-    hash_table_insert(&opkg_config->file_hash, file_name, owning_pkg);
+    node = file_tree_add(&opkg_config->file_tree, file_name);
+    old_owning_pkg = node->owner;
+
+    /* Keep the owned_files of both packages in step with file_hash. */
+    if (old_owning_pkg != owning_pkg)
+        file_node_set_owner(node, owning_pkg);
 
     if (old_owning_pkg) {
-        if (!old_owning_pkg->installed_files)
-            pkg_get_installed_files(old_owning_pkg);
-        file_list_remove_elt(old_owning_pkg->installed_files, file_name);
+        /* Only another package loses the file, and the file list of
+         * owning_pkg may be held for the whole of its installation. */
+        if (old_owning_pkg != owning_pkg) {
+            if (!old_owning_pkg->installed_files)
+                pkg_get_installed_files(old_owning_pkg);
+            file_list_remove_elt(old_owning_pkg->installed_files, file_name);
+        }
 
         /* mark this package to have its filelist written */
         old_owning_pkg->state_flag |= SF_FILELIST_CHANGED;
         owning_pkg->state_flag |= SF_FILELIST_CHANGED;
     }
 }
+
+pkg_t *file_hash_get_obs_owner(const char *file_name)
+{
+    file_node_t *node;
+
+    file_name = strip_offline_root(file_name);
+
+    node = file_tree_get(&opkg_config->file_tree, file_name);
+    return node ? node->obs_owner : NULL;
+}
+
+void file_hash_set_obs_owner(const char *file_name, pkg_t * obs_pkg)
+{
+    file_name = strip_offline_root(file_name);
+    file_tree_add(&opkg_config->file_tree, file_name)->obs_owner = obs_pkg;
+}
@@ -39,11 +39,21 @@ typedef enum fetch_type fetch_type_t;
 
 void pkg_hash_init(void);
 void pkg_hash_deinit(void);
+const char *pkg_hash_intern(const char *str);
+const char *pkg_hash_intern_len(const char *str, size_t len);
+void *pkg_hash_alloc(size_t nmemb, size_t size);
+char *pkg_hash_strdup(const char *str);
+/* Serialize access to the string pool and the arch table while feed lists
+ * are parsed on several threads. No-ops otherwise. */
+void pkg_hash_lock(void);
+void pkg_hash_unlock(void);
 
 void pkg_hash_fetch_available(pkg_vec_t * available);
 
 int pkg_hash_load_feeds(void);
 int pkg_hash_load_status_files(void);
+int pkg_hash_index_file(const char *file_name, int is_status_file);
+void pkg_hash_load_cold_fields(pkg_t * pkg);
 
 void hash_insert_pkg(pkg_t * pkg, int set_status);
 
@@ -65,6 +75,9 @@ pkg_t *pkg_hash_fetch_installed_by_name_dest(const char *pkg_name,
 void file_hash_remove(const char *file_name);
 pkg_t *file_hash_get_file_owner(const char *file_name);
 void file_hash_set_file_owner(const char *file_name, pkg_t * pkg);
+/* The package a file is obsolete in, once a newer version dropped it. */
+pkg_t *file_hash_get_obs_owner(const char *file_name);
+void file_hash_set_obs_owner(const char *file_name, pkg_t * pkg);
 
 #ifdef __cplusplus
 }
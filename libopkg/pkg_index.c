@@ -0,0 +1,800 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* pkg_index.c - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pkg_index.h"
+#include "pkg_parse.h"
+#include "pkg_hash.h"
+#include "md5.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "xfuncs.h"
+
+#define PKG_INDEX_MAGIC "OPKGIDX"
+#define PKG_INDEX_VERSION 2
+
+struct pkg_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t verbose_status_file;
+    uint64_t list_size;
+    uint64_t list_ino;
+    int64_t list_mtime;
+    int64_t list_mtime_nsec;
+    uint32_t count;
+    uint32_t flags;
+    uint8_t list_md5[MD5_DIGEST_SIZE];
+};
+
+/* Each package is a sequence of tagged fields terminated by IDX_END. Strings
+ * are stored as a 32-bit length followed by the bytes and a NUL, lists as a
+ * 32-bit count followed by that many strings.
+ */
+enum pkg_index_tag {
+    IDX_END = 0,
+    IDX_PACKAGE,
+    IDX_VERSION,
+    IDX_ARCHITECTURE,
+    IDX_SECTION,
+    IDX_MAINTAINER,
+    IDX_DESCRIPTION,
+    IDX_TAGS,
+    IDX_FILENAME,
+    IDX_MD5SUM,
+    IDX_SHA256SUM,
+    IDX_PRIORITY,
+    IDX_SOURCE,
+    IDX_DEPENDS,
+    IDX_PRE_DEPENDS,
+    IDX_RECOMMENDS,
+    IDX_SUGGESTS,
+    IDX_CONFLICTS,
+    IDX_REPLACES,
+    IDX_PROVIDES,
+    IDX_SIZE,
+    IDX_INSTALLED_SIZE,
+    IDX_INSTALLED_TIME,
+    IDX_ESSENTIAL,
+    IDX_AUTO_INSTALLED,
+    IDX_STATUS,
+    IDX_CONFFILES,
+    IDX_USERFIELDS,
+    IDX_LAST_TAG
+};
+
+static const unsigned int pkg_index_tag_pfm[IDX_LAST_TAG] = {
+    [IDX_PACKAGE] = PFM_PACKAGE,
+    [IDX_VERSION] = PFM_VERSION,
+    [IDX_ARCHITECTURE] = PFM_ARCHITECTURE,
+    [IDX_SECTION] = PFM_SECTION,
+    [IDX_MAINTAINER] = PFM_MAINTAINER,
+    [IDX_DESCRIPTION] = PFM_DESCRIPTION,
+    [IDX_TAGS] = PFM_TAGS,
+    [IDX_FILENAME] = PFM_FILENAME,
+    [IDX_MD5SUM] = PFM_MD5SUM,
+    [IDX_SHA256SUM] = PFM_SHA256SUM,
+    [IDX_PRIORITY] = PFM_PRIORITY,
+    [IDX_SOURCE] = PFM_SOURCE,
+    [IDX_DEPENDS] = PFM_DEPENDS,
+    [IDX_PRE_DEPENDS] = PFM_PRE_DEPENDS,
+    [IDX_RECOMMENDS] = PFM_RECOMMENDS,
+    [IDX_SUGGESTS] = PFM_SUGGESTS,
+    [IDX_CONFLICTS] = PFM_CONFLICTS,
+    [IDX_REPLACES] = PFM_REPLACES,
+    [IDX_PROVIDES] = PFM_PROVIDES,
+    [IDX_SIZE] = PFM_SIZE,
+    [IDX_INSTALLED_SIZE] = PFM_INSTALLED_SIZE,
+    [IDX_INSTALLED_TIME] = PFM_INSTALLED_TIME,
+    [IDX_ESSENTIAL] = PFM_ESSENTIAL,
+    [IDX_AUTO_INSTALLED] = PFM_AUTO_INSTALLED,
+    [IDX_STATUS] = PFM_STATUS,
+    [IDX_CONFFILES] = PFM_CONFFILES,
+    [IDX_USERFIELDS] = 0,
+};
+
+struct pkg_index_writer {
+    FILE *fp;
+    char *index_file;
+    char *tmp_file;
+    struct pkg_index_header header;
+};
+
+static char *pkg_index_file_alloc(const char *list_file)
+{
+    char *index_file;
+
+    sprintf_alloc(&index_file, "%s.idx", list_file);
+    return index_file;
+}
+
+static int pkg_index_list_md5(const char *list_file, uint8_t * md5)
+{
+    FILE *fp;
+    int r;
+
+    fp = fopen(list_file, "r");
+    if (!fp)
+        return -1;
+    r = md5_stream(fp, md5);
+    fclose(fp);
+
+    return r;
+}
+
+static void pkg_index_header_init(struct pkg_index_header *header,
+                                  const struct stat *st, int flags)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, PKG_INDEX_MAGIC, sizeof(PKG_INDEX_MAGIC));
+    header->version = PKG_INDEX_VERSION;
+    header->verbose_status_file = opkg_config->verbose_status_file;
+    header->list_size = st->st_size;
+    header->list_ino = st->st_ino;
+    header->list_mtime = st->st_mtim.tv_sec;
+    header->list_mtime_nsec = st->st_mtim.tv_nsec;
+    header->flags = flags;
+}
+
+/*
+ * Writing
+ */
+
+static void write_u8(FILE * fp, uint8_t v)
+{
+    fputc(v, fp);
+}
+
+static void write_u32(FILE * fp, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void write_u64(FILE * fp, uint64_t v)
+{
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void write_str(FILE * fp, const char *s)
+{
+    uint32_t len = strlen(s);
+
+    write_u32(fp, len);
+    fwrite(s, 1, len + 1, fp);
+}
+
+static void write_str_field(FILE * fp, uint8_t tag, const char *s)
+{
+    if (!s)
+        return;
+
+    write_u8(fp, tag);
+    write_str(fp, s);
+}
+
+static void write_list_field(FILE * fp, uint8_t tag, char **list,
+                             unsigned int count)
+{
+    unsigned int i;
+
+    if (!list)
+        return;
+
+    write_u8(fp, tag);
+    write_u32(fp, count);
+    for (i = 0; i < count; i++)
+        write_str(fp, list[i]);
+}
+
+static void write_ulong_field(FILE * fp, uint8_t tag, uint64_t v)
+{
+    if (!v)
+        return;
+
+    write_u8(fp, tag);
+    write_u64(fp, v);
+}
+
+static void write_nv_list_field(FILE * fp, uint8_t tag, nv_pair_list_t * list)
+{
+    nv_pair_list_elt_t *iter;
+    uint32_t count = 0;
+
+    if (nv_pair_list_empty(list))
+        return;
+
+    for (iter = nv_pair_list_first(list); iter;
+            iter = nv_pair_list_next(list, iter))
+        count++;
+
+    write_u8(fp, tag);
+    write_u32(fp, count);
+    for (iter = nv_pair_list_first(list); iter;
+            iter = nv_pair_list_next(list, iter)) {
+        nv_pair_t *nv = (nv_pair_t *) iter->data;
+        write_str(fp, nv->name);
+        write_str(fp, nv->value ? nv->value : "");
+    }
+}
+
+pkg_index_writer_t *pkg_index_writer_new(const char *list_file, int flags)
+{
+    pkg_index_writer_t *writer;
+    struct stat st;
+    int fd;
+
+    if (stat(list_file, &st) != 0) {
+        opkg_perror(ERROR, "Failed to stat %s", list_file);
+        return NULL;
+    }
+
+    writer = xcalloc(1, sizeof(*writer));
+    writer->index_file = pkg_index_file_alloc(list_file);
+    sprintf_alloc(&writer->tmp_file, "%s.XXXXXX", writer->index_file);
+
+    fd = mkstemp(writer->tmp_file);
+    if (fd == -1) {
+        /* Not fatal: the list is still parsed as text. */
+        opkg_msg(DEBUG, "Can't create index %s: %s.\n", writer->tmp_file,
+                 strerror(errno));
+        goto err;
+    }
+    fchmod(fd, 0644);
+
+    writer->fp = fdopen(fd, "w");
+    if (!writer->fp) {
+        opkg_perror(ERROR, "Failed to fdopen %s", writer->tmp_file);
+        close(fd);
+        unlink(writer->tmp_file);
+        goto err;
+    }
+
+    pkg_index_header_init(&writer->header, &st, flags);
+    if ((flags & PKG_INDEX_CHECKSUM)
+            && pkg_index_list_md5(list_file, writer->header.list_md5) != 0) {
+        opkg_perror(ERROR, "Failed to checksum %s", list_file);
+        fclose(writer->fp);
+        unlink(writer->tmp_file);
+        goto err;
+    }
+    fwrite(&writer->header, sizeof(writer->header), 1, writer->fp);
+
+    return writer;
+
+ err:
+    free(writer->tmp_file);
+    free(writer->index_file);
+    free(writer);
+    return NULL;
+}
+
+int pkg_index_writer_add(pkg_index_writer_t * writer, pkg_t * pkg)
+{
+    FILE *fp = writer->fp;
+
+    write_str_field(fp, IDX_PACKAGE, pkg->name);
+    if (pkg->version) {
+        write_u8(fp, IDX_VERSION);
+        write_u64(fp, pkg->epoch);
+        write_str(fp, pkg->version);
+        write_u8(fp, pkg->revision != NULL);
+        if (pkg->revision)
+            write_str(fp, pkg->revision);
+    }
+    write_str_field(fp, IDX_ARCHITECTURE, pkg->architecture);
+    write_str_field(fp, IDX_SECTION, pkg->section);
+    write_str_field(fp, IDX_MAINTAINER, pkg->maintainer);
+    write_str_field(fp, IDX_DESCRIPTION, pkg->description);
+    write_str_field(fp, IDX_TAGS, pkg->tags);
+    write_str_field(fp, IDX_FILENAME, pkg->filename);
+    write_str_field(fp, IDX_MD5SUM, pkg->md5sum);
+    write_str_field(fp, IDX_SHA256SUM, pkg->sha256sum);
+    write_str_field(fp, IDX_PRIORITY, pkg->priority);
+    write_str_field(fp, IDX_SOURCE, pkg->source);
+    write_list_field(fp, IDX_DEPENDS, pkg->depends_str, pkg->depends_count);
+    write_list_field(fp, IDX_PRE_DEPENDS, pkg->pre_depends_str,
+                     pkg->pre_depends_count);
+    write_list_field(fp, IDX_RECOMMENDS, pkg->recommends_str,
+                     pkg->recommends_count);
+    write_list_field(fp, IDX_SUGGESTS, pkg->suggests_str,
+                     pkg->suggests_count);
+    write_list_field(fp, IDX_CONFLICTS, pkg->conflicts_str,
+                     pkg->conflicts_count);
+    write_list_field(fp, IDX_REPLACES, pkg->replaces_str,
+                     pkg->replaces_count);
+    write_list_field(fp, IDX_PROVIDES, pkg->provides_str,
+                     pkg->provides_count);
+    write_ulong_field(fp, IDX_SIZE, pkg->size);
+    write_ulong_field(fp, IDX_INSTALLED_SIZE, pkg->installed_size);
+    write_ulong_field(fp, IDX_INSTALLED_TIME, pkg->installed_time);
+    write_ulong_field(fp, IDX_ESSENTIAL, pkg->essential);
+    write_ulong_field(fp, IDX_AUTO_INSTALLED, pkg->auto_installed);
+    write_u8(fp, IDX_STATUS);
+    write_u32(fp, pkg->state_want);
+    write_u32(fp, pkg->state_flag);
+    write_u32(fp, pkg->state_status);
+    write_nv_list_field(fp, IDX_CONFFILES, &pkg->conffiles);
+    if (opkg_config->verbose_status_file)
+        write_nv_list_field(fp, IDX_USERFIELDS, &pkg->userfields);
+    write_u8(fp, IDX_END);
+
+    writer->header.count++;
+
+    return ferror(fp) ? -1 : 0;
+}
+
+int pkg_index_writer_close(pkg_index_writer_t * writer, int commit)
+{
+    int err = 0;
+
+    if (commit) {
+        rewind(writer->fp);
+        fwrite(&writer->header, sizeof(writer->header), 1, writer->fp);
+        if (ferror(writer->fp)) {
+            opkg_msg(ERROR, "Failed to write index %s.\n", writer->tmp_file);
+            err = -1;
+        }
+    }
+
+    if (fclose(writer->fp) != 0) {
+        opkg_perror(ERROR, "Failed to close %s", writer->tmp_file);
+        err = -1;
+    }
+
+    if (commit && !err) {
+        if (rename(writer->tmp_file, writer->index_file) != 0) {
+            opkg_perror(ERROR, "Failed to rename %s to %s", writer->tmp_file,
+                        writer->index_file);
+            err = -1;
+        } else {
+            opkg_msg(DEBUG, "Wrote index %s (%u packages).\n",
+                     writer->index_file, writer->header.count);
+        }
+    }
+
+    if (!commit || err)
+        unlink(writer->tmp_file);
+
+    free(writer->tmp_file);
+    free(writer->index_file);
+    free(writer);
+
+    return err;
+}
+
+/*
+ * Reading
+ *
+ * The index is walked twice: once to check that every record is well formed
+ * and once to build the packages, so that a truncated or corrupted index is
+ * rejected before any package has been handed out.
+ */
+
+struct pkg_index_cursor {
+    const char *p;
+    const char *end;
+};
+
+static int read_u8(struct pkg_index_cursor *c, uint8_t * v)
+{
+    if (c->end - c->p < 1)
+        return -1;
+    *v = *(const uint8_t *)c->p;
+    c->p += 1;
+    return 0;
+}
+
+static int read_u32(struct pkg_index_cursor *c, uint32_t * v)
+{
+    if (c->end - c->p < (ptrdiff_t) sizeof(*v))
+        return -1;
+    memcpy(v, c->p, sizeof(*v));
+    c->p += sizeof(*v);
+    return 0;
+}
+
+static int read_u64(struct pkg_index_cursor *c, uint64_t * v)
+{
+    if (c->end - c->p < (ptrdiff_t) sizeof(*v))
+        return -1;
+    memcpy(v, c->p, sizeof(*v));
+    c->p += sizeof(*v);
+    return 0;
+}
+
+/* Returns a pointer to the NUL terminated string in the index. */
+static const char *read_str(struct pkg_index_cursor *c, uint32_t * len)
+{
+    const char *s;
+
+    if (read_u32(c, len) < 0)
+        return NULL;
+    if ((uint64_t) (c->end - c->p) < (uint64_t) * len + 1)
+        return NULL;
+    s = c->p;
+    if (s[*len] != '\0')
+        return NULL;
+    c->p += *len + 1;
+    return s;
+}
+
+static char *read_xstrdup(struct pkg_index_cursor *c)
+{
+    uint32_t len;
+    const char *s = read_str(c, &len);
+
+    return s ? xstrndup(s, len) : NULL;
+}
+
+static int read_list(struct pkg_index_cursor *c, char ***list,
+                     unsigned int *count)
+{
+    uint32_t i, n, len;
+
+    if (read_u32(c, &n) < 0)
+        return -1;
+
+    if (!list) {
+        for (i = 0; i < n; i++)
+            if (!read_str(c, &len))
+                return -1;
+        return 0;
+    }
+
+    *list = xcalloc(n, sizeof(char *));
+    *count = n;
+    for (i = 0; i < n; i++)
+        (*list)[i] = read_xstrdup(c);
+    return 0;
+}
+
+static int read_nv_list(struct pkg_index_cursor *c, nv_pair_list_t * list)
+{
+    uint32_t i, n, len;
+    const char *name, *value;
+
+    if (read_u32(c, &n) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        name = read_str(c, &len);
+        if (!name)
+            return -1;
+        value = read_str(c, &len);
+        if (!value)
+            return -1;
+        if (list)
+            nv_pair_list_append(list, name, value);
+    }
+    return 0;
+}
+
+static int read_version(struct pkg_index_cursor *c, pkg_t * pkg)
+{
+    uint64_t epoch;
+    uint8_t has_revision;
+    uint32_t vlen, rlen = 0;
+    const char *version, *revision = NULL;
+
+    if (read_u64(c, &epoch) < 0)
+        return -1;
+    version = read_str(c, &vlen);
+    if (!version || read_u8(c, &has_revision) < 0)
+        return -1;
+    if (has_revision) {
+        revision = read_str(c, &rlen);
+        if (!revision)
+            return -1;
+    }
+
+    if (!pkg)
+        return 0;
+
+    /* The revision shares storage with the version, as in parse_version(). */
+    pkg->epoch = epoch;
+    pkg->version = xmalloc(vlen + 1 + rlen + 1);
+    memcpy(pkg->version, version, vlen + 1);
+    if (revision) {
+        pkg->revision = pkg->version + vlen + 1;
+        memcpy(pkg->revision, revision, rlen + 1);
+    }
+    return 0;
+}
+
+/* Reads one package. If pkg is NULL the record is only checked. */
+static int read_pkg(struct pkg_index_cursor *c, pkg_t * pkg, unsigned int mask)
+{
+    uint8_t tag;
+    uint32_t u32;
+    uint64_t u64;
+    char **str;
+    const char **atom;
+    const char *s;
+    char ***list;
+    unsigned int *count;
+    unsigned long *ulong;
+
+    while (1) {
+        if (read_u8(c, &tag) < 0 || tag >= IDX_LAST_TAG)
+            return -1;
+        if (tag == IDX_END)
+            return 0;
+
+        /* Fields excluded by the field mask are skipped, just like the text
+         * parser would. */
+        pkg_t *p = (pkg && !(mask & pkg_index_tag_pfm[tag])) ? pkg : NULL;
+
+        str = NULL;
+        atom = NULL;
+        list = NULL;
+        count = NULL;
+        ulong = NULL;
+
+        switch (tag) {
+        case IDX_PACKAGE:
+            str = p ? &p->name : NULL;
+            break;
+        case IDX_ARCHITECTURE:
+            atom = p ? &p->architecture : NULL;
+            break;
+        case IDX_SECTION:
+            atom = p ? &p->section : NULL;
+            break;
+        case IDX_MAINTAINER:
+            atom = p ? &p->maintainer : NULL;
+            break;
+        case IDX_DESCRIPTION:
+            str = p ? &p->description : NULL;
+            break;
+        case IDX_TAGS:
+            atom = p ? &p->tags : NULL;
+            break;
+        case IDX_FILENAME:
+            str = p ? &p->filename : NULL;
+            break;
+        case IDX_MD5SUM:
+            str = p ? &p->md5sum : NULL;
+            break;
+        case IDX_SHA256SUM:
+            str = p ? &p->sha256sum : NULL;
+            break;
+        case IDX_PRIORITY:
+            atom = p ? &p->priority : NULL;
+            break;
+        case IDX_SOURCE:
+            atom = p ? &p->source : NULL;
+            break;
+        case IDX_VERSION:
+            if (read_version(c, p) < 0)
+                return -1;
+            continue;
+        case IDX_DEPENDS:
+            if (p) {
+                list = &p->depends_str;
+                count = &p->depends_count;
+            }
+            goto read_list;
+        case IDX_PRE_DEPENDS:
+            if (p) {
+                list = &p->pre_depends_str;
+                count = &p->pre_depends_count;
+            }
+            goto read_list;
+        case IDX_RECOMMENDS:
+            if (p) {
+                list = &p->recommends_str;
+                count = &p->recommends_count;
+            }
+            goto read_list;
+        case IDX_SUGGESTS:
+            if (p) {
+                list = &p->suggests_str;
+                count = &p->suggests_count;
+            }
+            goto read_list;
+        case IDX_CONFLICTS:
+            if (p) {
+                list = &p->conflicts_str;
+                count = &p->conflicts_count;
+            }
+            goto read_list;
+        case IDX_REPLACES:
+            if (p) {
+                list = &p->replaces_str;
+                count = &p->replaces_count;
+            }
+            goto read_list;
+        case IDX_PROVIDES:
+            if (p) {
+                list = &p->provides_str;
+                count = &p->provides_count;
+            }
+ read_list:
+            if (read_list(c, list, count) < 0)
+                return -1;
+            continue;
+        case IDX_SIZE:
+            ulong = p ? &p->size : NULL;
+            goto read_ulong;
+        case IDX_INSTALLED_SIZE:
+            ulong = p ? &p->installed_size : NULL;
+ read_ulong:
+            if (read_u64(c, &u64) < 0)
+                return -1;
+            if (ulong)
+                *ulong = u64;
+            continue;
+        case IDX_INSTALLED_TIME:
+            if (read_u64(c, &u64) < 0)
+                return -1;
+            if (p)
+                p->installed_time = u64;
+            continue;
+        case IDX_ESSENTIAL:
+            if (read_u64(c, &u64) < 0)
+                return -1;
+            if (p)
+                p->essential = u64;
+            continue;
+        case IDX_AUTO_INSTALLED:
+            if (read_u64(c, &u64) < 0)
+                return -1;
+            if (p)
+                p->auto_installed = u64;
+            continue;
+        case IDX_STATUS:
+            if (read_u32(c, &u32) < 0)
+                return -1;
+            if (p)
+                p->state_want = u32;
+            if (read_u32(c, &u32) < 0)
+                return -1;
+            if (p)
+                p->state_flag = u32;
+            if (read_u32(c, &u32) < 0)
+                return -1;
+            if (p)
+                p->state_status = u32;
+            continue;
+        case IDX_CONFFILES:
+            if (read_nv_list(c, p ? &p->conffiles : NULL) < 0)
+                return -1;
+            continue;
+        case IDX_USERFIELDS:
+            if (read_nv_list(c, (p && opkg_config->verbose_status_file)
+                             ? &p->userfields : NULL) < 0)
+                return -1;
+            continue;
+        default:
+            return -1;
+        }
+
+        /* Plain string fields. Interned ones are looked up straight from
+         * the mapped index without a copy. */
+        if (str) {
+            *str = read_xstrdup(c);
+            if (!*str)
+                return -1;
+        } else {
+            s = read_str(c, &u32);
+            if (!s)
+                return -1;
+            if (atom)
+                *atom = pkg_hash_intern(s);
+        }
+    }
+}
+
+int pkg_index_foreach(const char *list_file, int flags, pkg_index_fn_t fn,
+                      void *data)
+{
+    char *index_file;
+    struct stat list_st, index_st;
+    struct pkg_index_header expected;
+    const struct pkg_index_header *header;
+    struct pkg_index_cursor c;
+    unsigned int i, mask;
+    void *map = MAP_FAILED;
+    int fd = -1;
+    int ret = 1;
+
+    if (stat(list_file, &list_st) != 0)
+        return 1;
+
+    index_file = pkg_index_file_alloc(list_file);
+    fd = open(index_file, O_RDONLY);
+    if (fd == -1)
+        goto cleanup;
+
+    if (fstat(fd, &index_st) != 0
+            || (size_t)index_st.st_size < sizeof(struct pkg_index_header))
+        goto cleanup;
+
+    map = mmap(NULL, index_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        opkg_perror(DEBUG, "Failed to mmap %s", index_file);
+        goto cleanup;
+    }
+
+    header = map;
+    pkg_index_header_init(&expected, &list_st, flags);
+    expected.count = header->count;
+    memcpy(expected.list_md5, header->list_md5, sizeof(expected.list_md5));
+    if (memcmp(header, &expected, sizeof(expected)) != 0) {
+        opkg_msg(DEBUG, "Index %s is out of date.\n", index_file);
+        goto cleanup;
+    }
+
+    /* Size and mtime are cheap but can't see a rewrite of the same length
+     * within the timestamp granularity of the filesystem. */
+    if (flags & PKG_INDEX_CHECKSUM) {
+        if (pkg_index_list_md5(list_file, expected.list_md5) != 0
+                || memcmp(header->list_md5, expected.list_md5,
+                          sizeof(expected.list_md5)) != 0) {
+            opkg_msg(DEBUG, "Checksum of %s doesn't match its index.\n",
+                     list_file);
+            goto cleanup;
+        }
+    }
+
+    c.p = (const char *)map + sizeof(*header);
+    c.end = (const char *)map + index_st.st_size;
+    for (i = 0; i < header->count; i++) {
+        if (read_pkg(&c, NULL, 0) < 0)
+            break;
+    }
+    if (i != header->count || c.p != c.end) {
+        opkg_msg(NOTICE, "Ignoring corrupted index %s.\n", index_file);
+        goto cleanup;
+    }
+
+    if (opkg_config->verbose_status_file)
+        mask = 0;
+    else
+        mask = opkg_config->pfm;
+
+    c.p = (const char *)map + sizeof(*header);
+    for (i = 0; i < header->count; i++) {
+        pkg_t *pkg = pkg_new();
+        read_pkg(&c, pkg, mask);
+        if (pkg->architecture)
+            pkg->arch_priority = get_arch_priority(pkg->architecture);
+        fn(pkg, data);
+    }
+
+    opkg_msg(DEBUG, "Loaded %u packages from index %s.\n", header->count,
+             index_file);
+    ret = 0;
+
+ cleanup:
+    if (map != MAP_FAILED)
+        munmap(map, index_st.st_size);
+    if (fd != -1)
+        close(fd);
+    free(index_file);
+    return ret;
+}
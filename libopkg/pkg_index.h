@@ -0,0 +1,50 @@
+/* vi: set expandtab sw=4 sts=4: */
+/* pkg_index.h - the opkg package management system
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_INDEX_H
+#define PKG_INDEX_H
+
+#include "pkg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A package index is a binary copy of the stanzas of a package list, stored
+ * next to it as "<list>.idx". It records the size and mtime of the list it
+ * was built from and is ignored as soon as the list changes.
+ */
+typedef struct pkg_index_writer pkg_index_writer_t;
+
+/* Also record the md5sum of the list and check it before using the index. */
+#define PKG_INDEX_CHECKSUM 1
+
+typedef void (*pkg_index_fn_t) (pkg_t * pkg, void *data);
+
+pkg_index_writer_t *pkg_index_writer_new(const char *list_file, int flags);
+int pkg_index_writer_add(pkg_index_writer_t * writer, pkg_t * pkg);
+int pkg_index_writer_close(pkg_index_writer_t * writer, int commit);
+
+/* Calls fn for every package of the index of list_file; fn takes ownership
+ * of the package. Returns 1 without calling fn if there is no valid index.
+ */
+int pkg_index_foreach(const char *list_file, int flags, pkg_index_fn_t fn,
+                      void *data);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* PKG_INDEX_H */
@@ -30,16 +30,54 @@
 #include "opkg_message.h"
 #include "opkg_utils.h"
 #include "pkg_parse.h"
+#include "pkg_hash.h"
 #include "xfuncs.h"
 
 #include "parse_util.h"
 
-static void parse_status(pkg_t * pkg, const char *sstr)
+static int is_blank_n(const char *line, size_t len)
+{
+    while (len--)
+        if (!isspace(*line++))
+            return 0;
+    return 1;
+}
+
+static char *parse_string(const char *value, size_t len)
+{
+    return len ? xstrndup(value, len) : NULL;
+}
+
+static const char *parse_atom(const char *value, size_t len)
+{
+    return len ? pkg_hash_intern_len(value, len) : NULL;
+}
+
+static unsigned long parse_ulong(const char *value, size_t len)
+{
+    char buf[32];
+
+    if (len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+    memcpy(buf, value, len);
+    buf[len] = '\0';
+
+    return strtoul(buf, NULL, 0);
+}
+
+static int parse_yes(const char *value, size_t len)
+{
+    return len == 3 && memcmp(value, "yes", 3) == 0;
+}
+
+static void parse_status(pkg_t * pkg, const char *value, size_t len)
 {
     char sw_str[64], sf_str[64], ss_str[64];
+    char *sstr = xstrndup(value, len);
     int r;
 
-    r = sscanf(sstr, "Status: %63s %63s %63s", sw_str, sf_str, ss_str);
+    r = sscanf(sstr, "%63s %63s %63s", sw_str, sf_str, ss_str);
+    free(sstr);
     if (r != 3) {
         opkg_msg(ERROR, "Failed to parse Status line for %s\n", pkg->name);
         return;
@@ -50,12 +88,14 @@ static void parse_status(pkg_t * pkg, const char *sstr)
     pkg->state_status = pkg_state_status_from_str(ss_str);
 }
 
-static void parse_conffiles(pkg_t * pkg, const char *cstr)
+static void parse_conffiles(pkg_t * pkg, const char *line, size_t len)
 {
     char file_name[1024], md5sum[35];
+    char *cstr = xstrndup(line, len);
     int r;
 
     r = sscanf(cstr, "%1023s %34s", file_name, md5sum);
+    free(cstr);
     if (r != 2) {
         opkg_msg(ERROR, "Failed to parse Conffiles line for %s\n", pkg->name);
         return;
@@ -64,12 +104,14 @@ static void parse_conffiles(pkg_t * pkg, const char *cstr)
     conffile_list_append(&pkg->conffiles, file_name, md5sum);
 }
 
-static void parse_userfields(pkg_t *pkg, const char *cstr)
+static void parse_userfields(pkg_t *pkg, const char *line, size_t len)
 {
     char name[1024], value[4096];
+    char *cstr = xstrndup(line, len);
     int r;
 
     r = sscanf(cstr, "%1023s %4095[^\n]", name, value);
+    free(cstr);
     if (r != 2) {
         opkg_msg(ERROR, "Failed to parse User Field line for %s\n", pkg->name);
         return;
@@ -79,33 +121,36 @@ static void parse_userfields(pkg_t *pkg, const char *cstr)
     nv_pair_list_append(&pkg->userfields, name, value);
 }
 
-int parse_version(pkg_t * pkg, const char *vstr)
+static int parse_version_n(pkg_t * pkg, const char *vstr, size_t len)
 {
-    size_t offset;
-    const char *numbers = "0123456789";
+    const char *end = vstr + len;
+    const char *p;
 
-    if (strncmp(vstr, "Version:", 8) == 0)
+    if (len >= 8 && strncmp(vstr, "Version:", 8) == 0)
         vstr += 8;
 
-    while (*vstr && isspace(*vstr))
+    while (vstr < end && isspace(*vstr))
         vstr++;
+    while (end > vstr && isspace(end[-1]))
+        end--;
 
     /* A colon is only the epoch separator if it is the first non-numeric
      * character in the string.
      */
-    offset = strspn(vstr, numbers);
-    if (vstr[offset] == ':') {
+    for (p = vstr; p < end && isdigit(*p); p++)
+        ;
+    if (p < end && *p == ':') {
         errno = 0;
         pkg->epoch = strtoul(vstr, NULL, 10);
         if (errno) {
             opkg_perror(ERROR, "%s: invalid epoch", pkg->name);
         }
-        vstr += offset + 1;
+        vstr = p + 1;
     } else {
         pkg->epoch = 0;
     }
 
-    pkg->version = trim_xstrdup(vstr);
+    pkg->version = xstrndup(vstr, end - vstr);
     pkg->revision = strrchr(pkg->version, '-');
 
     if (pkg->revision)
@@ -114,209 +159,439 @@ int parse_version(pkg_t * pkg, const char *vstr)
     return 0;
 }
 
-static int get_arch_priority(const char *arch)
+int parse_version(pkg_t * pkg, const char *vstr)
+{
+    return parse_version_n(pkg, vstr, strlen(vstr));
+}
+
+int get_arch_priority(const char *arch)
 {
-    nv_pair_list_elt_t *l;
+    nv_pair_t *nv;
 
-    list_for_each_entry(l, &opkg_config->arch_list.head, node) {
-        nv_pair_t *nv = (nv_pair_t *) l->data;
-        if (strcmp(nv->name, arch) == 0)
-            return strtol(nv->value, NULL, 0);
+    pkg_hash_lock();
+    nv = hash_table_get(&opkg_config->arch_hash, arch);
+    pkg_hash_unlock();
+
+    return nv ? strtol(nv->value, NULL, 0) : 0;
+}
+
+/* The description being read, which grows geometrically so that long
+ * descriptions are not copied over and over. Feed lists may be parsed on
+ * several threads, so each gets its own. */
+static __thread char *desc;
+static __thread size_t desc_len, desc_size;
+
+static void append_description(pkg_t * pkg, const char *line, size_t len)
+{
+    if (!pkg->description || pkg->description != desc) {
+        desc_len = pkg->description ? strlen(pkg->description) : 0;
+        desc_size = desc_len + 1;
     }
-    return 0;
+
+    if (desc_len + 1 + len + 1 > desc_size) {
+        desc_size *= 2;
+        if (desc_size < desc_len + 1 + len + 1)
+            desc_size = desc_len + 1 + len + 1;
+        pkg->description = xrealloc(pkg->description, desc_size);
+    }
+
+    pkg->description[desc_len++] = '\n';
+    memcpy(pkg->description + desc_len, line, len);
+    desc_len += len;
+    pkg->description[desc_len] = '\0';
+
+    desc = pkg->description;
 }
 
-int pkg_parse_line(void *ptr, const char *line, uint mask)
+static void finish_description(pkg_t * pkg)
 {
-    pkg_t *pkg = (pkg_t *) ptr;
+    if (pkg->description && pkg->description == desc
+            && desc_size > desc_len + 1)
+        pkg->description = xrealloc(pkg->description, desc_len + 1);
+    desc = NULL;
+}
 
-    /* these flags are a bit hackish... */
-    static int reading_conffiles = 0, reading_description = 0;
-    int ret = 0, userfield = 0;
+static void parse_architecture(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->architecture = parse_atom(value, len);
+    if (pkg->architecture)
+        pkg->arch_priority = get_arch_priority(pkg->architecture);
+}
 
-    if (opkg_config->verbose_status_file) {
-        mask = 0;
-    } else {
-        /* Exclude globally masked fields. */
-        mask |= opkg_config->pfm;
-    }
+static void parse_auto_installed(pkg_t * pkg, const char *value, size_t len)
+{
+    if (parse_yes(value, len))
+        pkg->auto_installed = 1;
+}
 
-    /* Flip the semantics of the mask. */
-    mask ^= PFM_ALL;
+static void parse_conflicts(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->conflicts_str = parse_list_n(value, len, &pkg->conflicts_count, ',', 1);
+}
 
-    switch (*line) {
-    case 'A':
-        if ((mask & PFM_ARCHITECTURE) && is_field("Architecture", line)) {
-            pkg->architecture = parse_simple("Architecture", line);
-            pkg->arch_priority = get_arch_priority(pkg->architecture);
-        } else if ((mask & PFM_AUTO_INSTALLED) && is_field("Auto-Installed", line)) {
-            char *tmp = parse_simple("Auto-Installed", line);
-            if (strcmp(tmp, "yes") == 0)
-                pkg->auto_installed = 1;
-            free(tmp);
-        } else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_depends(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->depends_str = parse_list_n(value, len, &pkg->depends_count, ',', 1);
+}
 
-    case 'C':
-        if ((mask & PFM_CONFFILES) && is_field("Conffiles", line)) {
-            reading_conffiles = 1;
-            reading_description = 0;
-            goto dont_reset_flags;
-        } else if ((mask & PFM_CONFLICTS) && is_field("Conflicts", line))
-            pkg->conflicts_str =
-                parse_list(line, &pkg->conflicts_count, ',', 0);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_description(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->description = parse_string(value, len);
+    desc = NULL;
+}
 
-    case 'D':
-        if ((mask & PFM_DESCRIPTION) && is_field("Description", line)) {
-            pkg->description = parse_simple("Description", line);
-            reading_conffiles = 0;
-            reading_description = 1;
-            goto dont_reset_flags;
-        } else if ((mask & PFM_DEPENDS) && is_field("Depends", line))
-            pkg->depends_str = parse_list(line, &pkg->depends_count, ',', 0);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_essential(pkg_t * pkg, const char *value, size_t len)
+{
+    if (parse_yes(value, len))
+        pkg->essential = 1;
+}
 
-    case 'E':
-        if ((mask & PFM_ESSENTIAL) && is_field("Essential", line)) {
-            char *tmp = parse_simple("Essential", line);
-            if (strcmp(tmp, "yes") == 0)
-                pkg->essential = 1;
-            free(tmp);
-        } else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_filename(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->filename = parse_string(value, len);
+}
 
-    case 'F':
-        if ((mask & PFM_FILENAME) && is_field("Filename", line))
-            pkg->filename = parse_simple("Filename", line);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_installed_size(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->installed_size = parse_ulong(value, len);
+}
 
-    case 'I':
-        if ((mask & PFM_INSTALLED_SIZE) && is_field("Installed-Size", line)) {
-            char *tmp = parse_simple("Installed-Size", line);
-            pkg->installed_size = strtoul(tmp, NULL, 0);
-            free(tmp);
-        } else if ((mask & PFM_INSTALLED_TIME) && is_field("Installed-Time", line)) {
-            char *tmp = parse_simple("Installed-Time", line);
-            pkg->installed_time = strtoul(tmp, NULL, 0);
-            free(tmp);
-        } else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_installed_time(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->installed_time = parse_ulong(value, len);
+}
 
-    case 'M':
-        if ((mask & PFM_MD5SUM) && is_field("MD5sum:", line))
-            pkg->md5sum = parse_simple("MD5sum", line);
-        /* The old opkg wrote out status files with the wrong
-         * case for MD5sum, let's parse it either way */
-        else if ((mask & PFM_MD5SUM) && is_field("MD5Sum:", line))
-            pkg->md5sum = parse_simple("MD5Sum", line);
-        else if ((mask & PFM_MAINTAINER) && is_field("Maintainer", line))
-            pkg->maintainer = parse_simple("Maintainer", line);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_maintainer(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->maintainer = parse_atom(value, len);
+}
 
-    case 'P':
-        if ((mask & PFM_PACKAGE) && is_field("Package", line))
-            pkg->name = parse_simple("Package", line);
-        else if ((mask & PFM_PRIORITY) && is_field("Priority", line))
-            pkg->priority = parse_simple("Priority", line);
-        else if ((mask & PFM_PROVIDES) && is_field("Provides", line))
-            pkg->provides_str = parse_list(line, &pkg->provides_count, ',', 0);
-        else if ((mask & PFM_PRE_DEPENDS) && is_field("Pre-Depends", line))
-            pkg->pre_depends_str =
-                parse_list(line, &pkg->pre_depends_count, ',', 0);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_md5sum(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->md5sum = parse_string(value, len);
+}
 
-    case 'R':
-        if ((mask & PFM_RECOMMENDS) && is_field("Recommends", line))
-            pkg->recommends_str =
-                parse_list(line, &pkg->recommends_count, ',', 0);
-        else if ((mask & PFM_REPLACES) && is_field("Replaces", line))
-            pkg->replaces_str = parse_list(line, &pkg->replaces_count, ',', 0);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_package(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->name = parse_string(value, len);
+}
 
-    case 'S':
-        if ((mask & PFM_SECTION) && is_field("Section", line))
-            pkg->section = parse_simple("Section", line);
-        else if ((mask & PFM_SHA256SUM) && is_field("SHA256sum", line))
-            pkg->sha256sum = parse_simple("SHA256sum", line);
-        else if ((mask & PFM_SIZE) && is_field("Size", line)) {
-            char *tmp = parse_simple("Size", line);
-            pkg->size = strtoul(tmp, NULL, 0);
-            free(tmp);
-        } else if ((mask & PFM_SOURCE) && is_field("Source", line))
-            pkg->source = parse_simple("Source", line);
-        else if ((mask & PFM_STATUS) && is_field("Status", line))
-            parse_status(pkg, line);
-        else if ((mask & PFM_SUGGESTS) && is_field("Suggests", line))
-            pkg->suggests_str = parse_list(line, &pkg->suggests_count, ',', 0);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_pre_depends(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->pre_depends_str =
+        parse_list_n(value, len, &pkg->pre_depends_count, ',', 1);
+}
 
-    case 'T':
-        if ((mask & PFM_TAGS) && is_field("Tags", line))
-            pkg->tags = parse_simple("Tags", line);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
-        break;
+static void parse_priority(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->priority = parse_atom(value, len);
+}
+
+static void parse_provides(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->provides_str = parse_list_n(value, len, &pkg->provides_count, ',', 1);
+}
 
-    case 'V':
-        if ((mask & PFM_VERSION) && is_field("Version", line))
-            parse_version(pkg, line);
-        else if (opkg_config->verbose_status_file)
-            userfield = 1;
+static void parse_recommends(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->recommends_str =
+        parse_list_n(value, len, &pkg->recommends_count, ',', 1);
+}
+
+static void parse_replaces(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->replaces_str = parse_list_n(value, len, &pkg->replaces_count, ',', 1);
+}
+
+static void parse_section(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->section = parse_atom(value, len);
+}
+
+static void parse_sha256sum(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->sha256sum = parse_string(value, len);
+}
+
+static void parse_size(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->size = parse_ulong(value, len);
+}
+
+static void parse_source(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->source = parse_atom(value, len);
+}
+
+static void parse_suggests(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->suggests_str = parse_list_n(value, len, &pkg->suggests_count, ',', 1);
+}
+
+static void parse_tags(pkg_t * pkg, const char *value, size_t len)
+{
+    pkg->tags = parse_atom(value, len);
+}
+
+static void parse_version_field(pkg_t * pkg, const char *value, size_t len)
+{
+    parse_version_n(pkg, value, len);
+}
+
+enum {
+    F_ARCHITECTURE,
+    F_AUTO_INSTALLED,
+    F_CONFFILES,
+    F_CONFLICTS,
+    F_DEPENDS,
+    F_DESCRIPTION,
+    F_ESSENTIAL,
+    F_FILENAME,
+    F_INSTALLED_SIZE,
+    F_INSTALLED_TIME,
+    F_MD5SUM,
+    F_MD5SUM_OLD,
+    F_MAINTAINER,
+    F_PACKAGE,
+    F_PRE_DEPENDS,
+    F_PRIORITY,
+    F_PROVIDES,
+    F_RECOMMENDS,
+    F_REPLACES,
+    F_SHA256SUM,
+    F_SECTION,
+    F_SIZE,
+    F_SOURCE,
+    F_STATUS,
+    F_SUGGESTS,
+    F_TAGS,
+    F_VERSION,
+    F_COUNT
+};
+
+typedef struct {
+    const char *name;
+    size_t len;
+    uint pfm;
+    /* NULL for fields whose value is on the lines that follow */
+    void (*parse) (pkg_t * pkg, const char *value, size_t len);
+} pkg_field_t;
+
+#define FIELD(name, pfm, parse) { name, sizeof(name) - 1, pfm, parse }
+
+/* Fields with the same length and first letter must be adjacent, see
+ * pkg_field_lookup(). */
+static const pkg_field_t pkg_fields[F_COUNT] = {
+    [F_ARCHITECTURE] = FIELD("Architecture", PFM_ARCHITECTURE, parse_architecture),
+    [F_AUTO_INSTALLED] = FIELD("Auto-Installed", PFM_AUTO_INSTALLED, parse_auto_installed),
+    [F_CONFFILES] = FIELD("Conffiles", PFM_CONFFILES, NULL),
+    [F_CONFLICTS] = FIELD("Conflicts", PFM_CONFLICTS, parse_conflicts),
+    [F_DEPENDS] = FIELD("Depends", PFM_DEPENDS, parse_depends),
+    [F_DESCRIPTION] = FIELD("Description", PFM_DESCRIPTION, parse_description),
+    [F_ESSENTIAL] = FIELD("Essential", PFM_ESSENTIAL, parse_essential),
+    [F_FILENAME] = FIELD("Filename", PFM_FILENAME, parse_filename),
+    [F_INSTALLED_SIZE] = FIELD("Installed-Size", PFM_INSTALLED_SIZE, parse_installed_size),
+    [F_INSTALLED_TIME] = FIELD("Installed-Time", PFM_INSTALLED_TIME, parse_installed_time),
+    [F_MD5SUM] = FIELD("MD5sum", PFM_MD5SUM, parse_md5sum),
+    /* The old opkg wrote out status files with the wrong
+     * case for MD5sum, let's parse it either way */
+    [F_MD5SUM_OLD] = FIELD("MD5Sum", PFM_MD5SUM, parse_md5sum),
+    [F_MAINTAINER] = FIELD("Maintainer", PFM_MAINTAINER, parse_maintainer),
+    [F_PACKAGE] = FIELD("Package", PFM_PACKAGE, parse_package),
+    [F_PRE_DEPENDS] = FIELD("Pre-Depends", PFM_PRE_DEPENDS, parse_pre_depends),
+    [F_PRIORITY] = FIELD("Priority", PFM_PRIORITY, parse_priority),
+    [F_PROVIDES] = FIELD("Provides", PFM_PROVIDES, parse_provides),
+    [F_RECOMMENDS] = FIELD("Recommends", PFM_RECOMMENDS, parse_recommends),
+    [F_REPLACES] = FIELD("Replaces", PFM_REPLACES, parse_replaces),
+    [F_SHA256SUM] = FIELD("SHA256sum", PFM_SHA256SUM, parse_sha256sum),
+    [F_SECTION] = FIELD("Section", PFM_SECTION, parse_section),
+    [F_SIZE] = FIELD("Size", PFM_SIZE, parse_size),
+    [F_SOURCE] = FIELD("Source", PFM_SOURCE, parse_source),
+    [F_STATUS] = FIELD("Status", PFM_STATUS, parse_status),
+    [F_SUGGESTS] = FIELD("Suggests", PFM_SUGGESTS, parse_suggests),
+    [F_TAGS] = FIELD("Tags", PFM_TAGS, parse_tags),
+    [F_VERSION] = FIELD("Version", PFM_VERSION, parse_version_field),
+};
+
+#define FIELD_KEY(len, c) (((len) << 8) | (unsigned char)(c))
+
+/*
+ * Returns the field called name, which is len bytes long, or NULL if it is
+ * not one opkg knows about.
+ */
+static const pkg_field_t *pkg_field_lookup(const char *name, size_t len)
+{
+    int i;
+
+    /* Find the first field with the same length and first letter, then
+     * compare whole names. */
+    switch (len < 16 ? FIELD_KEY(len, name[0]) : 0) {
+    case FIELD_KEY(12, 'A'):
+        i = F_ARCHITECTURE;
+        break;
+    case FIELD_KEY(14, 'A'):
+        i = F_AUTO_INSTALLED;
+        break;
+    case FIELD_KEY(9, 'C'):
+        i = F_CONFFILES;
+        break;
+    case FIELD_KEY(7, 'D'):
+        i = F_DEPENDS;
+        break;
+    case FIELD_KEY(11, 'D'):
+        i = F_DESCRIPTION;
+        break;
+    case FIELD_KEY(9, 'E'):
+        i = F_ESSENTIAL;
+        break;
+    case FIELD_KEY(8, 'F'):
+        i = F_FILENAME;
+        break;
+    case FIELD_KEY(14, 'I'):
+        i = F_INSTALLED_SIZE;
+        break;
+    case FIELD_KEY(6, 'M'):
+        i = F_MD5SUM;
+        break;
+    case FIELD_KEY(10, 'M'):
+        i = F_MAINTAINER;
+        break;
+    case FIELD_KEY(7, 'P'):
+        i = F_PACKAGE;
+        break;
+    case FIELD_KEY(11, 'P'):
+        i = F_PRE_DEPENDS;
+        break;
+    case FIELD_KEY(8, 'P'):
+        i = F_PRIORITY;
+        break;
+    case FIELD_KEY(10, 'R'):
+        i = F_RECOMMENDS;
+        break;
+    case FIELD_KEY(8, 'R'):
+        i = F_REPLACES;
+        break;
+    case FIELD_KEY(9, 'S'):
+        i = F_SHA256SUM;
+        break;
+    case FIELD_KEY(7, 'S'):
+        i = F_SECTION;
+        break;
+    case FIELD_KEY(4, 'S'):
+        i = F_SIZE;
+        break;
+    case FIELD_KEY(6, 'S'):
+        i = F_SOURCE;
         break;
+    case FIELD_KEY(8, 'S'):
+        i = F_SUGGESTS;
+        break;
+    case FIELD_KEY(4, 'T'):
+        i = F_TAGS;
+        break;
+    case FIELD_KEY(7, 'V'):
+        i = F_VERSION;
+        break;
+    default:
+        return NULL;
+    }
+
+    for (; i < F_COUNT && pkg_fields[i].len == len
+         && pkg_fields[i].name[0] == name[0]; i++)
+        if (memcmp(pkg_fields[i].name, name, len) == 0)
+            return &pkg_fields[i];
+
+    return NULL;
+}
+
+int pkg_parse_line(void *ptr, const char *line, uint mask)
+{
+    /* Exclude globally masked fields. */
+    return pkg_parse_field(ptr, line, strlen(line), mask | opkg_config->pfm);
+}
+
+/*
+ * Parses one line of a stanza. The line is len bytes long and need not be
+ * terminated, so that it can point straight into a mapped file. Unlike
+ * pkg_parse_line(), the fields masked by the current command are only
+ * skipped if they are in mask.
+ */
+int pkg_parse_field(void *ptr, const char *line, size_t len, uint mask)
+{
+    pkg_t *pkg = (pkg_t *) ptr;
+    const pkg_field_t *field = NULL;
+    const char *colon, *value, *end;
+
+    /* these flags are a bit hackish... */
+    static __thread int reading_conffiles = 0, reading_description = 0;
 
-    case ' ':
+    if (opkg_config->verbose_status_file)
+        mask = 0;
+
+    /* Read later, by pkg_hash_load_cold_fields(). */
+    if (pkg->stanza_file)
+        mask |= PFM_COLD;
+
+    /* Flip the semantics of the mask. */
+    mask ^= PFM_ALL;
+
+    if (len && *line == ' ') {
         if ((mask & PFM_DESCRIPTION) && reading_description) {
-            if (!pkg->description) {
-                pkg->description = xmalloc(1 + strlen(line) + 1);
-                *pkg->description = '\0';
-            } else {
-                pkg->description =
-                    xrealloc(pkg->description, strlen(pkg->description)
-                             + 1 + strlen(line) + 1);
-            }
-            strcat(pkg->description, "\n");
-            strcat(pkg->description, (line));
-            goto dont_reset_flags;
+            append_description(pkg, line, len);
+            return 0;
         } else if ((mask & PFM_CONFFILES) && reading_conffiles) {
-            parse_conffiles(pkg, line);
-            goto dont_reset_flags;
+            parse_conffiles(pkg, line, len);
+            return 0;
         }
-
-        /* FALLTHROUGH */
-    default:
-        /* For package lists, signifies end of package. */
-        if (line_is_blank(line)) {
-            ret = 1;
-            break;
-        } else if (opkg_config->verbose_status_file)
-            userfield = 1;
     }
 
-    if (userfield)
-        parse_userfields(pkg, line);
-
+    if (reading_description)
+        finish_description(pkg);
     reading_description = 0;
     reading_conffiles = 0;
 
- dont_reset_flags:
+    /* For package lists, signifies end of package. */
+    if (is_blank_n(line, len))
+        return 1;
+
+    colon = memchr(line, ':', len);
+    if (colon && colon > line)
+        field = pkg_field_lookup(line, colon - line);
+
+    if (!field || !(mask & field->pfm)) {
+        if (opkg_config->verbose_status_file && !pkg->stanza_file)
+            parse_userfields(pkg, line, len);
+        return 0;
+    }
+
+    value = colon + 1;
+    end = line + len;
+    while (value < end && isspace(*value))
+        value++;
+    while (end > value && isspace(end[-1]))
+        end--;
+
+    if (field->parse)
+        field->parse(pkg, value, end - value);
+
+    reading_description = (field->pfm == PFM_DESCRIPTION);
+    reading_conffiles = (field->pfm == PFM_CONFFILES);
+
+    return 0;
+}
+
+int pkg_parse_from_buffer(pkg_t * pkg, const char *buf, size_t len,
+                          uint mask)
+{
+    int ret;
+
+    /* Exclude globally masked fields, as pkg_parse_line() does. */
+    ret = parse_from_buffer(pkg_parse_field, pkg, &buf, buf + len,
+                            mask | opkg_config->pfm);
+    if (pkg->name == NULL) {
+        /* probably just a blank line */
+        ret = 1;
+    }
 
     return ret;
 }
@@ -29,7 +29,12 @@ extern "C" {
 
 int parse_version(pkg_t * pkg, const char *raw);
 int pkg_parse_from_stream(pkg_t * pkg, FILE * fp, uint mask);
+/* Parses the first stanza of the len bytes at buf. */
+int pkg_parse_from_buffer(pkg_t * pkg, const char *buf, size_t len,
+                          uint mask);
 int pkg_parse_line(void *ptr, const char *line, uint mask);
+int pkg_parse_field(void *ptr, const char *line, size_t len, uint mask);
+int get_arch_priority(const char *arch);
 
 /* package field mask */
 #define PFM_ARCHITECTURE    (1 << 1)
@@ -61,6 +66,10 @@ int pkg_parse_line(void *ptr, const char *line, uint mask);
 
 #define PFM_ALL (~(uint)0)
 
+/* Fields only needed to show a package, which are not read from feed lists
+ * until asked for. */
+#define PFM_COLD (PFM_DESCRIPTION | PFM_MAINTAINER | PFM_SOURCE | PFM_TAGS)
+
 #ifdef __cplusplus
 }
 #endif
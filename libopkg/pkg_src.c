@@ -25,10 +25,12 @@
 #include <stdio.h>
 
 #include "file_util.h"
+#include "list_diff.h"
 #include "opkg_conf.h"
 #include "opkg_download.h"
 #include "opkg_message.h"
 #include "opkg_verify.h"
+#include "pkg_hash.h"
 #include "pkg_src.h"
 #include "sprintf_alloc.h"
 #include "xfuncs.h"
@@ -60,21 +62,89 @@ void pkg_src_deinit(pkg_src_t * src)
     free(src->extra_data);
 }
 
+static char *pkg_src_url(pkg_src_t * src, const char *file_name)
+{
+    char *url;
+
+    if (src->extra_data)        /* debian style? */
+        sprintf_alloc(&url, "%s/%s/%s", src->value, src->extra_data,
+                      file_name);
+    else
+        sprintf_alloc(&url, "%s/%s", src->value, file_name);
+
+    return url;
+}
+
+static const char *pkg_src_signature_ext(void)
+{
+    if (strcmp(opkg_config->signature_type, "gpg-asc") == 0)
+        return "asc";
+    else
+        return "sig";
+}
+
+char *pkg_src_list_url(pkg_src_t * src)
+{
+    return pkg_src_url(src, src->gzip ? "Packages.gz" : "Packages");
+}
+
+char *pkg_src_signature_url(pkg_src_t * src)
+{
+    char *file_name;
+    char *url;
+
+    if (!opkg_config->check_signature || src->options->signature_verified)
+        return NULL;
+
+    sprintf_alloc(&file_name, "Packages.%s", pkg_src_signature_ext());
+    url = pkg_src_url(src, file_name);
+    free(file_name);
+    return url;
+}
+
+int pkg_src_install_list(pkg_src_t * src, const char *cache_location)
+{
+    int err;
+    char *feed;
+
+    if (!src->gzip) {
+        sprintf_alloc(&feed, "%s/%s", opkg_config->lists_dir, src->name);
+        err = file_copy(cache_location, feed);
+        if (!err && opkg_config->compress_list_files)
+            file_gz_compress(feed);
+        free(feed);
+        return err;
+    }
+
+    sprintf_alloc(&feed, "%s/%s%s", opkg_config->lists_dir, src->name,
+                  opkg_config->compress_list_files ? ".gz" : "");
+    if (opkg_config->compress_list_files) {
+        err = file_copy(cache_location, feed);
+    } else {
+        err = file_decompress(cache_location, feed);
+    }
+    if (err)
+        opkg_msg(ERROR, "Couldn't %s feed for source %s.",
+                 (opkg_config->compress_list_files) ? "copy" : "decompress",
+                 src->name);
+
+    free(feed);
+    return err;
+}
+
 static int pkg_src_download(pkg_src_t * src)
 {
     int err = 0;
     char *url;
     char *feed;
-    const char *url_filename;
 
     sprintf_alloc(&feed, "%s/%s", opkg_config->lists_dir, src->name);
+    url = pkg_src_list_url(src);
 
-    url_filename = src->gzip ? "Packages.gz" : "Packages";
-    if (src->extra_data)        /* debian style? */
-        sprintf_alloc(&url, "%s/%s/%s", src->value, src->extra_data,
-                      url_filename);
-    else
-        sprintf_alloc(&url, "%s/%s", src->value, url_filename);
+    if (opkg_config->index_diffs && list_diff_update(url, feed, NULL) == 0) {
+        opkg_msg(DEBUG, "Patched package list for %s.\n", src->name);
+        goto cleanup;
+    }
 
     if (src->gzip) {
         char *cache_location;
@@ -85,19 +155,10 @@ static int pkg_src_download(pkg_src_t * src)
             goto cleanup;
         }
 
-        if (opkg_config->compress_list_files) {
-            strcat(feed, ".gz");
-            err = file_copy(cache_location, feed);
-        } else {
-            err = file_decompress(cache_location, feed);
-        }
+        err = pkg_src_install_list(src, cache_location);
         free(cache_location);
-        if (err) {
-            opkg_msg(ERROR, "Couldn't %s feed for source %s.",
-                     (opkg_config->compress_list_files) ? "copy" : "decompress",
-                     src->name);
+        if (err)
             goto cleanup;
-        }
     } else {
         err = opkg_download(url, feed, NULL, NULL);
         if (err)
@@ -119,23 +180,13 @@ static int pkg_src_download_signature(pkg_src_t * src)
     int err = 0;
     char *url;
     char *sigfile;
-    const char *sigext;
-
-    if (strcmp(opkg_config->signature_type, "gpg-asc") == 0)
-        sigext = "asc";
-    else
-        sigext = "sig";
 
     sprintf_alloc(&sigfile, "%s/%s.%s", opkg_config->lists_dir, src->name,
-                  sigext);
+                  pkg_src_signature_ext());
     opkg_msg(DEBUG, "sigfile: %s\n", sigfile);
 
     /* get the url for the sig file */
-    if (src->extra_data)        /* debian style? */
-        sprintf_alloc(&url, "%s/%s/Packages.%s", src->value, src->extra_data,
-                      sigext);
-    else
-        sprintf_alloc(&url, "%s/Packages.%s", src->value, sigext);
+    url = pkg_src_signature_url(src);
     opkg_msg(DEBUG, "url: %s\n", url);
 
     err = opkg_download(url, sigfile, NULL, NULL);
@@ -157,15 +208,9 @@ int pkg_src_verify(pkg_src_t * src)
     int err = 0;
     char *feed;
     char *sigfile;
-    const char *sigext;
-
-    if (strcmp(opkg_config->signature_type, "gpg-asc") == 0)
-        sigext = "asc";
-    else
-        sigext = "sig";
 
     sprintf_alloc(&feed, "%s/%s", opkg_config->lists_dir, src->name);
-    sprintf_alloc(&sigfile, "%s.%s", feed, sigext);
+    sprintf_alloc(&sigfile, "%s.%s", feed, pkg_src_signature_ext());
 
     opkg_msg(DEBUG, "feed: %s\n", feed);
     opkg_msg(DEBUG, "sigfile: %s\n", sigfile);
@@ -199,6 +244,21 @@ int pkg_src_verify(pkg_src_t * src)
     return err;
 }
 
+static int pkg_src_updated(pkg_src_t * src)
+{
+    if (opkg_config->feed_index) {
+        char *feed;
+
+        sprintf_alloc(&feed, "%s/%s%s", opkg_config->lists_dir, src->name,
+                      opkg_config->compress_list_files ? ".gz" : "");
+        pkg_hash_index_file(feed, 0);
+        free(feed);
+    }
+
+    opkg_msg(NOTICE, "Updated source '%s'.\n", src->name);
+    return 0;
+}
+
 int pkg_src_update(pkg_src_t * src)
 {
     int err;
@@ -219,6 +279,32 @@ int pkg_src_update(pkg_src_t * src)
             return err;
     }
 
-    opkg_msg(NOTICE, "Updated source '%s'.\n", src->name);
-    return 0;
+    return pkg_src_updated(src);
+}
+
+int pkg_src_finish_update(pkg_src_t * src, const char *sig_cache_location)
+{
+    char *sigfile;
+    int err;
+
+    if (opkg_config->check_signature && !(src->options->signature_verified)) {
+        if (!sig_cache_location) {
+            opkg_msg(ERROR, "Failed to download signature for %s.\n",
+                     src->name);
+            return -1;
+        }
+
+        sprintf_alloc(&sigfile, "%s/%s.%s", opkg_config->lists_dir,
+                      src->name, pkg_src_signature_ext());
+        err = file_copy(sig_cache_location, sigfile);
+        free(sigfile);
+        if (err)
+            return err;
+
+        err = pkg_src_verify(src);
+        if (err)
+            return err;
+    }
+
+    return pkg_src_updated(src);
 }
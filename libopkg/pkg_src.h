@@ -46,6 +46,14 @@ void pkg_src_deinit(pkg_src_t * src);
 int pkg_src_verify(pkg_src_t * src);
 int pkg_src_update(pkg_src_t * src);
 
+/* The steps of pkg_src_update(), for updating several sources at once. The
+ * signature URL is NULL if no signature needs checking.
+ */
+char *pkg_src_list_url(pkg_src_t * src);
+char *pkg_src_signature_url(pkg_src_t * src);
+int pkg_src_install_list(pkg_src_t * src, const char *cache_location);
+int pkg_src_finish_update(pkg_src_t * src, const char *sig_cache_location);
+
 #ifdef __cplusplus
 }
 #endif
@@ -70,8 +70,7 @@ void pkg_vec_insert_merge(pkg_vec_t * vec, pkg_t * pkg, int set_status)
                 && ((pkg->state_want == SW_DEINSTALL
                         && (pkg->state_flag & SF_HOLD))
                     || ((pkg_compare_versions(pkg, vec->pkgs[i]) == 0)
-                        && (strcmp(pkg->architecture,
-                                   vec->pkgs[i]->architecture) == 0)));
+                        && (pkg->architecture == vec->pkgs[i]->architecture)));
         if (match) {
             found = 1;
             opkg_msg(DEBUG2, "Duplicate for pkg=%s version=%s arch=%s.\n",
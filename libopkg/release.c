@@ -30,12 +30,14 @@
 #include "opkg_archive.h"
 
 #include "opkg_download.h"
+#include "pkg_hash.h"
 #include "sprintf_alloc.h"
 
 #include "release_parse.h"
 
 #include "parse_util.h"
 #include "file_util.h"
+#include "list_diff.h"
 
 static void release_init(release_t * release)
 {
@@ -146,12 +148,16 @@ int release_verify_file(release_t * release, const char *file_name,
         ret = 1;
     } else {
 
-        f_md5 = file_md5sum_alloc(file_name);
 #ifdef HAVE_SHA256
-        f_sha256 = file_sha256sum_alloc(file_name);
+        r = file_checksums_alloc(file_name, md5 ? &f_md5 : NULL,
+                                 sha256 ? &f_sha256 : NULL);
+#else
+        r = file_checksums_alloc(file_name, md5 ? &f_md5 : NULL, NULL);
 #endif
 
-        if (md5 && strcmp(md5, f_md5)) {
+        if (r != 0) {
+            ret = 1;
+        } else if (md5 && strcmp(md5, f_md5)) {
             opkg_msg(ERROR, "MD5 verification failed for %s - %s.\n",
                      release->name, pathname);
             ret = 1;
@@ -173,6 +179,20 @@ int release_verify_file(release_t * release, const char *file_name,
     return ret;
 }
 
+/* Returns the SHA256 checksum the Release file gives pathname, or NULL if it
+ * lists none.
+ */
+const char *release_file_sha256(release_t * release, const char *pathname)
+{
+    const cksum_t *cksum;
+
+    if (!release->sha256sums)
+        return NULL;
+
+    cksum = cksum_list_find(release->sha256sums, pathname);
+    return cksum ? cksum->value : NULL;
+}
+
 release_t *release_new(void)
 {
     release_t *release;
@@ -315,6 +335,7 @@ int release_download(release_t * release, pkg_src_t * dist, char *lists_dir,
             char *url;
             char *list_file_name;
             char *subpath = NULL;
+            int patched = 0;
 
             nv_pair_t *nv = (nv_pair_t *) l->data;
 
@@ -324,7 +345,25 @@ int release_download(release_t * release, pkg_src_t * dist, char *lists_dir,
             sprintf_alloc(&subpath, "%s/binary-%s/%s", comps[i], nv->name,
                           dist->gzip ? "Packages.gz" : "Packages");
 
-            if (dist->gzip) {
+            if (opkg_config->index_diffs) {
+                char *list_subpath;
+                const char *sha256;
+
+                sprintf_alloc(&url, "%s-%s/Packages", prefix, nv->name);
+                sprintf_alloc(&list_subpath, "%s/binary-%s/Packages", comps[i],
+                              nv->name);
+                sha256 = release_file_sha256(release, list_subpath);
+                /* Nothing vouches for patches the Release file gives no
+                 * SHA256 to check the result against. */
+                if (sha256 && list_diff_update(url, list_file_name, sha256) == 0) {
+                    patched = 1;
+                    err = 0;
+                }
+                free(list_subpath);
+                free(url);
+            }
+
+            if (dist->gzip && !patched) {
                 char *cache_location;
                 sprintf_alloc(&url, "%s-%s/Packages.gz", prefix, nv->name);
                 cache_location = opkg_download_cache(url, NULL, NULL);
@@ -349,19 +388,39 @@ int release_download(release_t * release, pkg_src_t * dist, char *lists_dir,
                 free(cache_location);
             }
 
-            if (!dist->gzip || err) {
+            if (!patched && (!dist->gzip || err)) {
+                /* Verified against the checksums of the uncompressed list. */
+                if (dist->gzip) {
+                    free(subpath);
+                    sprintf_alloc(&subpath, "%s/binary-%s/Packages", comps[i],
+                                  nv->name);
+                }
                 sprintf_alloc(&url, "%s-%s/Packages", prefix, nv->name);
                 err = opkg_download(url, list_file_name, NULL, NULL);
                 if (!err) {
-                    if (opkg_config->compress_list_files)
-                        err = file_gz_compress(list_file_name);
                     err = release_verify_file(release, list_file_name, subpath);
                     if (err)
                         unlink(list_file_name);
+                    else if (opkg_config->compress_list_files)
+                        err = file_gz_compress(list_file_name);
                 }
                 free(url);
             }
 
+            if (!err && opkg_config->feed_index) {
+                char *index_file_name;
+
+                /* However it came, the list ends up compressed if
+                 * compress_list_files is set. */
+                sprintf_alloc(&index_file_name, "%s/%s-%s-%s%s", lists_dir,
+                              dist->name, comps[i], nv->name,
+                              opkg_config->compress_list_files ? ".gz" : "");
+                if (file_exists(index_file_name))
+                    pkg_hash_index_file(index_file_name, 0);
+                free(index_file_name);
+            }
+
+            free(subpath);
             free(list_file_name);
         }
 
@@ -373,3 +432,114 @@ int release_download(release_t * release, pkg_src_t * dist, char *lists_dir,
 
     return ret;
 }
+
+static void release_list_set_url(release_list_t * list, const char *comp,
+                                 const char *arch)
+{
+    const char *name = list->gzip ? "Packages.gz" : "Packages";
+
+    sprintf_alloc(&list->url, "%s/dists/%s/%s/binary-%s/%s", list->dist->value,
+                  list->dist->name, comp, arch, name);
+    sprintf_alloc(&list->subpath, "%s/binary-%s/%s", comp, arch, name);
+}
+
+/*
+ * Returns the lists release_download() would fetch for dist, one per
+ * component and architecture.
+ */
+release_list_t *release_lists(release_t * release, pkg_src_t * dist,
+                              const char *lists_dir, unsigned int *count)
+{
+    unsigned int ncomp;
+    const char **comps = release_comps(release, &ncomp);
+    release_list_t *lists = NULL;
+    nv_pair_list_elt_t *l;
+    unsigned int i, n = 0;
+
+    for (i = 0; i < ncomp; i++) {
+        list_for_each_entry(l, &opkg_config->arch_list.head, node) {
+            nv_pair_t *nv = (nv_pair_t *) l->data;
+            release_list_t *list;
+
+            lists = xrealloc(lists, (n + 1) * sizeof(*lists));
+            list = &lists[n++];
+            list->release = release;
+            list->dist = dist;
+            list->gzip = dist->gzip;
+            release_list_set_url(list, comps[i], nv->name);
+            sprintf_alloc(&list->list_file_name, "%s/%s-%s-%s", lists_dir,
+                          dist->name, comps[i], nv->name);
+        }
+    }
+
+    *count = n;
+    return lists;
+}
+
+/*
+ * Verifies a downloaded list against the Release file and puts it in place.
+ * This may run on a thread of its own.
+ */
+int release_list_install(release_list_t * list, const char *cache_location)
+{
+    int err;
+
+    err = release_verify_file(list->release, cache_location, list->subpath);
+    if (err) {
+        unlink(list->list_file_name);
+        return err;
+    }
+
+    if (list->gzip) {
+        if (opkg_config->compress_list_files) {
+            char *gz_file_name;
+
+            sprintf_alloc(&gz_file_name, "%s.gz", list->list_file_name);
+            err = file_copy(cache_location, gz_file_name);
+            free(gz_file_name);
+        } else {
+            err = file_decompress(cache_location, list->list_file_name);
+        }
+    } else {
+        err = file_copy(cache_location, list->list_file_name);
+        if (!err && opkg_config->compress_list_files)
+            err = file_gz_compress(list->list_file_name);
+    }
+    if (err)
+        opkg_msg(ERROR, "Couldn't %s %s.\n",
+                 (opkg_config->compress_list_files) ? "copy" : "decompress",
+                 list->url);
+
+    return err;
+}
+
+/*
+ * Points a gzipped list at its uncompressed version, to fall back on.
+ * Returns 0 if it did, -1 if the list is not gzipped.
+ */
+int release_list_ungzip(release_list_t * list)
+{
+    char *end;
+
+    if (!list->gzip)
+        return -1;
+
+    list->gzip = 0;
+    end = strrchr(list->url, '.');
+    *end = '\0';
+    end = strrchr(list->subpath, '.');
+    *end = '\0';
+    return 0;
+}
+
+void release_lists_free(release_list_t * lists, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        free(lists[i].url);
+        free(lists[i].subpath);
+        free(lists[i].list_file_name);
+    }
+    free(lists);
+}
@@ -42,13 +42,29 @@ struct release {
 
 typedef struct release release_t;
 
+/* A Packages list of a dist, for fetching those of several dists at once. */
+typedef struct {
+    release_t *release;
+    pkg_src_t *dist;
+    char *url;
+    char *subpath;              /* of url in the Release file */
+    char *list_file_name;
+    int gzip;
+} release_list_t;
+
 release_t *release_new(void);
 void release_deinit(release_t * release);
 int release_init_from_file(release_t * release, const char *filename);
 int release_comps_supported(release_t * release, const char *complist);
+const char *release_file_sha256(release_t * release, const char *pathname);
 int release_download(release_t * release, pkg_src_t * dist, char *lists_dir,
                      char *tmpdir);
 const char **release_comps(release_t * release, unsigned int *count);
+release_list_t *release_lists(release_t * release, pkg_src_t * dist,
+                              const char *lists_dir, unsigned int *count);
+int release_list_install(release_list_t * list, const char *cache_location);
+int release_list_ungzip(release_list_t * list);
+void release_lists_free(release_list_t * lists, unsigned int count);
 
 #ifdef __cplusplus
 }
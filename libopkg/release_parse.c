@@ -65,6 +65,9 @@ static int release_parse_line(void *ptr, const char *line, uint mask)
     case 'M':
         if (is_field("MD5Sum", line)) {
             reading_md5sums = 1;
+#ifdef HAVE_SHA256
+            reading_sha256sums = 0;
+#endif
             if (release->md5sums == NULL) {
                 release->md5sums = xcalloc(1, sizeof(cksum_list_t));
                 cksum_list_init(release->md5sums);
@@ -77,6 +80,7 @@ static int release_parse_line(void *ptr, const char *line, uint mask)
     case 'S':
         if (is_field("SHA256", line)) {
             reading_sha256sums = 1;
+            reading_md5sums = 0;
             if (release->sha256sums == NULL) {
                 release->sha256sums = xcalloc(1, sizeof(cksum_list_t));
                 cksum_list_init(release->sha256sums);
@@ -20,6 +20,7 @@
 #include "opkg_solver_internal.h"
 #include "pkg_depends.h"
 #include "opkg_install.h"
+#include "opkg_download.h"
 #include "opkg_remove.h"
 #include "opkg_message.h"
 #include "opkg_utils.h"
@@ -154,6 +155,33 @@ static int opkg_prepare_install_by_name(const char *pkg_name, pkg_t **pkg)
     return 1;
 }
 
+/* Fetches the packages about to be installed together when parallel
+ * downloads are enabled. A package that fails here is tried again, and
+ * reported, by opkg_install_pkg().
+ */
+static void opkg_prefetch_pkgs(pkg_vec_t *pkgs_to_install)
+{
+    pkg_vec_t *pkgs;
+    pkg_t *pkg;
+    unsigned int i;
+
+    if (opkg_config->noaction || opkg_config->parallel_downloads < 2)
+        return;
+
+    pkgs = pkg_vec_alloc();
+    for (i = 0; i < pkgs_to_install->len; i++) {
+        pkg = pkgs_to_install->pkgs[i];
+        if (pkg->state_status == SS_INSTALLED
+                || pkg->state_status == SS_UNPACKED || pkg->local_filename)
+            continue;
+        pkg_vec_insert(pkgs, pkg);
+    }
+
+    if (pkgs->len > 1)
+        opkg_download_pkgs(pkgs, NULL, NULL);
+    pkg_vec_free(pkgs);
+}
+
 int opkg_execute_install(pkg_t *pkg, pkg_vec_t *pkgs_to_install, pkg_vec_t *replacees, pkg_vec_t *orphans, int from_upgrade)
 {
     int r, errors = 0;
@@ -163,6 +191,8 @@ int opkg_execute_install(pkg_t *pkg, pkg_vec_t *pkgs_to_install, pkg_vec_t *repl
     /* Add top level package to pkgs_to_install vector */
     pkg_vec_insert(pkgs_to_install, pkg);
 
+    opkg_prefetch_pkgs(pkgs_to_install);
+
     /* Remove orphans */
     pkg_remove_installed(orphans);
 
@@ -875,11 +875,15 @@ static int requires_download(Id typeId)
 static int libsolv_solver_transaction_preamble(libsolv_solver_t *libsolv_solver, pkg_vec_t *pkgs, Transaction *transaction, int no_action)
 {
     pkg_t *pkg;
-    int i;
+    pkg_vec_t *pkgs_to_download;
+    unsigned int j;
+    int i, err = 0;
 
     /* order the transaction so dependencies are handled first */
     transaction_order(transaction, 0);
 
+    pkgs_to_download = pkg_vec_alloc();
+
     for (i = 0; i < transaction->steps.count; i++) {
         Id stepId = transaction->steps.elements[i];
         Solvable *solvable = pool_id2solvable(libsolv_solver->pool, stepId);
@@ -897,17 +901,25 @@ static int libsolv_solver_transaction_preamble(libsolv_solver_t *libsolv_solver,
         pkg_vec_insert(pkgs, pkg);
 
         if (!no_action && pkg->local_filename == NULL &&
-            opkg_config->download_first && requires_download(typeId)) {
-            if (opkg_download_pkg(pkg)) {
-                opkg_msg(ERROR,
-                         "Failed to download %s. "
-                         "Perhaps you need to run 'opkg update'?\n", pkg->name);
-                return -1;
-            }
+            opkg_config->download_first && requires_download(typeId))
+            pkg_vec_insert(pkgs_to_download, pkg);
+    }
+
+    /* Fetch them all at once so that parallel downloads can be used. */
+    if (pkgs_to_download->len && opkg_download_pkgs(pkgs_to_download, NULL, NULL)) {
+        for (j = 0; j < pkgs_to_download->len; j++) {
+            pkg = pkgs_to_download->pkgs[j];
+            if (pkg->local_filename)
+                continue;
+            opkg_msg(ERROR,
+                     "Failed to download %s. "
+                     "Perhaps you need to run 'opkg update'?\n", pkg->name);
         }
+        err = -1;
     }
 
-    return 0;
+    pkg_vec_free(pkgs_to_download);
+    return err;
 }
 
 static int libsolv_solver_execute_transaction(libsolv_solver_t *libsolv_solver)
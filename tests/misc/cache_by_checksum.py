@@ -0,0 +1,85 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# With cache_by_checksum, a package in the cache is found by its checksum
+# whatever URL it was downloaded from. Check that a package moved to another
+# feed is installed from the cache rather than downloaded again, and that a
+# checksum which isn't one is never taken for a file name.
+#
+
+import glob
+import hashlib
+import os
+import shutil
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+conffile = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg/opkg.conf'
+with open(conffile, 'a') as f:
+    f.write('option cache_local_files 1\n')
+    f.write('option cache_by_checksum 1\n')
+
+o = opk.OpkGroup()
+o.add(Package='a')
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+opkgcl.install('a')
+if not opkgcl.is_installed('a'):
+    opk.fail("Package 'a' failed to install.")
+opkgcl.remove('a')
+
+# Publish the list alone under another feed, without the package itself.
+os.makedirs('mirror', exist_ok=True)
+shutil.copy('Packages', 'mirror/Packages')
+with open(conffile) as f:
+    conf = f.read()
+with open(conffile, 'w') as f:
+    f.write(conf.replace('src test file:{}'.format(cfg.opkdir),
+                         'src mirror file:{}/mirror'.format(cfg.opkdir)))
+
+# What was recorded about a file the cache had under the new URL goes.
+cachedir = cfg.offline_root + os.environ['VARDIR'] + '/cache/opkg'
+url = 'file:{}/mirror/a_1.0_all.opk'.format(cfg.opkdir)
+location = '{}/{}_a_1.0_all.opk'.format(
+    cachedir, hashlib.md5(url.encode()).hexdigest())
+for suffix in ['', '.@stamp', '.@sums']:
+    with open(location + suffix, 'w') as f:
+        f.write('stale\n')
+
+opkgcl.update()
+opkgcl.install('a')
+if not opkgcl.is_installed('a'):
+    opk.fail("Package 'a' not installed from the cache under another URL.")
+for suffix in ['.@stamp', '.@sums']:
+    if os.path.exists(location + suffix):
+        opk.fail("Stale {} kept for the relinked cache entry.".format(suffix))
+
+cached = glob.glob(cfg.offline_root + '/**/*_a_1.0_all.opk', recursive=True)
+if len(cached) != 2 or not os.path.samefile(cached[0], cached[1]):
+    opk.fail("Package 'a' not cached once for both URLs.")
+
+# A feed naming a file outside the cache for a checksum.
+victim = cachedir + '/../victim'
+with open(victim, 'w') as f:
+    f.write('victim\n')
+
+o = opk.OpkGroup()
+o.add(Package='b')
+o.write_opk()
+o.write_list('b.list')
+shutil.move('b_1.0_all.opk', 'mirror/b_1.0_all.opk')
+with open('b.list') as f:
+    stanza = ''.join(line if not line.startswith('MD5Sum:')
+                     else 'MD5Sum: ../victim\n' for line in f)
+with open('mirror/Packages', 'a') as f:
+    f.write(stanza)
+
+opkgcl.update()
+opkgcl.install('b')
+if opkgcl.is_installed('b'):
+    opk.fail("Package 'b' installed despite its malformed checksum.")
+if not os.path.exists(victim):
+    opk.fail("File outside the cache removed for a malformed checksum.")
@@ -0,0 +1,47 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# The checksums of a package in the cache are recorded beside it so that
+# installing it again need not read it to verify it. Check that they are
+# recorded, and that a package changed in place after they were taken is
+# still caught as corrupt.
+#
+
+import glob
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+with open('asdf', 'w') as f:
+    f.write('asdf\n' * 100)
+o = opk.OpkGroup()
+a = o.add(Package='a')
+a.write(data_files=['asdf'])
+o.write_list()
+os.unlink('asdf')
+
+opkgcl.update()
+opkgcl.install('a')
+if not opkgcl.is_installed('a'):
+    opk.fail("Package 'a' failed to install.")
+sums = glob.glob(cfg.offline_root + '/**/*_a_1.0_all.opk.@sums', recursive=True)
+if len(sums) != 1:
+    opk.fail("No checksums recorded for package 'a' in the cache.")
+
+opkgcl.remove('a')
+opkgcl.install('a')
+if not opkgcl.is_installed('a'):
+    opk.fail("Package 'a' failed to install from the cache.")
+
+# Flip a byte of the package without changing its size.
+opkgcl.remove('a')
+with open(a.control['Filename'], 'r+b') as f:
+    f.seek(-16, os.SEEK_END)
+    b = f.read(1)
+    f.seek(-16, os.SEEK_END)
+    f.write(bytes([b[0] ^ 0xff]))
+
+opkgcl.install('a')
+if opkgcl.is_installed('a'):
+    opk.fail("Package 'a' installed although it changed in the cache.")
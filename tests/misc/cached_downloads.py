@@ -0,0 +1,71 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Lists and packages fetched over http are cached with a stamp of what the
+# server sent, and checked against it with a single conditional request.
+# Serve the feed over http and check that an unchanged list is kept on a
+# 304, an interrupted download is resumed with a 206, a changed list is
+# replaced and a stamp in the old format just costs a full download.
+#
+
+import glob
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+server = opk.serve_feed()
+
+listfile = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/lists/test'
+
+o = opk.OpkGroup()
+for name in ['a', 'b', 'c']:
+    o.add(Package=name, Description='Package {} '.format(name) + 'x' * 500)
+o.write_opk()
+o.write_list()
+
+
+def update(code):
+    """Updates the feed, which must take one request for its list answered
+    with code, and checks that the list is the current one."""
+    if opkgcl.update() != 0:
+        opk.fail("Update failed.")
+    requests = server.requests()
+    if requests != [('/Packages', code)]:
+        opk.fail("Expected the list to be fetched with a {} but got {}."
+                 .format(code, requests))
+    with open('Packages', 'rb') as f, open(listfile, 'rb') as g:
+        if f.read() != g.read():
+            opk.fail("List does not match the feed's after a {}."
+                     .format(code))
+
+
+update(200)
+cached = glob.glob(cfg.offline_root + '/**/*_Packages', recursive=True)
+if len(cached) != 1 or not os.path.exists(cached[0] + '.@stamp'):
+    opk.fail("List not cached with a stamp.")
+cached = cached[0]
+
+# Unchanged, the cached copy is still good.
+update(304)
+
+# Cut short, the rest of it is asked for.
+with open(cached + '.@stamp') as f:
+    size, filetime, etag = f.read().split(' ', 2)
+if int(size) != os.path.getsize('Packages'):
+    opk.fail("Stamp records a size of {}.".format(size))
+with open(cached + '.@stamp', 'w') as f:
+    f.write('-1 {} {}'.format(filetime, etag))
+os.truncate(cached, 1000)
+update(206)
+
+# Changed, the list is downloaded again.
+o.add(Package='d')
+o.write_opk()
+o.write_list()
+update(200)
+
+# Stamps which only held an ETag aren't trusted.
+with open(cached + '.@stamp', 'w') as f:
+    f.write(etag)
+update(200)
+update(304)
@@ -0,0 +1,58 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Fields like Description and Maintainer are only read from the feed list
+# when a command shows them. Check that list, find and info still see them,
+# and that a verbose status file keeps them, and user fields, after an
+# install.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option verbose_status_file 1\n')
+
+status = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/status'
+
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0", Maintainer="Jane Doe <jane@example.com>",
+      Homepage="https://example.com/a",
+      Description="Short text\n Long description\n on two lines")
+o.add(Package="b", Version="1.0", Description="Something else")
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+
+out = opkgcl.opkgcl('list')[1]
+if "a - 1.0 - Short text" not in out:
+    opk.fail("Description of 'a' missing from list.")
+if "b - 1.0 - Something else" not in out:
+    opk.fail("Description of 'b' missing from list.")
+
+out = opkgcl.opkgcl('find "*else*"')[1]
+if "b - 1.0" not in out or "a - 1.0" in out:
+    opk.fail("find did not match on the description.")
+
+info = opkgcl.info("a")
+if "Maintainer: Jane Doe <jane@example.com>" not in info:
+    opk.fail("Maintainer of 'a' missing from info.")
+if "Long description\n on two lines" not in info:
+    opk.fail("Long description of 'a' missing from info.")
+
+opkgcl.install("a")
+if not opkgcl.is_installed("a"):
+    opk.fail("Package 'a' not installed.")
+
+with open(status) as f:
+    text = f.read()
+if "Maintainer: Jane Doe <jane@example.com>" not in text:
+    opk.fail("Maintainer of 'a' missing from the verbose status file.")
+if "Description: Short text\n Long description" not in text:
+    opk.fail("Description of 'a' missing from the verbose status file.")
+if "Homepage: https://example.com/a" not in text:
+    opk.fail("User field of 'a' missing from the verbose status file.")
@@ -0,0 +1,63 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# The md5sum of a conffile is taken as the file is extracted. Check that the
+# one recorded in the status file is that of the installed file, and that an
+# upgrade still keeps a conffile the user has changed, putting the one from
+# the new package beside it.
+#
+
+import hashlib
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+status_path = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/status'
+conf_path = cfg.offline_root + '/etc/a.conf'
+
+def md5sum(path):
+    with open(path, 'rb') as f:
+        return hashlib.md5(f.read()).hexdigest()
+
+def write_conf(text):
+    os.makedirs('etc', exist_ok=True)
+    with open('etc/a.conf', 'w') as f:
+        f.write(text)
+
+o = opk.OpkGroup()
+write_conf('setting=1\n' * 1000)
+a1 = o.add(Package='a', Version='1.0')
+a1.conffiles = ['/etc/a.conf']
+a1.write(data_files=['etc/a.conf'])
+o.write_list()
+
+opkgcl.update()
+opkgcl.install('a')
+if not opkgcl.is_installed('a', '1.0'):
+    opk.fail("Package 'a' failed to install.")
+
+with open(status_path) as f:
+    status = f.read()
+line = ' /etc/a.conf %s\n' % md5sum(conf_path)
+if 'Conffiles:\n' + line not in status:
+    opk.fail("Wrong md5sum recorded for conffile '/etc/a.conf'.")
+
+with open(conf_path, 'a') as f:
+    f.write('local=1\n')
+user_md5 = md5sum(conf_path)
+
+write_conf('setting=2\n' * 1000)
+a2 = o.add(Package='a', Version='2.0')
+a2.conffiles = ['/etc/a.conf']
+a2.write(data_files=['etc/a.conf'])
+o.write_list()
+
+opkgcl.update()
+opkgcl.upgrade('a')
+if not opkgcl.is_installed('a', '2.0'):
+    opk.fail("Package 'a' failed to upgrade.")
+if md5sum(conf_path) != user_md5:
+    opk.fail("Changed conffile '/etc/a.conf' not kept on upgrade.")
+if md5sum(conf_path + '-opkg') != md5sum('etc/a.conf'):
+    opk.fail("New conffile not placed at '/etc/a.conf-opkg'.")
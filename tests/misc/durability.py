@@ -0,0 +1,61 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# With "option durability batch", the status file and the file lists are
+# written under temporary names and renamed into place at the end of the
+# command. Check that they end up complete, that a file list written and then
+# read again in the same command is read back, and that removing a package
+# drops its file list for good.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option durability batch\n')
+
+vardir = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg'
+infodir = vardir + '/info'
+
+def check_no_leftovers():
+    for d in [vardir, infodir]:
+        for name in os.listdir(d):
+            if name.endswith('.new'):
+                opk.fail("Temporary file '%s' left in '%s'." % (name, d))
+
+def list_files(name):
+    with open('%s/%s.list' % (infodir, name)) as f:
+        return [line.split('\t')[0] for line in f]
+
+open("asdf", "w").close()
+open("qwer", "w").close()
+o = opk.OpkGroup()
+a = o.add(Package="a", Version="1.0", Architecture="all")
+a.write(data_files=["asdf", "qwer"])
+b = o.add(Package="b", Version="1.0", Architecture="all", Depends="a")
+b.write(data_files=["asdf"])
+o.write_list()
+os.unlink("asdf")
+os.unlink("qwer")
+
+opkgcl.update()
+
+# b takes asdf over from a, which was installed by the same command.
+opkgcl.install("b", "--force-overwrite")
+if not opkgcl.is_installed("a") or not opkgcl.is_installed("b"):
+    opk.fail("Packages 'a' and 'b' not installed.")
+check_no_leftovers()
+if list_files("a") != ["/qwer"]:
+    opk.fail("Wrong file list for 'a': %s." % list_files("a"))
+if list_files("b") != ["/asdf"]:
+    opk.fail("Wrong file list for 'b': %s." % list_files("b"))
+
+opkgcl.remove("b")
+if opkgcl.is_installed("b"):
+    opk.fail("Package 'b' not removed.")
+check_no_leftovers()
+if os.path.exists(infodir + '/b.list'):
+    opk.fail("File list of 'b' left after removing it.")
@@ -0,0 +1,52 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# With more than one extract thread, data archives are decompressed on a
+# thread of their own. Force that and check that a package spanning many
+# buffers installs intact, and that one whose data archive is cut short
+# fails to install rather than hanging.
+#
+
+import os
+import signal
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+# A hang is a failure too.
+signal.alarm(120)
+
+conffile = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg/opkg.conf'
+with open(conffile, 'a') as f:
+    f.write('option extract_threads 2\n')
+
+data = os.urandom(1024 * 1024)
+with open('big', 'wb') as f:
+    f.write(data)
+
+o = opk.OpkGroup()
+o.add(Package='a').write(data_files=['big'])
+o.add(Package='b', Version='1.0').write(data_files=['big'])
+os.unlink('big')
+
+# Cut the data archive of 'b' in half, keeping the package well-formed.
+b = o.opk_list[1].control['Filename']
+os.system('ar x {} data.tar.gz'.format(b))
+with open('data.tar.gz', 'r+b') as f:
+    f.truncate(os.path.getsize('data.tar.gz') // 2)
+os.system('ar r {} data.tar.gz 2>/dev/null'.format(b))
+os.unlink('data.tar.gz')
+o.write_list()
+
+opkgcl.update()
+
+opkgcl.install('a')
+if not opkgcl.is_installed('a'):
+    opk.fail("Package 'a' failed to install.")
+with open(cfg.offline_root + '/big', 'rb') as f:
+    if f.read() != data:
+        opk.fail("File of package 'a' not extracted intact.")
+
+opkgcl.remove('a')
+if opkgcl.install('b') == 0 or opkgcl.is_installed('b'):
+    opk.fail("Package 'b' installed despite its data archive being cut short.")
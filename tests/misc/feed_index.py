@@ -0,0 +1,49 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Enable the binary feed index and check that packages loaded from it behave
+# like the ones parsed from the text list, and that the index is rebuilt when
+# the list changes behind its back.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option feed_index 1\n')
+
+listsdir = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/lists'
+
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0-r1", Depends="b (>= 1.0)",
+      Description="Short\n Long description\n on two lines")
+o.add(Package="b", Version="2:1.0")
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+
+if not os.path.exists(listsdir + '/test.idx'):
+    opk.fail("Index of feed 'test' was not written by update.")
+
+info = opkgcl.info("a")
+if "Version: 1.0-r1" not in info:
+    opk.fail("Version of 'a' lost in the index.")
+if "Long description\n on two lines" not in info:
+    opk.fail("Description of 'a' lost in the index.")
+
+opkgcl.install("a")
+if not opkgcl.is_installed("a"):
+    opk.fail("Package 'a' not installed.")
+if not opkgcl.is_installed("b", "2:1.0"):
+    opk.fail("Dependency 'b' of 'a' not installed.")
+
+# Change the list without running update; the stale index must be ignored.
+with open(listsdir + '/test', 'a') as f:
+    f.write('\nPackage: c\nVersion: 1.0\nArchitecture: all\n\n')
+
+if "c - 1.0" not in opkgcl.opkgcl('list')[1]:
+    opk.fail("Package 'c' added to the list is not visible.")
@@ -0,0 +1,57 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Enable the file ownership index and check that owners loaded from it are
+# honoured, and that a record is ignored once its .list file changes behind
+# the index's back.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option file_index 1\n')
+
+vardir = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg'
+
+open("asdf", "w").close()
+open("qwer", "w").close()
+a = opk.Opk(Package="a", Version="1.0", Architecture="all")
+a.write(data_files=["asdf"])
+b = opk.Opk(Package="b", Version="1.0", Architecture="all")
+b.write(data_files=["asdf"])
+c = opk.Opk(Package="c", Version="1.0", Architecture="all")
+c.write(data_files=["qwer"])
+os.unlink("asdf")
+os.unlink("qwer")
+
+opkgcl.install("a_1.0_all.opk")
+if not opkgcl.is_installed("a"):
+    opk.fail("Package 'a' not installed.")
+if not os.path.exists(vardir + '/status.files.idx'):
+    opk.fail("File index was not written.")
+
+(status, output) = opkgcl.opkgcl("install b_1.0_all.opk")
+if opkgcl.is_installed("b"):
+    opk.fail("Package 'b' installed over a file owned by 'a'.")
+if "already provided by package" not in output or "<no package>" in output:
+    opk.fail("Owner of asdf lost in the file index.")
+
+# Hand 'a' another file without going through opkg; the stale record must
+# be ignored in favour of the .list file.
+open("{}/qwer".format(cfg.offline_root), "w").close()
+with open(vardir + '/info/a.list', 'a') as f:
+    f.write("{}/qwer\n".format(cfg.offline_root))
+
+(status, output) = opkgcl.opkgcl("install c_1.0_all.opk")
+if opkgcl.is_installed("c"):
+    opk.fail("Package 'c' installed over a file owned by 'a'.")
+if "already provided by package" not in output or "<no package>" in output:
+    opk.fail("Stale file index record was used.")
+
+opkgcl.remove("a")
+if opkgcl.is_installed("a"):
+    opk.fail("Package 'a' not removed.")
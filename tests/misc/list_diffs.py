@@ -0,0 +1,177 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Enable index diffs and check that update patches the local list from the
+# Packages.diff published next to the feed, and that it falls back on the
+# full list when the patches don't lead to the current one, or when the
+# Release file of a dist has no SHA256 to check the result against.
+#
+
+import difflib
+import gzip
+import hashlib
+import os
+import shutil
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option index_diffs 1\n')
+
+listsdir = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/lists'
+
+
+def sha256(data):
+    return hashlib.sha256(data).hexdigest()
+
+
+def ed_script(old, new):
+    """The ed script "diff --ed" would make from old to new."""
+    a = old.decode().splitlines(True)
+    b = new.decode().splitlines(True)
+    script = ''
+    ops = difflib.SequenceMatcher(None, a, b, autojunk=False).get_opcodes()
+    for tag, i1, i2, j1, j2 in reversed(ops):
+        if tag == 'equal':
+            continue
+        if tag == 'insert':
+            script += '{}a\n'.format(i1)
+        else:
+            lines = str(i1 + 1) if i2 - i1 == 1 else '{},{}'.format(i1 + 1, i2)
+            script += lines + ('d\n' if tag == 'delete' else 'c\n')
+        if tag != 'delete':
+            script += ''.join(b[j1:j2]) + '.\n'
+    return script.encode()
+
+
+def write_diffs(lists, dir='.'):
+    """Publish patches from each of lists to the next, the last one being
+    the current list."""
+    diff_dir = os.path.join(dir, 'Packages.diff')
+    os.makedirs(diff_dir, exist_ok=True)
+    history = patches = ''
+    for n in range(len(lists) - 1):
+        script = ed_script(lists[n], lists[n + 1])
+        name = 'T-{}'.format(n)
+        with open('{}/{}.gz'.format(diff_dir, name), 'wb') as f:
+            f.write(gzip.compress(script))
+        history += ' {} {} {}\n'.format(sha256(lists[n]), len(lists[n]), name)
+        patches += ' {} {} {}\n'.format(sha256(script), len(script), name)
+    with open(diff_dir + '/Index', 'w') as f:
+        f.write('SHA256-Current: {} {}\n'.format(sha256(lists[-1]),
+                                                 len(lists[-1])))
+        f.write('SHA256-History:\n' + history)
+        f.write('SHA256-Patches:\n' + patches)
+
+
+def read_list():
+    with open('Packages', 'rb') as f:
+        return f.read()
+
+
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0")
+o.add(Package="b", Version="1.0")
+o.write_opk()
+o.write_list()
+first = read_list()
+
+opkgcl.update()
+
+o.add(Package="c", Version="1.0")
+o.write_opk()
+o.write_list()
+second = read_list()
+
+o = opk.OpkGroup()
+o.add(Package="b", Version="2.0")
+o.add(Package="c", Version="1.0")
+o.write_opk()
+o.write_list()
+third = read_list()
+
+write_diffs([first, second, third])
+
+# Only the patches are there to bring the list up to date.
+os.unlink('Packages')
+if opkgcl.update() != 0:
+    opk.fail("Update failed to patch the list.")
+with open(listsdir + '/test', 'rb') as f:
+    if f.read() != third:
+        opk.fail("Patched list does not match the current one.")
+if "b - 2.0" not in opkgcl.opkgcl('list')[1]:
+    opk.fail("Package 'b' not upgraded by the patches.")
+
+# A list the patches don't know of is downloaded in full.
+o.add(Package="d", Version="1.0")
+o.write_opk()
+o.write_list()
+with open(listsdir + '/test', 'ab') as f:
+    f.write(b'Package: e\nVersion: 1.0\nArchitecture: all\n\n')
+
+if opkgcl.update() != 0:
+    opk.fail("Update failed to download the full list.")
+with open(listsdir + '/test', 'rb') as f:
+    if f.read() != read_list():
+        opk.fail("Unknown list was not replaced with the full one.")
+
+# The lists of a dist are only patched when its Release file has a SHA256
+# of the result; nothing else vouches for the patches.
+dist_dir = 'dists/d/main/binary-all'
+shutil.rmtree('dists', ignore_errors=True)
+os.makedirs(dist_dir)
+
+
+def write_dist(packages, with_sha256):
+    o = opk.OpkGroup()
+    for name in packages:
+        o.add(Package=name, Version='1.0')
+    o.write_opk()
+    o.write_list(dist_dir + '/Packages')
+    with open(dist_dir + '/Packages', 'rb') as f:
+        data = f.read()
+    with open('dists/d/Release', 'w') as f:
+        f.write('Codename: d\nArchitectures: all\nComponents: main\n')
+        f.write('MD5Sum:\n {} {} main/binary-all/Packages\n'.format(
+            hashlib.md5(data).hexdigest(), len(data)))
+        if with_sha256:
+            f.write('SHA256:\n {} {} main/binary-all/Packages\n'.format(
+                sha256(data), len(data)))
+    return data
+
+
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('dist d file:{} main\n'.format(cfg.opkdir))
+
+first = write_dist(['m'], False)
+if opkgcl.update() != 0:
+    opk.fail("Update failed to download the list of the dist.")
+
+second = write_dist(['m', 'n'], False)
+evil = first.replace(b'Package: m', b'Package: evil')
+write_diffs([first, evil], dist_dir)
+if opkgcl.update() != 0:
+    opk.fail("Update of the dist failed.")
+with open(listsdir + '/d-main-all', 'rb') as f:
+    if f.read() != second:
+        opk.fail("List of a dist patched without a SHA256 to check it.")
+
+# Patched with compress_list_files, the index of the list is rebuilt.
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option compress_list_files 1\n')
+    f.write('option feed_index 1\n')
+opkgcl.update()
+third = write_dist(['m', 'n', 'o'], True)
+write_diffs([second, third], dist_dir)
+index = listsdir + '/d-main-all.gz.idx'
+if os.path.exists(index):
+    os.unlink(index)
+if opkgcl.update() != 0:
+    opk.fail("Update failed to patch the list of the dist.")
+with gzip.open(listsdir + '/d-main-all.gz', 'rb') as f:
+    if f.read() != third:
+        opk.fail("List of the dist not patched to the current one.")
+if not os.path.exists(index):
+    opk.fail("Index of the patched list not rebuilt.")
@@ -0,0 +1,61 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# With parallel_downloads, the packages an install needs are fetched
+# together. Serve the feed over http and check that a package and its
+# dependencies are each downloaded once, into the cache, and installed.
+#
+
+import filecmp
+import glob
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+server = opk.serve_feed()
+
+conffile = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg/opkg.conf'
+with open(conffile, 'a') as f:
+    f.write('option parallel_downloads 4\n')
+
+names = ['a', 'b', 'c', 'd', 'e', 'f']
+o = opk.OpkGroup()
+o.add(Package='a', Depends=', '.join(names[1:]))
+for name in names[1:]:
+    with open(name, 'w') as f:
+        f.write(name * 1000)
+    o.add(Package=name).write(data_files=[name])
+    os.unlink(name)
+o.opk_list[0].write()
+o.write_list()
+
+if opkgcl.update() != 0:
+    opk.fail("Update failed.")
+server.requests()
+
+if opkgcl.install('a') != 0:
+    opk.fail("Install of 'a' failed.")
+for name in names:
+    if not opkgcl.is_installed(name):
+        opk.fail("Package '{}' not installed.".format(name))
+
+fetched = sorted(path for path, code in server.requests() if code == 200)
+if fetched != ['/{}_1.0_all.opk'.format(name) for name in names]:
+    opk.fail("Packages not downloaded once each: {}.".format(fetched))
+
+for name in names:
+    cached = glob.glob(cfg.offline_root + '/**/*_{}_1.0_all.opk'.format(name),
+                       recursive=True)
+    if len(cached) != 1 or not filecmp.cmp(cached[0],
+                                           '{}_1.0_all.opk'.format(name),
+                                           shallow=False):
+        opk.fail("Package '{}' not in the cache.".format(name))
+
+# Installing again is served from the cache.
+opkgcl.remove('a', '--autoremove')
+if opkgcl.is_installed('f'):
+    opk.fail("Dependency 'f' not removed with 'a'.")
+if opkgcl.install('a') != 0 or not opkgcl.is_installed('f'):
+    opk.fail("Install of 'a' from the cache failed.")
+if server.requests():
+    opk.fail("Cached packages were downloaded again.")
@@ -0,0 +1,104 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# With parallel_downloads, update fetches the lists of all the feeds and
+# dists together. Serve several feeds, one of them missing, and a dist with
+# a corrupt gzipped list over http, and check that the lists and the exit
+# status are those of updating one source after the other.
+#
+
+import gzip
+import hashlib
+import os
+import shutil
+import opk, cfg, opkgcl
+
+opk.regress_init()
+server = opk.serve_feed()
+
+conffile = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg/opkg.conf'
+listsdir = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/lists'
+
+for d in ['f1', 'f2', 'missing', 'dists']:
+    shutil.rmtree(d, ignore_errors=True)
+
+
+def write_list(path, *names):
+    o = opk.OpkGroup()
+    for name in names:
+        o.add(Package=name)
+    o.write_opk()
+    os.makedirs(os.path.dirname(path) or '.', exist_ok=True)
+    o.write_list(path)
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def gzip_list(path):
+    with open(path, 'rb') as f:
+        data = gzip.compress(f.read())
+    with open(path + '.gz', 'wb') as f:
+        f.write(data)
+    return data
+
+
+write_list('Packages', 'a')
+write_list('f1/Packages', 'b')
+gzip_list('f1/Packages')
+write_list('f2/Packages', 'c')
+
+# The gzipped list of the extra component doesn't match the Release file,
+# its uncompressed list is fetched instead.
+release = {}
+main = write_list('dists/d/main/binary-all/Packages', 'd')
+release['main/binary-all/Packages'] = main
+release['main/binary-all/Packages.gz'] = gzip_list(
+    'dists/d/main/binary-all/Packages')
+release['extra/binary-all/Packages'] = write_list(
+    'dists/d/extra/binary-all/Packages', 'e')
+release['extra/binary-all/Packages.gz'] = gzip.compress(main)
+with open('dists/d/extra/binary-all/Packages.gz', 'wb') as f:
+    f.write(gzip.compress(release['extra/binary-all/Packages'] + b'\n'))
+with open('dists/d/Release', 'w') as f:
+    f.write('Codename: d\nArchitectures: all\nComponents: main extra\n')
+    f.write('MD5Sum:\n')
+    for path, data in release.items():
+        f.write(' {} {} {}\n'.format(hashlib.md5(data).hexdigest(),
+                                      len(data), path))
+
+with open(conffile, 'a') as f:
+    f.write('src/gz f1 {}/f1\n'.format(server.url))
+    f.write('src f2 {}/f2\n'.format(server.url))
+    f.write('src/gz missing {}/missing\n'.format(server.url))
+    f.write('dist/gz d {} main extra\n'.format(server.url))
+
+
+def update():
+    shutil.rmtree(listsdir, ignore_errors=True)
+    status = opkgcl.update()
+    lists = {}
+    for name in os.listdir(listsdir):
+        with open(os.path.join(listsdir, name), 'rb') as f:
+            lists[name] = f.read()
+    return status, lists
+
+
+status, lists = update()
+if status == 0:
+    opk.fail("Update succeeded despite a missing feed.")
+for name in ['test', 'f1', 'f2', 'd', 'd-main-all', 'd-extra-all']:
+    if name not in lists:
+        opk.fail("No list for {} updating one by one.".format(name))
+
+with open(conffile, 'a') as f:
+    f.write('option parallel_downloads 2\n')
+
+parallel_status, parallel_lists = update()
+if parallel_status != status:
+    opk.fail("Parallel update exited with {} rather than {}.".format(
+        parallel_status, status))
+if parallel_lists != lists:
+    opk.fail("Parallel update fetched lists {} rather than {}.".format(
+        sorted(parallel_lists), sorted(lists)))
+if b'Package: e' not in parallel_lists['d-extra-all']:
+    opk.fail("Corrupt gzipped list of the dist not replaced.")
@@ -0,0 +1,40 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Parse several feed lists on parser threads and check that every package is
+# loaded and that a package found in more than one feed still comes from the
+# last of them, as when the lists are read one after the other.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+feeds = ['feed{}'.format(i) for i in range(6)]
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option parse_threads 4\n')
+    for feed in feeds:
+        f.write('src {} file:{}/{}\n'.format(feed, cfg.opkdir, feed))
+
+listsdir = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/lists'
+os.makedirs(listsdir)
+
+for feed in feeds:
+    with open('{}/{}'.format(listsdir, feed), 'w') as f:
+        f.write('Package: dup\nVersion: 1.0\nArchitecture: all\n'
+                'Description: from {}\n\n'.format(feed))
+        for i in range(500):
+            f.write('Package: {}-{}\nVersion: 1.0\nArchitecture: all\n\n'
+                    .format(feed, i))
+
+out = opkgcl.opkgcl('list')[1]
+for feed in feeds:
+    for i in range(500):
+        if '{}-{} - 1.0'.format(feed, i) not in out:
+            opk.fail("Package '{}-{}' not loaded.".format(feed, i))
+
+if "Description: from feed5" not in opkgcl.info("dup"):
+    opk.fail("Package 'dup' not taken from the last feed.")
@@ -0,0 +1,36 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Install packages stored as ar archives with differently compressed members
+# and as a tar.gz archive, and check that both their control and data
+# archives are read.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+def check_installed(name, data_file):
+    if not opkgcl.is_installed(name):
+        opk.fail("Package '%s' not installed." % name)
+    if not os.path.exists("%s/%s" % (cfg.offline_root, data_file)):
+        opk.fail("Data file '%s' of '%s' not installed." % (data_file, name))
+    if not os.path.exists("%s/%s.postinst-ran" % (cfg.offline_root, name)):
+        opk.fail("Postinst of '%s' did not run." % name)
+
+packages = [("gz", "ar-gz", False, "gz"),
+            ("xz", "ar-xz", False, "xz"),
+            ("tar", "tar-gz", True, "gz")]
+
+for (name, data_file, tar_not_ar, compression) in packages:
+    open(data_file, "w").close()
+    pkg = opk.Opk(Package=name, Version="1.0", Architecture="all")
+    pkg.postinst = "#!/bin/sh\ntouch ${PKG_ROOT}%s.postinst-ran\n" % name
+    pkg.write(tar_not_ar=tar_not_ar, data_files=[data_file],
+              compression=compression)
+    os.unlink(data_file)
+
+for (name, data_file, tar_not_ar, compression) in packages:
+    opkgcl.install("%s_1.0_all.opk" % name)
+    check_installed(name, data_file)
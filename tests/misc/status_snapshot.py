@@ -0,0 +1,41 @@
+#! /usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Enable the binary status snapshot, install a package and check that the
+# snapshot is written and then ignored once the text status file changes,
+# even by a rewrite that keeps its size and mtime.
+#
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+confdir = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg'
+with open(confdir + '/opkg.conf', 'a') as f:
+    f.write('option status_snapshot 1\n')
+
+status = cfg.offline_root + os.environ['VARDIR'] + '/lib/opkg/status'
+
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0")
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+opkgcl.install("a")
+
+if not os.path.exists(status + '.idx'):
+    opk.fail("Status snapshot was not written.")
+if not opkgcl.is_installed("a", "1.0"):
+    opk.fail("Package 'a' not installed.")
+
+st = os.stat(status)
+with open(status) as f:
+    text = f.read()
+with open(status, 'w') as f:
+    f.write(text.replace('Version: 1.0', 'Version: 1.1'))
+os.utime(status, ns=(st.st_atime_ns, st.st_mtime_ns))
+
+if not opkgcl.is_installed("a", "1.1"):
+    opk.fail("Stale status snapshot used after the status file changed.")
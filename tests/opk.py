@@ -1,11 +1,15 @@
 # SPDX-License-Identifier: GPL-2.0-only
+import email.utils
 import errno
+import functools
 import hashlib
+import http.server
 import os
 import os.path
 import stat
 import sys
 import tarfile
+import threading
 from pathlib import Path
 
 import cfg
@@ -40,6 +44,7 @@ class Opk:
         'Version',
         ]
 
+    conffiles = None
     control = None
     postinst = None
     postrm = None
@@ -77,7 +82,7 @@ class Opk:
         data_file = 'data.tar.' + compression
         tar_mode = 'w:' + compression
 
-        TEMP_FILES = ['control', control_file, data_file, 'preinst',
+        TEMP_FILES = ['control', 'conffiles', control_file, data_file, 'preinst',
                       'postinst', 'prerm', 'postrm', 'debian-binary']
 
         # process a final filename for the package
@@ -100,6 +105,11 @@ class Opk:
             for k in self.control.keys():
                 f.write('{}: {}\n'.format(k, self.control[k]))
 
+        if self.conffiles:
+            with open('conffiles', 'w') as f:
+                for cf in self.conffiles:
+                    f.write('{}\n'.format(cf))
+
         if self.preinst:
             with open('preinst', 'w') as f:
                 os.fchmod(f.fileno(), 0o755)
@@ -122,6 +132,7 @@ class Opk:
 
         with tarfile.open(control_file, tar_mode) as tar:
             tar.add('control')
+            if self.conffiles: tar.add('conffiles')
             if self.preinst: tar.add('preinst')
             if self.postinst: tar.add('postinst')
             if self.prerm: tar.add('prerm')
@@ -226,3 +237,94 @@ def regress_init():
     f.write('arch all 1\n')
     f.write('src test file:{}\n'.format(cfg.opkdir))
     f.close()
+
+
+class FeedRequestHandler(http.server.SimpleHTTPRequestHandler):
+    """Serves files with an ETag, answers conditional and ranged requests
+    like a real feed server would, and logs each request to the server."""
+
+    def etag(self, path):
+        st = os.stat(path)
+        return '"{:x}-{:x}"'.format(st.st_mtime_ns, st.st_size)
+
+    def send_head(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            return super().send_head()
+
+        etag = self.etag(path)
+        st = os.stat(path)
+        size = st.st_size
+        mtime = int(st.st_mtime)
+        since = self.headers.get('If-Modified-Since')
+        if self.headers.get('If-None-Match') == etag or (
+                since and 'If-None-Match' not in self.headers
+                and email.utils.parsedate_to_datetime(since).timestamp()
+                >= mtime):
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.end_headers()
+            return None
+
+        start = 0
+        ranged = self.headers.get('Range', '')
+        if ranged.startswith('bytes=') and \
+                self.headers.get('If-Range', etag) == etag:
+            start = int(ranged[6:].split('-')[0])
+            if start >= size:
+                self.send_response(416)
+                self.send_header('Content-Range', 'bytes */{}'.format(size))
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                return None
+            self.send_response(206)
+            self.send_header('Content-Range',
+                             'bytes {}-{}/{}'.format(start, size - 1, size))
+        else:
+            self.send_response(200)
+
+        f = open(path, 'rb')
+        f.seek(start)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(size - start))
+        self.send_header('Last-Modified', self.date_time_string(mtime))
+        self.send_header('ETag', etag)
+        self.end_headers()
+        return f
+
+    def log_request(self, code='-', size='-'):
+        self.server.requests.append((self.path, int(code)))
+
+    def log_message(self, format, *args):
+        pass
+
+
+class HttpServer:
+    """Serves cfg.opkdir on localhost."""
+
+    def __init__(self):
+        handler = functools.partial(FeedRequestHandler, directory=cfg.opkdir)
+        self.httpd = http.server.ThreadingHTTPServer(('127.0.0.1', 0),
+                                                     handler)
+        self.httpd.requests = []
+        self.url = 'http://127.0.0.1:{}'.format(self.httpd.server_address[1])
+        threading.Thread(target=self.httpd.serve_forever, daemon=True).start()
+
+    def requests(self):
+        """Returns the (path, status) of each request since the last call."""
+        requests = self.httpd.requests
+        self.httpd.requests = []
+        return requests
+
+
+def serve_feed():
+    """Points the test feed at an http server on localhost serving
+    cfg.opkdir rather than at the directory itself. Returns the server."""
+    server = HttpServer()
+    conffile = cfg.offline_root + os.environ['SYSCONFDIR'] + '/opkg/opkg.conf'
+    with open(conffile) as f:
+        conf = f.read()
+    with open(conffile, 'w') as f:
+        f.write(conf.replace('src test file:{}'.format(cfg.opkdir),
+                             'src test {}'.format(server.url)))
+    return server